@@ -0,0 +1,341 @@
+/*
+
+  This header defines a caching CPU allocator of the tensors created by atnn
+  (zeros_like outputs, grad_weight/grad_bias temporaries, accumulated grads).
+
+  NOTE:
+
+  - the same set of sizes is allocated and freed by every training step. freed blocks are kept in
+    size-class bins (4 classes per power of two) of the freeing thread, then of a shared pool,
+    and reused by the next step without malloc or page faults.
+  - requests above 3/4 of huge_page (2 MiB) are mapped from huge pages (MAP_HUGETLB, else transparent huge pages)
+    and cached by their size rounded up to huge_page.
+  - it is off by default: CachingAllocatorGuard or the environment variable ATNN_CACHING_ALLOCATOR=1 enables it.
+    the tensors of the other backends and the outputs of ATen ops are allocated as before.
+
+ */
+
+#pragma once
+
+#include <sys/mman.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "testing.hpp"
+
+namespace atnn {
+    namespace alloc {
+
+        /// the statistics of the blocks (in bytes of the size classes, not of the tensors)
+        struct Stats {
+            /// held by tensors
+            size_t live_bytes = 0;
+            /// freed by tensors and kept for reuse (the per-thread caches and the shared pool)
+            size_t cached_bytes = 0;
+            /// the highest live_bytes + cached_bytes since the last reset_stats
+            size_t peak_bytes = 0;
+            /// allocations served from the caches and from the system
+            uint64_t hits = 0, misses = 0;
+
+            double hit_rate() const {
+                return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+            }
+        };
+
+        namespace detail {
+            constexpr size_t min_block = 256;
+            constexpr size_t huge_page = size_t(2) << 20;
+            constexpr size_t alignment = 64;
+            /// 256 B, then 4 classes per power of two up to 3/4 of huge_page
+            constexpr size_t num_bins = 1 + 4 * 12 + 3;
+
+            inline bool is_huge(size_t bytes) {
+                return bytes > huge_page / 4 * 3;
+            }
+
+            inline size_t bin_of(size_t n) {
+                if (n <= min_block) return 0;
+                size_t p = 8; // 2^p < n <= 2^(p + 1)
+                while ((size_t(2) << p) < n) ++p;
+                const size_t quarter = size_t(1) << (p - 2);
+                const size_t k = (n - (size_t(1) << p) + quarter - 1) / quarter; // 1..4
+                return 1 + 4 * (p - 8) + (k - 1);
+            }
+
+            inline size_t bin_size(size_t bin) {
+                if (bin == 0) return min_block;
+                const size_t p = 8 + (bin - 1) / 4;
+                const size_t k = 1 + (bin - 1) % 4;
+                return (size_t(1) << p) + k * (size_t(1) << (p - 2));
+            }
+
+            inline size_t round_huge(size_t n) {
+                return (n + huge_page - 1) / huge_page * huge_page;
+            }
+
+            /// huge_page aligned mapping: explicit huge pages if reserved, else advised to be transparent huge pages
+            inline void* map_huge(size_t bytes) {
+#ifdef MAP_HUGETLB
+                void* p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p != MAP_FAILED) return p;
+#endif
+                // over-map by a huge page and trim both ends to the aligned range
+                const size_t padded = bytes + huge_page;
+                auto* raw = static_cast<char*>(::mmap(nullptr, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+                if (raw == MAP_FAILED) throw std::bad_alloc();
+                const auto addr = reinterpret_cast<uintptr_t>(raw);
+                auto* aligned = reinterpret_cast<char*>((addr + huge_page - 1) / huge_page * huge_page);
+                if (aligned > raw) ::munmap(raw, aligned - raw);
+                const size_t tail = raw + padded - (aligned + bytes);
+                if (tail > 0) ::munmap(aligned + bytes, tail);
+#ifdef MADV_HUGEPAGE
+                ::madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+                return aligned;
+            }
+
+            inline size_t element_size(at::ScalarType s) {
+                switch (s) {
+                case at::kByte: case at::kChar: return 1;
+                case at::kShort: case at::kHalf: return 2;
+                case at::kInt: case at::kFloat: return 4;
+                case at::kLong: case at::kDouble: return 8;
+                default: throw_with_trace(std::runtime_error("unknown scalar type"));
+                }
+                return 0;
+            }
+        }
+
+/**
+   size-class caching allocator. blocks freed by a thread go to its own cache first
+   (no lock) up to max_thread_cached bytes, the rest to the shared pool (one mutex).
+   a thread exiting hands its cache over to the shared pool.
+*/
+        struct CachingAllocator {
+            /// per-thread cache capacity
+            size_t max_thread_cached = size_t(64) << 20;
+
+            /// the process-wide instance. never destroyed: tensors and thread caches may outlive static destructors
+            static CachingAllocator& instance() {
+                static auto* a = new CachingAllocator;
+                return *a;
+            }
+
+            void* allocate(size_t bytes, size_t& block_bytes) {
+                void* p = nullptr;
+                const bool huge = detail::is_huge(bytes);
+                if (huge) {
+                    block_bytes = detail::round_huge(bytes);
+                    p = this->take_huge(block_bytes);
+                } else {
+                    const auto bin = detail::bin_of(bytes);
+                    block_bytes = detail::bin_size(bin);
+                    p = this->take_small(bin);
+                }
+                if (p) {
+                    ++this->hits;
+                    this->cached -= block_bytes;
+                } else {
+                    ++this->misses;
+                    if (huge) {
+                        p = detail::map_huge(block_bytes);
+                    } else if (::posix_memalign(&p, detail::alignment, block_bytes) != 0) {
+                        throw std::bad_alloc();
+                    }
+                }
+                this->update_peak(this->live += block_bytes);
+                return p;
+            }
+
+            void deallocate(void* p, size_t block_bytes) {
+                this->live -= block_bytes;
+                this->cached += block_bytes;
+                if (detail::is_huge(block_bytes)) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->huge.emplace(block_bytes, p);
+                    return;
+                }
+                const auto bin = detail::bin_of(block_bytes);
+                auto* cache = ThreadCache::get();
+                if (cache && cache->bytes + block_bytes <= this->max_thread_cached) {
+                    cache->bins[bin].push_back(p);
+                    cache->bytes += block_bytes;
+                } else {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->pool[bin].push_back(p);
+                }
+            }
+
+            /// returns the shared pool and the cache of the calling thread to the system
+            void empty_cache() {
+                if (auto* cache = ThreadCache::get()) this->flush(*cache);
+                std::lock_guard<std::mutex> lock(this->mutex);
+                for (size_t bin = 0; bin < detail::num_bins; ++bin) {
+                    for (auto p: this->pool[bin]) std::free(p);
+                    this->cached -= this->pool[bin].size() * detail::bin_size(bin);
+                    this->pool[bin].clear();
+                }
+                for (auto&& h: this->huge) {
+                    ::munmap(h.second, h.first);
+                    this->cached -= h.first;
+                }
+                this->huge.clear();
+            }
+
+            Stats stats() const {
+                Stats s;
+                s.live_bytes = this->live;
+                s.cached_bytes = this->cached;
+                s.peak_bytes = this->peak;
+                s.hits = this->hits;
+                s.misses = this->misses;
+                return s;
+            }
+
+            /// restarts the peak from the current usage and zeroes the hit counters
+            void reset_stats() {
+                this->peak = this->live + this->cached;
+                this->hits = 0;
+                this->misses = 0;
+            }
+
+        private:
+            struct ThreadCache {
+                std::array<std::vector<void*>, detail::num_bins> bins;
+                size_t bytes = 0;
+
+                ~ThreadCache() {
+                    destroyed() = true;
+                    CachingAllocator::instance().flush(*this);
+                }
+
+                /// nullptr while the thread is exiting (tensors freed by other thread_local destructors go to the pool)
+                static ThreadCache* get() {
+                    if (destroyed()) return nullptr;
+                    thread_local ThreadCache cache;
+                    return &cache;
+                }
+
+                static bool& destroyed() {
+                    thread_local bool flag = false;
+                    return flag;
+                }
+            };
+
+            void* take_small(size_t bin) {
+                if (auto* cache = ThreadCache::get()) {
+                    auto&& free = cache->bins[bin];
+                    if (!free.empty()) {
+                        auto p = free.back();
+                        free.pop_back();
+                        cache->bytes -= detail::bin_size(bin);
+                        return p;
+                    }
+                }
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto&& free = this->pool[bin];
+                if (free.empty()) return nullptr;
+                auto p = free.back();
+                free.pop_back();
+                return p;
+            }
+
+            /// the exact rounded size: the steps repeat the same large sizes
+            void* take_huge(size_t block_bytes) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto it = this->huge.find(block_bytes);
+                if (it == this->huge.end()) return nullptr;
+                auto p = it->second;
+                this->huge.erase(it);
+                return p;
+            }
+
+            void flush(ThreadCache& cache) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                for (size_t bin = 0; bin < detail::num_bins; ++bin) {
+                    auto&& free = cache.bins[bin];
+                    this->pool[bin].insert(this->pool[bin].end(), free.begin(), free.end());
+                    free.clear();
+                }
+                cache.bytes = 0;
+            }
+
+            void update_peak(size_t live_now) {
+                const size_t total = live_now + this->cached;
+                size_t prev = this->peak;
+                while (total > prev && !this->peak.compare_exchange_weak(prev, total)) {}
+            }
+
+            std::mutex mutex;
+            std::array<std::vector<void*>, detail::num_bins> pool;
+            std::multimap<size_t, void*> huge;
+            std::atomic<size_t> live {0}, cached {0}, peak {0};
+            std::atomic<uint64_t> hits {0}, misses {0};
+        };
+
+        /**
+           process-wide switch of the caching allocator (the tensors move across threads, e.g., pipeline.hpp).
+           the initial state is read from the environment variable ATNN_CACHING_ALLOCATOR.
+        */
+        struct CachingAllocatorMode {
+            static std::atomic<bool>& enabled() {
+                static std::atomic<bool> flag {[] {
+                        const char* env = std::getenv("ATNN_CACHING_ALLOCATOR");
+                        return env != nullptr && env[0] != '\0' && env[0] != '0';
+                    }()};
+                return flag;
+            }
+
+            static bool is_enabled() { return enabled(); }
+        };
+
+        struct CachingAllocatorGuard {
+            const bool prev = CachingAllocatorMode::enabled();
+            explicit CachingAllocatorGuard(bool enabled=true) { CachingAllocatorMode::enabled() = enabled; }
+            ~CachingAllocatorGuard() { CachingAllocatorMode::enabled() = this->prev; }
+        };
+
+        inline Stats stats() { return CachingAllocator::instance().stats(); }
+
+        inline void reset_stats() { CachingAllocator::instance().reset_stats(); }
+
+        inline void empty_cache() { CachingAllocator::instance().empty_cache(); }
+
+        /// uninitialized contiguous tensor, from the caching allocator if enabled and type is dense CPU
+        inline at::Tensor empty(const at::Type& type, at::IntList sizes) {
+            int64_t numel = 1;
+            for (auto s: sizes) numel *= s;
+            if (!CachingAllocatorMode::is_enabled() || type.backend() != at::kCPU || numel == 0) return type.tensor(sizes);
+            size_t block_bytes = 0;
+            auto& allocator = CachingAllocator::instance();
+            void* p = allocator.allocate(numel * detail::element_size(type.scalarType()), block_bytes);
+            return type.tensorFromBlob(p, sizes, [&allocator, block_bytes](void* q) { allocator.deallocate(q, block_bytes); });
+        }
+
+        inline at::Tensor zeros(const at::Type& type, at::IntList sizes) {
+            return empty(type, sizes).zero_();
+        }
+
+        inline at::Tensor empty_like(const at::Tensor& t) {
+            return empty(t.type(), t.sizes());
+        }
+
+        inline at::Tensor zeros_like(const at::Tensor& t) {
+            return zeros(t.type(), t.sizes());
+        }
+
+        inline at::Tensor clone(const at::Tensor& t) {
+            return empty_like(t).copy_(t);
+        }
+    }
+}
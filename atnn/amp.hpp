@@ -0,0 +1,201 @@
+/*
+
+  This header defines bf16 mixed-precision training
+
+  - BF16Autocast: rounds the inputs of the allowed module types (Linear, Conv2d) to bf16
+  - LossScaler: dynamic loss scaling applied by Variable::backward (see LossScale)
+  - MixedPrecision: fp32 master copies of the parameters, bf16 compute copies in the modules
+
+  amp::MixedPrecision mp(net);
+  {
+      amp::MixedPrecisionGuard guard(mp);
+      auto loss = net(x);
+      loss.clear_grads();
+      loss.backward(gy); // scaled
+  }
+  mp.step([&](at::Tensor w, at::Tensor g) { w -= lr * g; }); // skipped on inf/nan grads
+
+ */
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_set>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+#include "saved.hpp"
+
+namespace atnn {
+    namespace amp {
+
+        /// CPU float tensors rounded to the nearest bf16 (kept in float storage). the others are returned as they are
+        inline at::Tensor round_bf16(const at::Tensor& x) {
+            if (!x.defined() || x.type().backend() != at::kCPU || x.type().scalarType() != at::kFloat) return x;
+            const auto src = x.contiguous();
+            auto y = src.type().tensor(src.sizes());
+            const auto px = src.data<float>();
+            auto py = y.data<float>();
+            const long n = src.numel();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+            for (long i = 0; i < n; ++i) py[i] = saved::detail::from_bf16(saved::detail::to_bf16(px[i]));
+            return y;
+        }
+
+        using AllowList = std::unordered_set<std::type_index>;
+
+        /// the GEMM and convolution modules, whose products accumulate in fp32
+        inline AllowList default_allow_list() {
+            return {typeid(modules::Linear), typeid(modules::Conv2d)};
+        }
+
+/**
+   the inputs of the allowed modules are rounded to bf16 and their products accumulate in fp32.
+   the other modules (e.g., losses, BatchNorm statistics) run in fp32.
+*/
+        struct BF16Autocast : Autocast {
+            AllowList allow;
+
+            explicit BF16Autocast(AllowList allow=default_allow_list()) : allow(allow) {}
+
+            bool allows(const std::type_info& module) const override {
+                return this->allow.count(std::type_index(module)) > 0;
+            }
+
+            at::Tensor cast(const at::Tensor& x) const override { return round_bf16(x); }
+        };
+
+        struct LossScalerOptions {
+            float init_scale = 65536;
+            float growth_factor = 2;
+            float backoff_factor = 0.5;
+            long growth_interval = 2000; // steps without inf/nan before growing the scale
+        };
+
+/**
+   dynamic loss scaling: keeps small bf16/fp16 grads from flushing to zero.
+   the scale backs off on each step with inf/nan grads (the step is skipped)
+   and grows after growth_interval finite steps.
+*/
+        struct LossScaler {
+            LossScalerOptions options;
+            float scale;
+            long good_steps = 0;
+            long skipped_steps = 0;
+
+            explicit LossScaler(LossScalerOptions options={}) : options(options), scale(options.init_scale) {}
+
+            /// divides the grads by the scale in place. false if any of them has inf/nan
+            bool unscale(VList& parameters) const {
+                bool finite = true;
+                for (auto&& p: parameters) {
+                    auto&& g = p.ptr->grad;
+                    if (is_empty(g)) continue;
+                    g *= 1.0f / this->scale;
+                    finite = finite && std::isfinite(at::Scalar(g.sum()).toDouble());
+                }
+                return finite;
+            }
+
+            void update(bool finite) {
+                if (!finite) {
+                    this->scale *= this->options.backoff_factor;
+                    this->good_steps = 0;
+                    ++this->skipped_steps;
+                } else if (++this->good_steps >= this->options.growth_interval) {
+                    this->scale *= this->options.growth_factor;
+                    this->good_steps = 0;
+                }
+            }
+        };
+
+        struct MixedPrecisionOptions {
+            AllowList allow = default_allow_list();
+            bool bf16_saved_tensors = true; // pack the saved tensors with saved::HalfPolicy
+            size_t saved_min_numel = 4096;
+            LossScalerOptions scaler;
+        };
+
+/**
+   keeps fp32 master copies of the parameters of the allowed modules and rounds their data to bf16.
+   the other parameters are updated in place in fp32.
+
+   ATen has no bf16 tensors nor bf16 GEMM, so the compute copies and activations are bf16 values in
+   float storage: the arithmetic matches bf16 inputs with fp32 accumulation, and the saved tensors
+   (most of the activation memory) are stored in 16 bits by saved::HalfPolicy. the fp32 activations
+   still held by the user stay in memory until dropped (see Node::pack).
+*/
+        struct MixedPrecision {
+            MixedPrecisionOptions options;
+            std::shared_ptr<BF16Autocast> autocast;
+            std::shared_ptr<SavedTensorPolicy> saved_policy; // nullptr without bf16_saved_tensors
+            LossScaler scaler;
+            VList parameters;
+            TList masters; // undefined for the parameters kept in fp32
+
+            explicit MixedPrecision(ModulePtr model, MixedPrecisionOptions options={})
+                : options(options)
+                , autocast(std::make_shared<BF16Autocast>(options.allow))
+                , scaler(options.scaler) {
+                if (options.bf16_saved_tensors) {
+                    this->saved_policy = std::make_shared<saved::HalfPolicy>(saved::HalfPolicy::BF16, options.saved_min_numel);
+                }
+                model->for_each_module([this](ModuleBase& m, VList& ps) {
+                        const bool allowed = this->autocast->allows(typeid(m));
+                        for (auto&& p: ps) {
+                            if (!p.data().defined()) continue;
+                            this->parameters.push_back(p);
+                            this->masters.push_back(allowed ? p.data().clone() : at::Tensor());
+                            if (allowed) p.ptr->data.copy_(round_bf16(p.data()));
+                        }
+                    });
+            }
+
+            /// unscales the grads and calls update(weight, grad) with the fp32 weights unless they have inf/nan.
+            /// the grads are zeroed afterwards. returns false when the step was skipped
+            template <class F>
+            bool step(F update) {
+                const bool finite = this->scaler.unscale(this->parameters);
+                this->scaler.update(finite);
+                if (finite) this->apply(update);
+                for (auto&& p: this->parameters) p.zero_grad();
+                return finite;
+            }
+
+        private:
+            template <class F>
+            void apply(F update) {
+                for (size_t i = 0; i < this->parameters.size(); ++i) {
+                    auto&& p = this->parameters[i];
+                    if (is_empty(p.grad())) continue;
+                    auto&& master = this->masters[i];
+                    if (!master.defined()) {
+                        update(p.data(), p.grad());
+                        continue;
+                    }
+                    update(master, p.grad());
+                    p.ptr->data.copy_(round_bf16(master));
+                }
+            }
+        };
+
+        /// runs forward with autocast and bf16 saved tensors, and backward with the loss scale
+        struct MixedPrecisionGuard {
+            AutocastGuard autocast;
+            SavedTensorPolicyGuard saved;
+            LossScaleGuard scale;
+
+            explicit MixedPrecisionGuard(const MixedPrecision& mp)
+                : autocast(mp.autocast), saved(mp.saved_policy), scale(mp.scaler.scale) {}
+        };
+
+    } // namespace amp
+} // namespace atnn
@@ -0,0 +1,215 @@
+/*
+
+  This header defines memory-efficient scaled dot-product attention for CPU training
+
+  - Attention: softmax(q k^T * scale) v over (batch, heads, length, dim) inputs without the (length x length) matrix.
+    forward streams the keys in tiles with an online softmax and saves the log-sum-exp of each query only,
+    backward recomputes the probabilities tile by tile. the (batch x head) pairs run in parallel
+
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "testing.hpp"
+
+namespace atnn {
+    namespace attention {
+
+        namespace detail {
+            /// the shapes of one (batch, head) pair
+            struct Head {
+                long lq, lk, d, dv;
+                long query_tile, key_tile;
+                float scale;
+                bool causal;
+
+                /// the keys [0, end) visible to the queries [i, i + rows)
+                long key_end(long i, long rows) const {
+                    return this->causal ? std::min(this->lk, i + rows) : this->lk;
+                }
+
+                bool masked(long i, long j) const { return this->causal && j > i; }
+            };
+
+            /// s (rows x cols) = q[i ...] k[j ...]^T * scale, -inf where masked
+            inline void scores(const Head& h, const float* q, const float* k, long i, long rows, long j, long cols, float* s) {
+                for (long r = 0; r < rows; ++r) {
+                    const auto qr = q + (i + r) * h.d;
+                    for (long c = 0; c < cols; ++c) {
+                        const auto kc = k + (j + c) * h.d;
+                        float acc = 0;
+                        for (long e = 0; e < h.d; ++e) acc += qr[e] * kc[e];
+                        s[r * cols + c] = h.masked(i + r, j + c) ? -std::numeric_limits<float>::infinity() : acc * h.scale;
+                    }
+                }
+            }
+
+            /// o = softmax(q k^T * scale) v and lse = log sum exp of each row of the scores
+            inline void forward(const Head& h, const float* q, const float* k, const float* v, float* o, float* lse) {
+                std::vector<float> s(h.query_tile * h.key_tile), m(h.query_tile), l(h.query_tile);
+                for (long i = 0; i < h.lq; i += h.query_tile) {
+                    const long rows = std::min(h.query_tile, h.lq - i);
+                    std::fill(m.begin(), m.end(), -std::numeric_limits<float>::infinity());
+                    std::fill(l.begin(), l.end(), 0.0f);
+                    std::fill(o + i * h.dv, o + (i + rows) * h.dv, 0.0f);
+                    const long end = h.key_end(i, rows);
+                    for (long j = 0; j < end; j += h.key_tile) {
+                        const long cols = std::min(h.key_tile, end - j);
+                        scores(h, q, k, i, rows, j, cols, s.data());
+                        for (long r = 0; r < rows; ++r) {
+                            auto sr = s.data() + r * cols;
+                            const float tile_max = *std::max_element(sr, sr + cols);
+                            const float m_new = std::max(m[r], tile_max);
+                            if (m_new == -std::numeric_limits<float>::infinity()) continue; // all masked so far
+                            const float correction = std::exp(m[r] - m_new); // rescales the previous tiles
+                            auto orow = o + (i + r) * h.dv;
+                            for (long e = 0; e < h.dv; ++e) orow[e] *= correction;
+                            float sum = 0;
+                            for (long c = 0; c < cols; ++c) {
+                                const float p = std::exp(sr[c] - m_new);
+                                sum += p;
+                                const auto vc = v + (j + c) * h.dv;
+                                for (long e = 0; e < h.dv; ++e) orow[e] += p * vc[e];
+                            }
+                            l[r] = l[r] * correction + sum;
+                            m[r] = m_new;
+                        }
+                    }
+                    for (long r = 0; r < rows; ++r) {
+                        auto orow = o + (i + r) * h.dv;
+                        for (long e = 0; e < h.dv; ++e) orow[e] /= l[r];
+                        lse[i + r] = m[r] + std::log(l[r]);
+                    }
+                }
+            }
+
+            /// dq, dk, dv (zeroed) of one head. p = exp(s - lse) is recomputed per tile, ds = p * (do v^T - rowsum(do * o))
+            inline void backward(const Head& h, const float* q, const float* k, const float* v, const float* o,
+                                 const float* lse, const float* go, float* dq, float* dk, float* dv) {
+                std::vector<float> s(h.query_tile * h.key_tile), delta(h.lq);
+                for (long r = 0; r < h.lq; ++r) {
+                    float acc = 0;
+                    for (long e = 0; e < h.dv; ++e) acc += go[r * h.dv + e] * o[r * h.dv + e];
+                    delta[r] = acc;
+                }
+                for (long i = 0; i < h.lq; i += h.query_tile) {
+                    const long rows = std::min(h.query_tile, h.lq - i);
+                    const long end = h.key_end(i, rows);
+                    for (long j = 0; j < end; j += h.key_tile) {
+                        const long cols = std::min(h.key_tile, end - j);
+                        scores(h, q, k, i, rows, j, cols, s.data());
+                        for (long r = 0; r < rows; ++r) {
+                            const auto gor = go + (i + r) * h.dv;
+                            const auto qr = q + (i + r) * h.d;
+                            auto dqr = dq + (i + r) * h.d;
+                            for (long c = 0; c < cols; ++c) {
+                                const float p = std::exp(s[r * cols + c] - lse[i + r]); // 0 where masked
+                                if (p == 0) continue;
+                                const auto vc = v + (j + c) * h.dv;
+                                auto dvc = dv + (j + c) * h.dv;
+                                float dp = 0;
+                                for (long e = 0; e < h.dv; ++e) {
+                                    dvc[e] += p * gor[e];
+                                    dp += gor[e] * vc[e];
+                                }
+                                const float ds = p * (dp - delta[i + r]) * h.scale;
+                                const auto kc = k + (j + c) * h.d;
+                                auto dkc = dk + (j + c) * h.d;
+                                for (long e = 0; e < h.d; ++e) {
+                                    dqr[e] += ds * kc[e];
+                                    dkc[e] += ds * qr[e];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        } // namespace detail
+
+/**
+   multi-head scaled dot-product attention: y = softmax(q k^T * scale) v for each (batch, head).
+   q (batch, heads, queries, dim), k (batch, heads, keys, dim) and v (batch, heads, keys, value dim) are CPU float.
+
+   the memory saved for backward is q, k, v, y and one log-sum-exp per query: linear in the length.
+   each thread holds one (query_tile x key_tile) score tile. causal masks the keys after each query (queries == keys).
+*/
+        struct Attention : atnn::Module<Attention> {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<3> xs) {
+                    const auto q = xs[0].contiguous(), k = xs[1].contiguous(), v = xs[2].contiguous();
+                    const auto h = ctx->head(q, k, v);
+                    const long heads = q.size(0) * q.size(1);
+                    auto y = q.type().tensor({q.size(0), q.size(1), h.lq, h.dv});
+                    auto lse = q.type().tensor({q.size(0), q.size(1), h.lq});
+                    const auto pq = q.template data<float>(), pk = k.template data<float>(), pv = v.template data<float>();
+                    auto py = y.template data<float>(), plse = lse.template data<float>();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long n = 0; n < heads; ++n) {
+                        detail::forward(h, pq + n * h.lq * h.d, pk + n * h.lk * h.d, pv + n * h.lk * h.dv,
+                                        py + n * h.lq * h.dv, plse + n * h.lq);
+                    }
+                    ctx->save_for_backward({q, k, v, y, lse});
+                    return y;
+                }
+
+                template <typename Context>
+                static atnn::TArray<3> backward(Context ctx, atnn::TArray<1> gy) {
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    auto&& saved = ctx->saved_tensors;
+                    const auto q = saved[0], k = saved[1], v = saved[2], y = saved[3], lse = saved[4];
+                    const auto go = gy[0].contiguous();
+                    ATNN_ASSERT_SHAPE_EQ(go.sizes(), y.sizes());
+                    const auto h = ctx->head(q, k, v);
+                    const long heads = q.size(0) * q.size(1);
+                    auto dq = q.type().zeros_like(q), dk = k.type().zeros_like(k), dv = v.type().zeros_like(v);
+                    const auto pq = q.template data<float>(), pk = k.template data<float>(), pv = v.template data<float>();
+                    const auto py = y.template data<float>(), plse = lse.template data<float>(), pgo = go.template data<float>();
+                    auto pdq = dq.template data<float>(), pdk = dk.template data<float>(), pdv = dv.template data<float>();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long n = 0; n < heads; ++n) { // the grads of different heads do not overlap
+                        detail::backward(h, pq + n * h.lq * h.d, pk + n * h.lk * h.d, pv + n * h.lk * h.dv,
+                                         py + n * h.lq * h.dv, plse + n * h.lq, pgo + n * h.lq * h.dv,
+                                         pdq + n * h.lq * h.d, pdk + n * h.lk * h.d, pdv + n * h.lk * h.dv);
+                    }
+                    return {dq, dk, dv};
+                }
+            };
+
+            bool causal;
+            long query_tile, key_tile;
+            float scale; // <= 0: 1 / sqrt(dim)
+
+            explicit Attention(bool causal=false, long query_tile=64, long key_tile=64, float scale=0)
+                : causal(causal), query_tile(query_tile), key_tile(key_tile), scale(scale) {
+                ATNN_ASSERT(query_tile > 0 && key_tile > 0);
+            }
+
+            detail::Head head(const at::Tensor& q, const at::Tensor& k, const at::Tensor& v) const {
+                for (auto&& t: {q, k, v}) {
+                    ATNN_ASSERT_MSG(t.type().backend() == at::kCPU && t.type().scalarType() == at::kFloat,
+                                    "Attention runs on CPU float tensors");
+                    ATNN_ASSERT_EQ(t.dim(), 4);
+                }
+                ATNN_ASSERT(q.size(0) == k.size(0) && q.size(1) == k.size(1) && q.size(3) == k.size(3));
+                ATNN_ASSERT(v.size(0) == k.size(0) && v.size(1) == k.size(1) && v.size(2) == k.size(2));
+                ATNN_ASSERT_MSG(!this->causal || q.size(2) == k.size(2), "causal attention needs as many queries as keys");
+                const float scale = this->scale > 0 ? this->scale : 1.0f / std::sqrt(static_cast<float>(q.size(3)));
+                return {q.size(2), k.size(2), q.size(3), v.size(3), this->query_tile, this->key_tile, scale, this->causal};
+            }
+        };
+
+    } // namespace attention
+} // namespace atnn
@@ -1,17 +1,29 @@
 #pragma once
 
 #include <assert.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <vector>
 #include <memory>
+#include <functional>
 #include <iostream>
 #include <set>
+#include <stdexcept>
+#include <string>
 #include <unordered_set>
 #include <unordered_map>
 #include <queue>
 
 #include <tuple>
+#include <typeinfo>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include <ATen/ATen.h>
 
+#include "allocator.hpp"
+#include "small_vector.hpp"
 #include "tuple.hpp"
 #include "testing.hpp"
 
@@ -19,25 +31,310 @@ namespace atnn {
     struct Variable;
     using VList = std::vector<Variable>;
     using TList = std::vector<at::Tensor>;
+    /// fixed-arity alternative of TList in Function::forward/backward (no heap allocation)
+    template <size_t N>
+    using TArray = std::array<at::Tensor, N>;
+    /// grads through the type-erased ModuleBase::backward
+    using GradList = SmallVector<at::Tensor, 2>;
 
-    struct ModuleBase : std::enable_shared_from_this<ModuleBase> {
-        TList saved_tensors;
-        VList vargs, vrets;
-        virtual TList backward(TList grads) = 0;
-        virtual void toBackend(at::Backend b) = 0;
+    /**
+       thread-local switch of tape recording.
+       modules running under NoGradGuard neither save tensors for backward nor link Variables.
+    */
+    struct GradMode {
+        static bool& enabled() {
+            thread_local bool flag = true;
+            return flag;
+        }
+
+        static bool is_enabled() { return enabled(); }
+    };
+
+    struct NoGradGuard {
+        const bool prev = GradMode::enabled();
+        NoGradGuard() { GradMode::enabled() = false; }
+        ~NoGradGuard() { GradMode::enabled() = this->prev; }
+    };
+
+    /**
+       thread-local switch of lazy execution (see lazy.hpp).
+       pointwise modules running under LazyGuard are recorded and fused instead of executed.
+    */
+    struct LazyMode {
+        static bool& enabled() {
+            thread_local bool flag = false;
+            return flag;
+        }
+
+        static bool is_enabled() { return enabled(); }
+    };
+
+    struct LazyGuard {
+        const bool prev = LazyMode::enabled();
+        LazyGuard() { LazyMode::enabled() = true; }
+        ~LazyGuard() { LazyMode::enabled() = this->prev; }
+    };
+
+    /**
+       thread-local switch of forward-mode differentiation.
+       modules running under ForwardModeGuard propagate the tangents of their inputs and parameters
+       through Function::jvp alongside forward. no tape is recorded, so the memory does not grow with the depth.
+    */
+    struct ForwardMode {
+        static bool& enabled() {
+            thread_local bool flag = false;
+            return flag;
+        }
+
+        static bool is_enabled() { return enabled(); }
+    };
+
+    struct ForwardModeGuard {
+        const bool prev = ForwardMode::enabled();
+        ForwardModeGuard() { ForwardMode::enabled() = true; }
+        ~ForwardModeGuard() { ForwardMode::enabled() = this->prev; }
+    };
+
+    struct VariableImpl;
+
+    namespace lazy {
+        /// an elementwise module recorded in lazy mode. Functions declare it by `static lazy::Op pointwise(Context)`
+        struct Op {
+            enum Kind { Sigmoid, Tanh, Threshold, Scale, Add } kind;
+            float a = 0, b = 0;  // threshold and value, or the scale factor
+            size_t operand = 0;  // Add: the other input in Fused::operands
+
+            size_t arity() const { return this->kind == Add ? 2 : 1; }
+        };
+
+        struct Fused;
+
+        /// computes the pending ops of v into v.data
+        void materialize(VariableImpl& v);
+
+        template <class ... Args>
+        Variable record(Op op, Args ... args);
+
+        template <class M, class = void>
+        struct IsPointwise : std::false_type {};
+
+        template <class M>
+        struct IsPointwise<M, decltype((void) M::Function::template pointwise<M*>(std::declval<M*>()))> : std::true_type {};
+    }
+
+    /// Functions declare forward-mode differentiation by `static auto jvp(Context, inputs, outputs, input tangents)`
+    template <class M, class = void>
+    struct HasJvp : std::false_type {};
+
+    template <class M>
+    struct HasJvp<M, decltype((void) &M::Function::template jvp<M*>)> : std::true_type {};
+
+    /// incremented by each in-place write through Module::forward (Function calls ctx->mark_dirty)
+    struct VersionCounter {
+        std::atomic<uint64_t> value{0};
+    };
+
+    /// the version of a saved tensor when it was saved
+    struct SavedVersion {
+        std::shared_ptr<VersionCounter> counter;
+        uint64_t version;
+    };
+
+    inline void check_versions(const std::vector<SavedVersion>& saved) {
+        for (auto&& s: saved) {
+            if (s.counter->value != s.version) {
+                throw_with_trace(std::runtime_error(
+                    "a tensor saved for backward was modified by an in-place operation (version "
+                    + std::to_string(s.counter->value) + ", saved at " + std::to_string(s.version) + ")"));
+            }
+        }
+    }
+
+    inline bool same_tensor(const at::Tensor& a, const at::Tensor& b) {
+        return a.defined() && b.defined() && a.unsafeGetTH(false) == b.unsafeGetTH(false);
+    }
+
+    /// a saved tensor stored by a SavedTensorPolicy until backward
+    struct PackedTensor {
+        virtual ~PackedTensor() {}
+        /// starts restoring in the background (called before the backward of the parent node)
+        virtual void prefetch() {}
+        virtual at::Tensor unpack() = 0;
+        /// false for rounding formats: the Variables aliasing the saved tensor keep their exact data while held by the user
+        virtual bool lossless() const { return true; }
+
+        /// unpack() once, shared by the Node and the Variables aliasing the saved tensor until release()
+        at::Tensor restored() {
+            if (!this->cache.defined()) this->cache = this->unpack();
+            return this->cache;
+        }
+
+        void release() { this->cache = at::Tensor(); }
+
+    private:
+        at::Tensor cache;
     };
 
+    using PackedTensorPtr = std::shared_ptr<PackedTensor>;
+
     struct VariableImpl {
         at::Tensor data, grad;
-        VariableImpl(at::Tensor data) : data(data) {}
+        // shared with the outputs of in-place Functions, which alias data
+        std::shared_ptr<VersionCounter> version = std::make_shared<VersionCounter>();
+        bool grad_borrowed = false; // grad aliases a tensor owned elsewhere: accumulate out of place once
+        std::shared_ptr<lazy::Fused> pending; // set until a lazy result is observed
+        bool owned = false; // data was allocated by the lazy executor and may be reused in place
+        PackedTensorPtr packed; // set while data is held by a SavedTensorPolicy instead
+        std::atomic<int> graph_refs {0}; // Node::vargs entries holding this Variable (see Node::pack)
+        at::Tensor tangent; // forward mode: the directional derivative of data (undefined: zero)
+        // leaves: trainable. outputs: computed in forward (any input or parameter requires grad)
+        bool requires_grad = true;
+        VariableImpl(at::Tensor data, bool requires_grad=true) : data(data), requires_grad(requires_grad) {}
+
+        /// restores data released to a SavedTensorPolicy
+        void unpack();
     };
 
-    using ModulePtr = std::shared_ptr<ModuleBase>;
+    struct Node;
+    using NodePtr = std::shared_ptr<Node>;
+
+/**
+   storage of saved tensors between forward and backward (e.g., compression or spilling, see saved.hpp).
+   enabled per thread by SavedTensorPolicyGuard, and applied to each Node at the end of its forward.
+*/
+    struct SavedTensorPolicy {
+        virtual ~SavedTensorPolicy() {}
+        /// nullptr keeps t as is
+        virtual PackedTensorPtr pack(const at::Tensor& t) = 0;
+
+        static std::shared_ptr<SavedTensorPolicy>& current() {
+            thread_local std::shared_ptr<SavedTensorPolicy> policy;
+            return policy;
+        }
+    };
+
+    struct SavedTensorPolicyGuard {
+        const std::shared_ptr<SavedTensorPolicy> prev = SavedTensorPolicy::current();
+        explicit SavedTensorPolicyGuard(std::shared_ptr<SavedTensorPolicy> p) { SavedTensorPolicy::current() = p; }
+        ~SavedTensorPolicyGuard() { SavedTensorPolicy::current() = this->prev; }
+    };
+
+/**
+   mixed precision of module calls (see amp.hpp), enabled per thread by AutocastGuard.
+   the input tensors of the module types it allows are cast before Function::forward.
+*/
+    struct Autocast {
+        virtual ~Autocast() {}
+        /// `module` is the type of the Module (e.g., typeid(modules::Linear))
+        virtual bool allows(const std::type_info& module) const = 0;
+        virtual at::Tensor cast(const at::Tensor& x) const = 0;
+
+        static std::shared_ptr<Autocast>& current() {
+            thread_local std::shared_ptr<Autocast> autocast;
+            return autocast;
+        }
+    };
+
+    struct AutocastGuard {
+        const std::shared_ptr<Autocast> prev = Autocast::current();
+        explicit AutocastGuard(std::shared_ptr<Autocast> a) { Autocast::current() = a; }
+        ~AutocastGuard() { Autocast::current() = this->prev; }
+    };
+
+    /// thread-local factor of the grad passed to Variable::backward (see amp::LossScaler)
+    struct LossScale {
+        static float& current() {
+            thread_local float scale = 1;
+            return scale;
+        }
+    };
+
+    struct LossScaleGuard {
+        const float prev = LossScale::current();
+        explicit LossScaleGuard(float scale) { LossScale::current() = scale; }
+        ~LossScaleGuard() { LossScale::current() = this->prev; }
+    };
+
+/**
+   intra-op (OpenMP) threads of the ATen/TH ops run by modules (see threading.hpp).
+   the outermost module call on a thread applies the process-wide count, and ModuleBase::num_threads
+   overrides it during the forward/backward of that module and the modules it calls.
+*/
+    struct IntraOp {
+        /// 0: the OpenMP default
+        static std::atomic<int>& threads() {
+            static std::atomic<int> n{0};
+            return n;
+        }
+
+        static int& depth() {
+            thread_local int d = 0;
+            return d;
+        }
+    };
+
+    struct IntraOpGuard {
+        int prev = 0;
+
+        explicit IntraOpGuard(int n) {
+            if (n <= 0 && IntraOp::depth() == 0) n = IntraOp::threads();
+            ++IntraOp::depth();
+#ifdef _OPENMP
+            if (n > 0 && n != omp_get_max_threads()) {
+                this->prev = omp_get_max_threads();
+                omp_set_num_threads(n);
+            }
+#endif
+        }
+
+        ~IntraOpGuard() {
+            --IntraOp::depth();
+#ifdef _OPENMP
+            if (this->prev > 0) omp_set_num_threads(this->prev);
+#endif
+        }
+    };
+
+    /// thread-local factor of the parameter grads added by accumulate_grad (e.g., 1 / micro-batches)
+    struct GradAccumulation {
+        static float& scale() {
+            thread_local float s = 1;
+            return s;
+        }
+    };
+
+    struct GradAccumulationGuard {
+        const float prev = GradAccumulation::scale();
+        explicit GradAccumulationGuard(float scale) { GradAccumulation::scale() = scale; }
+        ~GradAccumulationGuard() { GradAccumulation::scale() = this->prev; }
+    };
+
+/**
+   per-example parameter grads (see per_sample.hpp), enabled per thread by PerSampleGuard.
+   the backward of Linear and Conv2d hands its saved inputs and output grads to it
+   instead of accumulating the grads of the batch.
+*/
+    struct PerSampleGrad {
+        virtual ~PerSampleGrad() {}
+        /// x (n, in features, positions) and gy (n, out features, positions): the weight grad of example i is gy[i] x[i]^T
+        /// and the bias grad is gy[i] summed over the positions (1 for Linear, the output pixels for Conv2d)
+        virtual void add(const Variable& weight, const Variable& bias, const at::Tensor& x, const at::Tensor& gy) = 0;
+
+        static std::shared_ptr<PerSampleGrad>& current() {
+            thread_local std::shared_ptr<PerSampleGrad> p;
+            return p;
+        }
+    };
+
+    struct PerSampleGuard {
+        const std::shared_ptr<PerSampleGrad> prev = PerSampleGrad::current();
+        explicit PerSampleGuard(std::shared_ptr<PerSampleGrad> p) { PerSampleGrad::current() = p; }
+        ~PerSampleGuard() { PerSampleGrad::current() = this->prev; }
+    };
 
     struct Variable {
-        bool train = true;
         std::shared_ptr<VariableImpl> ptr;
-        ModulePtr module;
+        NodePtr node;
 
         struct Hash {
             size_t operator()(const Variable& v) const {
@@ -66,12 +363,18 @@ namespace atnn {
 
         Variable() {}
 
+        /// train = false: a leaf without grad (e.g., input images or frozen parameters)
         Variable(at::Tensor data, bool train=true)
-            : train(train), ptr(std::make_shared<VariableImpl>(data)) {}
+            : ptr(std::make_shared<VariableImpl>(data, train)) {}
 
         Variable& operator=(const Variable&) = default;
 
         auto data() const {
+            if (this->ptr->pending) lazy::materialize(*this->ptr);
+            if (this->ptr->packed) this->ptr->unpack();
+            // observed: no longer reusable by the lazy executor. only written when set, so concurrent forwards
+            // reading shared parameters (never owned) do not write to them
+            if (this->ptr->owned) this->ptr->owned = false;
             return this->ptr->data;
         }
 
@@ -79,61 +382,385 @@ namespace atnn {
             return this->ptr->grad;
         }
 
+        /// backward skips the Variables (and the subgraphs behind them) without it
+        bool requires_grad() const { return this->ptr->requires_grad; }
+
+        Variable& set_requires_grad(bool r) {
+            this->ptr->requires_grad = r;
+            return *this;
+        }
+
+        /// propagated under ForwardModeGuard (see Function::jvp)
+        at::Tensor tangent() const { return this->ptr->tangent; }
+
+        /// the direction of the input or parameter in forward mode. an undefined tensor clears it
+        Variable& set_tangent(at::Tensor t) {
+            if (t.defined()) ATNN_ASSERT_SHAPE_EQ(t.sizes(), this->data().sizes());
+            this->ptr->tangent = t;
+            return *this;
+        }
+
         auto sizes() const {
-            return this->ptr->data.sizes();
+            return this->data().sizes();
         }
 
-        void clear_grads() {
-            this->ptr->grad = at::Tensor();
-            if (!this->is_leaf()) {
-                for (auto& v: this->children()) {
-                    v.clear_grads();
-                }
+        void clear_grads();
+
+        /// zeroes the grad in place to reuse its buffer (a borrowed grad is released instead).
+        /// for parameters and leaves: a defined grad of an intermediate Variable means that it has arrived
+        void zero_grad() {
+            if (!is_empty(this->ptr->grad) && !this->ptr->grad_borrowed) {
+                this->ptr->grad.zero_();
+            } else {
+                this->ptr->grad = at::Tensor();
+                this->ptr->grad_borrowed = false;
             }
         }
 
-        auto& set_module(ModulePtr m) {
-            this->module = m;
+        auto& set_node(NodePtr n) {
+            this->node = n;
             return *this;
         }
 
-        bool is_leaf() const { return this->module == nullptr; }
+        bool is_leaf() const { return this->node == nullptr; }
 
-        VList& children() { return this->module->vargs; }
+        auto& children();
 
-        VList& brothers() { return this->module->vrets; }
+        /// grad is multiplied by the current LossScale
+        void backward(at::Tensor grad);
 
-        auto backward(at::Tensor grad) {
-            ATNN_ASSERT_SHAPE_EQ(this->sizes(), grad.sizes());
-            if (is_empty(this->ptr->grad)) {
-                this->ptr->grad = grad.clone();
-            } else {
-                this->ptr->grad += grad;
+        /// adds grad and propagates once all the outputs of the node have theirs
+        void accumulate(at::Tensor grad);
+
+        auto backward() {
+            
+        }
+    };
+
+    struct ModuleBase;
+    using ModulePtr = std::shared_ptr<ModuleBase>;
+
+/**
+   Node is the tape of one module call (an edge from vargs to vrets in the graph).
+   it lives outside of the module, so a module can be applied many times (e.g., RNN)
+   and from many threads at once without locks.
+*/
+    struct Node {
+        ModulePtr module;
+        SmallVector<Variable, 2> vargs;
+        // weak to avoid the cycle Variable -> Node -> Variable. expired outputs get undefined grads
+        SmallVector<std::weak_ptr<VariableImpl>, 2> vrets;
+        TList saved_tensors;
+        // saved_tensors of each stage when the module chains other Functions statically (Sequential)
+        std::vector<TList> stage_tensors;
+        TList dirty; // inputs written in place by Function::forward
+        std::vector<SavedVersion> saved_versions; // of saved tensors aliasing vargs or vrets
+
+        // saved_tensors then stage_tensors (flattened) replaced by the policy. nullptr entries stay in place
+        std::vector<PackedTensorPtr> packed;
+
+        ~Node() {
+            for (auto&& v: this->vargs) --v.ptr->graph_refs;
+        }
+
+        void add_varg(const Variable& v) {
+            ++v.ptr->graph_refs;
+            this->vargs.push_back(v);
+        }
+
+        /// bumps the versions of dirty inputs and records those of the saved tensors. called at the end of forward
+        void commit_versions();
+
+        /// moves the saved tensors into the policy's storage
+        void pack(SavedTensorPolicy& policy);
+
+        /// restores the packed tensors (unpack = true) or drops the restored copies
+        void restore(bool unpack);
+
+        void prefetch() {
+            for (auto&& p: this->packed) {
+                if (p) p->prefetch();
+            }
+        }
+
+        GradList backward(const GradList& grads);
+    };
+
+    /// the node of the module call running Function::forward/backward on this thread
+    inline Node*& current_node() {
+        thread_local Node* node = nullptr;
+        return node;
+    }
+
+    struct NodeScope {
+        Node* const prev = current_node();
+        explicit NodeScope(Node* node) { current_node() = node; }
+        ~NodeScope() { current_node() = this->prev; }
+    };
+
+/**
+   `ctx->saved_tensors` in Function::forward/backward.
+   it refers to the saved tensors of the running call instead of storing them in the module.
+*/
+    struct SavedTensors {
+        TList& get() const {
+            auto node = current_node();
+            ATNN_ASSERT_MSG(node != nullptr, "saved_tensors is only available inside Function::forward/backward");
+            return node->saved_tensors;
+        }
+
+        operator TList() const { return this->get(); }
+        at::Tensor& operator[](size_t i) const { return this->get()[i]; }
+        size_t size() const { return this->get().size(); }
+        bool empty() const { return this->get().empty(); }
+        auto begin() const { return this->get().begin(); }
+        auto end() const { return this->get().end(); }
+    };
+
+    /// called with the input and output tensors of each forward/predict (e.g., calibration observers)
+    using ForwardHook = std::function<void(const TList& inputs, const TList& outputs)>;
+
+    struct ModuleBase : std::enable_shared_from_this<ModuleBase> {
+        SavedTensors saved_tensors;
+        std::vector<std::shared_ptr<ForwardHook>> forward_hooks;
+        int num_threads = 0; // intra-op threads during forward/backward (0: inherited, see IntraOp)
+        virtual GradList backward(const GradList& grads) = 0;
+        virtual void toBackend(at::Backend b) = 0;
+        /// type-erased Module::predict
+        virtual TList infer(TList xs) = 0;
+
+        /// type-erased forward of modules with one input and one output (e.g., the stages of pipeline.hpp)
+        virtual Variable forward_unary(Variable x) {
+            ATNN_ASSERT_MSG(false, "not a module with one input and one output");
+            return x;
+        }
+
+        using Visitor = std::function<void(ModuleBase& module, VList& parameters)>;
+        /// calls f on this module and its submodules
+        virtual void for_each_module(const Visitor& f) {
+            VList none;
+            f(*this, none);
+        }
+
+        /// any parameter of this module or its submodules requires grad
+        bool has_trainable_parameters() {
+            bool found = false;
+            this->for_each_module([&](ModuleBase&, VList& ps) {
+                    for (auto&& p: ps) found = found || (p.ptr->data.defined() && p.requires_grad());
+                });
+            return found;
+        }
+
+        /// freezes (false) or unfreezes the parameters of this module and its submodules
+        void set_requires_grad(bool r) {
+            this->for_each_module([=](ModuleBase&, VList& ps) {
+                    for (auto&& p: ps) p.set_requires_grad(r);
+                });
+        }
+    };
+
+    inline GradList Node::backward(const GradList& grads) {
+        check_versions(this->saved_versions);
+        this->restore(true);
+        // the inputs' nodes run backward next
+        for (auto&& v: this->vargs) {
+            if (v.node) v.node->prefetch();
+        }
+        GradList gxs;
+        {
+            NodeScope scope(this);
+            IntraOpGuard threads(this->module->num_threads);
+            gxs = this->module->backward(grads);
+        }
+        this->restore(false);
+        return gxs;
+    }
+
+    template <class F>
+    void for_each_saved(Node& node, F f) {
+        for (auto&& t: node.saved_tensors) f(t);
+        for (auto&& ts: node.stage_tensors) {
+            for (auto&& t: ts) f(t);
+        }
+    }
+
+    inline void VariableImpl::unpack() {
+        this->data = this->packed->restored();
+        this->packed.reset();
+    }
+
+    namespace detail {
+        /// an intermediate input whose saved copy was packed by a rounding format
+        struct LossyPacked {
+            std::weak_ptr<VariableImpl> var;
+            const void* data; // the packed tensor, still the data of var
+            uint64_t version;
+            PackedTensorPtr packed;
+        };
+
+        inline std::vector<LossyPacked>& lossy_packed() {
+            thread_local std::vector<LossyPacked> pending;
+            return pending;
+        }
+
+        /// releases the data of the pending Variables that only the graph holds (no longer observable as exact)
+        inline void release_lossy_packed() {
+            auto& pending = lossy_packed();
+            size_t kept = 0;
+            for (auto&& e: pending) {
+                auto v = e.var.lock();
+                if (!v || v->packed || !v->data.defined() || v->data.unsafeGetTH(false) != e.data
+                    || v->version->value != e.version) continue;
+                if (v.use_count() == 1 + v->graph_refs) {
+                    v->data = at::Tensor();
+                    v->packed = e.packed;
+                    continue;
+                }
+                pending[kept++] = std::move(e);
             }
+            pending.resize(kept);
+        }
+    }
 
-            if (this->is_leaf()) return; // stop the recursion
+    /// the data of intermediate inputs is released too (restored when observed): the graph keeps them alive.
+    /// with rounding formats, it is released later, once the user no longer holds the Variable,
+    /// so that the Variables held by the user do not change
+    inline void Node::pack(SavedTensorPolicy& policy) {
+        detail::release_lossy_packed();
+        for_each_saved(*this, [&](at::Tensor& t) {
+                auto p = t.defined() ? policy.pack(t) : nullptr;
+                if (p) {
+                    for (auto&& v: this->vargs) {
+                        if (v.is_leaf() || !same_tensor(v.ptr->data, t)) continue;
+                        if (p->lossless()) {
+                            v.ptr->data = at::Tensor();
+                            v.ptr->packed = p;
+                        } else {
+                            detail::lossy_packed().push_back({v.ptr, t.unsafeGetTH(false), v.ptr->version->value, p});
+                        }
+                    }
+                    t = at::Tensor();
+                }
+                this->packed.push_back(p);
+            });
+    }
+
+    inline void Node::restore(bool unpack) {
+        if (this->packed.empty()) return;
+        size_t i = 0;
+        for_each_saved(*this, [&](at::Tensor& t) {
+                auto&& p = this->packed[i++];
+                if (!p) return;
+                t = unpack ? p->restored() : at::Tensor();
+                if (!unpack) p->release();
+            });
+    }
 
-            for (auto&& b: this->brothers()) {
-                if (is_empty(b.grad())) return;
+    inline void Node::commit_versions() {
+        for (auto&& d: this->dirty) {
+            for (auto&& v: this->vargs) {
+                if (!same_tensor(v.ptr->data, d)) continue;
+                ++v.ptr->version->value;
+                for (auto&& r: this->vrets) {
+                    auto ret = r.lock();
+                    if (ret && same_tensor(ret->data, d)) ret->version = v.ptr->version;
+                }
+            }
+        }
+        const auto track = [this](const at::Tensor& t) {
+            for (auto&& v: this->vargs) {
+                if (same_tensor(v.ptr->data, t)) {
+                    this->saved_versions.push_back({v.ptr->version, v.ptr->version->value});
+                    return;
+                }
             }
+            for (auto&& r: this->vrets) {
+                auto ret = r.lock();
+                if (ret && same_tensor(ret->data, t)) {
+                    this->saved_versions.push_back({ret->version, ret->version->value});
+                    return;
+                }
+            }
+        };
+        for (auto&& t: this->saved_tensors) track(t);
+        for (auto&& ts: this->stage_tensors) {
+            for (auto&& t: ts) track(t);
+        }
+    }
 
-            TList accumulated_grads;
-            accumulated_grads.reserve(this->brothers().size());
-            for (auto&& b: this->brothers()) {
-                accumulated_grads.push_back(b.grad());
+    inline auto& Variable::children() { return this->node->vargs; }
+
+    inline void Variable::clear_grads() {
+        this->ptr->grad = at::Tensor();
+        if (!this->is_leaf()) {
+            for (auto& v: this->children()) {
+                v.clear_grads();
             }
+        }
+    }
 
-            TList next_grads = this->module->backward(accumulated_grads);
-            ATNN_ASSERT_EQ(next_grads.size(), this->children().size());
-            for (size_t i = 0; i < next_grads.size(); ++i) {
-                this->children()[i].backward(next_grads[i]);
+    inline void Variable::backward(at::Tensor grad) {
+        detail::release_lossy_packed();
+        const auto scale = LossScale::current();
+        this->accumulate(scale == 1 ? grad : grad * scale);
+    }
+
+/**
+   adds g * GradAccumulation::scale() into the grad of the parameter p, in place once the grad exists.
+   with Variable::zero_grad between steps, the grad buffers are allocated by the first step only.
+*/
+    inline void accumulate_grad(const Variable& p, const at::Tensor& g) {
+        auto&& grad = p.ptr->grad;
+        const auto scale = GradAccumulation::scale();
+        if (is_empty(grad)) {
+            if (scale == 1) {
+                grad = g;
+            } else {
+                grad = alloc::empty_like(g);
+                at::mul_out(grad, g, scale);
             }
+        } else if (scale == 1) {
+            grad += g;
+        } else {
+            grad.add_(g, scale);
         }
+    }
 
-        auto backward() {
-            
+    inline void Variable::accumulate(at::Tensor grad) {
+        // not materialized or unpacked only for this check
+        if (this->ptr->data.defined()) ATNN_ASSERT_SHAPE_EQ(this->ptr->data.sizes(), grad.sizes());
+        if (is_empty(this->ptr->grad)) {
+            // no copy: grad may be shared with other Variables (e.g., Add), so the first accumulation allocates
+            this->ptr->grad = grad;
+            this->ptr->grad_borrowed = true;
+        } else if (this->ptr->grad_borrowed) {
+            auto sum = alloc::empty_like(grad);
+            at::add_out(sum, this->ptr->grad, grad);
+            this->ptr->grad = sum;
+            this->ptr->grad_borrowed = false;
+        } else {
+            this->ptr->grad += grad;
         }
-    };
+
+        if (this->is_leaf()) return; // stop the recursion
+
+        GradList accumulated_grads;
+        accumulated_grads.reserve(this->node->vrets.size());
+        for (auto&& b: this->node->vrets) {
+            auto brother = b.lock();
+            if (brother && is_empty(brother->grad)) return; // wait for the other outputs
+            accumulated_grads.push_back(brother ? brother->grad : at::Tensor());
+        }
+
+        auto next_grads = this->node->backward(accumulated_grads);
+        ATNN_ASSERT_EQ(next_grads.size(), this->children().size());
+        for (size_t i = 0; i < next_grads.size(); ++i) {
+            auto&& child = this->children()[i];
+            // undefined: skipped by the module (see Module::needs_input_grad)
+            if (child.requires_grad() && next_grads[i].defined()) child.accumulate(next_grads[i]);
+        }
+    }
+
 
     
 
@@ -153,6 +780,78 @@ namespace atnn {
         }
     }
 
+    inline at::Tensor data_of(at::Tensor t) { return t; }
+
+    inline TList to_tlist(at::Tensor t) { return {t}; }
+
+    inline TList to_tlist(TList ts) { return ts; }
+
+    template <size_t N>
+    TList to_tlist(const TArray<N>& ts) { return TList(ts.begin(), ts.end()); }
+
+    /// converts a tensor or a tensor container to the container type L (TList, TArray<N> or GradList)
+    template <class L>
+    struct ListCast {
+        static L from(L xs) { return xs; }
+        static L from(at::Tensor t) { return L{t}; }
+        template <class Src>
+        static L from(const Src& xs) { return L(xs.begin(), xs.end()); }
+    };
+
+    template <size_t N>
+    struct ListCast<TArray<N>> {
+        static TArray<N> from(TArray<N> xs) { return xs; }
+        static TArray<N> from(at::Tensor t) {
+            static_assert(N == 1, "a single tensor to TArray<N != 1>");
+            return {{t}};
+        }
+        template <class Src>
+        static TArray<N> from(const Src& xs) {
+            ATNN_ASSERT_EQ(xs.size(), N);
+            TArray<N> a;
+            std::copy(xs.begin(), xs.end(), a.begin());
+            return a;
+        }
+    };
+
+    template <class L, class Src>
+    L list_cast(Src&& xs) { return ListCast<L>::from(std::forward<Src>(xs)); }
+
+    /// N for TArray<N>, -1 for the variable-length TList
+    template <class L>
+    struct FixedArity : std::integral_constant<long, -1> {};
+
+    template <size_t N>
+    struct FixedArity<TArray<N>> : std::integral_constant<long, N> {};
+
+    namespace detail {
+        template <class R, class C, class A>
+        A second_arg(R (*)(C, A));
+    }
+
+    /// the container of M::Function::forward inputs, i.e., the arity declared by its signature
+    template <class M>
+    using InputsOf = std::decay_t<decltype(detail::second_arg(&M::Function::template forward<M*>))>;
+
+    /// the container of M::Function::backward output grads
+    template <class M>
+    using GradOutputsOf = std::decay_t<decltype(detail::second_arg(&M::Function::template backward<M*>))>;
+
+    inline at::Tensor data_of(const Variable& v) { return v.data(); }
+
+    inline Variable single_output(Variable v) { return v; }
+
+    template <size_t N>
+    Variable single_output(const std::array<Variable, N>& vs) {
+        ATNN_ASSERT_EQ(N, 1);
+        return vs[0];
+    }
+
+    inline Variable single_output(const VList& vs) {
+        ATNN_ASSERT_EQ(vs.size(), 1);
+        return vs[0];
+    }
+
     template <typename T>
     static void to_backend_of(T& src, at::Backend b) {
         const auto src_backend = src.type().backend();
@@ -170,16 +869,64 @@ namespace atnn {
             }
         }
 
-        virtual TList backward(TList grads [[gnu::unused]]) {
+        GradList backward(const GradList& grads [[gnu::unused]]) override {
             // FIXME: find better way.
             ATNN_ASSERT_MSG(false, "never call this");
             return {};
         }
+
+        TList infer(TList xs [[gnu::unused]]) override {
+            ATNN_ASSERT_MSG(false, "never call this");
+            return {};
+        }
+
+        void for_each_module(const Visitor& f) override {
+            for (auto& m: this->modules) {
+                m->for_each_module(f);
+            }
+        }
     };
 
 /**
-   Module stores Parameters and Variables
-   for Derived::Function (static class with forward/backward functions)
+   sums the parameter grads of micro-batches into persistent buffers (see accumulate_grad).
+
+   GradAccumulator acc(net, 4);
+   for (auto&& mb: micro_batches) {
+       GradAccumulationGuard guard(acc.scale()); // the average is fused into the accumulation
+       loss(mb).backward(gy);
+   }
+   update(acc.parameters);
+   acc.zero(); // in place: no allocation in the next step
+*/
+    struct GradAccumulator {
+        VList parameters;
+        long micro_batches;
+        bool average;
+
+        GradAccumulator(ModulePtr model, long micro_batches, bool average=true)
+            : micro_batches(micro_batches), average(average) {
+            ATNN_ASSERT(micro_batches > 0);
+            model->for_each_module([this](ModuleBase&, VList& ps) {
+                    this->parameters.insert(this->parameters.end(), ps.begin(), ps.end());
+                });
+        }
+
+        float scale() const { return this->average ? 1.0f / this->micro_batches : 1.0f; }
+
+        void zero() {
+            for (auto&& p: this->parameters) p.zero_grad();
+        }
+    };
+
+/**
+   Module stores Parameters
+   for Derived::Function (static class with forward/backward functions).
+   the tape of each call (vargs, vrets and saved_tensors) is stored in a Node instead.
+
+   Function::forward/backward take either TList or TArray<N>. the fixed arity form avoids heap allocations
+   per call and the number of forward arguments is checked at compile time.
+
+   NOTE: concurrent forwards are safe. concurrent backwards still accumulate into the same parameter grads.
 */
     template <class Derived>
     struct Module : ModuleBase {
@@ -191,64 +938,236 @@ namespace atnn {
         virtual ~Module() {}
 
         template <class T>
-        auto set_vargs(T&& t) { return t; }
+        static auto set_vargs(const NodePtr&, T&& t) { return t; }
 
-        auto set_vargs(Variable v) {
-            this->vargs.push_back(v);
+        static auto set_vargs(const NodePtr& node, Variable v) {
+            node->add_varg(v);
             return v.data();
         }
 
-        auto set_vrets(at::Tensor t) {
-            auto v = Variable(t).set_module(shared_from_this());
-            this->vrets.push_back(v);
+        static auto set_vrets(const NodePtr& node, at::Tensor t) {
+            auto v = Variable(t, node != nullptr).set_node(node);
+            if (node) node->vrets.push_back(v.ptr);
             return v;
         }
 
-        auto set_vrets(TList ts) {
-            this->vrets.reserve(ts.size());
+        static auto set_vrets(const NodePtr& node, TList ts) {
+            VList vrets;
+            vrets.reserve(ts.size());
             for (auto&& t: ts) {
-                this->vrets.push_back(
-                    Variable(t).set_module(shared_from_this()));
+                vrets.push_back(Variable(t, node != nullptr).set_node(node));
+                if (node) node->vrets.push_back(vrets.back().ptr);
             }
-            return this->vrets;
+            return vrets;
         }
 
+        template <size_t N>
+        static auto set_vrets(const NodePtr& node, const TArray<N>& ts) {
+            std::array<Variable, N> vrets;
+            for (size_t i = 0; i < N; ++i) {
+                vrets[i] = Variable(ts[i], node != nullptr).set_node(node);
+                if (node) node->vrets.push_back(vrets[i].ptr);
+            }
+            return vrets;
+        }
+
+        /// records a new Node per call. the module itself is not modified
         template <class ... Args>
         auto forward(Args ... args) {
-            // FIXME: cannot backward through multiple applied module like RNN because of clear.
-            // TODO: make this struct Edge { VList vargs, vrets; }
-            this->vargs.clear();
-            this->vrets.clear();
-            return set_vrets(Derived::Function::forward(dthis, {this->set_vargs(args)...}));
+            return this->forward_dispatch(lazy::IsPointwise<Derived>(), args...);
         }
 
-        TList backward(TList grads) override {
-            return Derived::Function::backward(dthis, grads);
+        /// pointwise Functions are deferred under LazyGuard
+        template <class ... Args>
+        auto forward_dispatch(std::true_type, Args ... args) {
+            if (LazyMode::is_enabled() && !ForwardMode::is_enabled()) return lazy::record(Derived::Function::pointwise(dthis), args...);
+            return this->forward_dispatch(std::false_type(), args...);
         }
 
-        void save_for_backward(TList tensors){
-            bool train = true;
-            for (auto&& v: this->vargs) {
-                train &= v.train;
-                if (!train) return;
+        template <class ... Args>
+        auto forward_dispatch(std::false_type, Args ... args) {
+            using Inputs = InputsOf<Derived>;
+            static_assert(FixedArity<Inputs>::value < 0 || FixedArity<Inputs>::value == sizeof...(Args),
+                          "the number of arguments differs from the arity of Function::forward");
+            if (ForwardMode::is_enabled()) return this->forward_tangents(args...);
+            if (!GradMode::is_enabled()) {
+                Inputs xs{data_of(args)...};
+                autocast(xs);
+                return set_vrets(nullptr, this->apply(std::move(xs)));
+            }
+            if (!any_requires_grad(args...) && !this->has_trainable_parameters()) {
+                // nothing to backpropagate to: no Node, no saved tensors
+                NoGradGuard guard;
+                return this->forward_dispatch(std::false_type(), args...);
+            }
+            auto node = std::make_shared<Node>();
+            node->module = shared_from_this();
+            NodeScope scope(node.get());
+            Inputs xs{set_vargs(node, args)...};
+            autocast(xs);
+            auto ys = set_vrets(node, this->apply(std::move(xs)));
+            node->commit_versions();
+            if (auto policy = SavedTensorPolicy::current()) node->pack(*policy);
+            return ys;
+        }
+
+        /// forward mode: the outputs carry J (input and parameter tangents). undefined input tangents are zeros
+        template <class ... Args>
+        auto forward_tangents(Args ... args) {
+            using Inputs = InputsOf<Derived>;
+            NoGradGuard guard; // no Node in the graph
+            Node tape; // holds what Function::forward saves for Function::jvp (e.g., the stream of Dropout)
+            NodeScope scope(&tape);
+            Inputs xs{data_of(args)...};
+            Inputs txs{tangent_of(args)...};
+            autocast(xs);
+            for (size_t i = 0; i < xs.size(); ++i) {
+                auto&& x = xs[i];
+                auto&& t = txs[i];
+                if (!t.defined()) {
+                    // e.g., inputs and targets held constant. integer inputs (labels) have no tangent
+                    const auto s = x.type().scalarType();
+                    if (s == at::kFloat || s == at::kDouble || s == at::kHalf) t = alloc::zeros_like(x);
+                } else if (t.type() != x.type()) {
+                    t = t.toType(x.type()); // cast by autocast
+                }
             }
-            this->saved_tensors = tensors;
+            auto ys = this->apply(xs);
+            const auto tys = list_cast<TList>(this->jvp(HasJvp<Derived>(), xs, ys, txs));
+            auto vrets = set_vrets(nullptr, ys);
+            const auto vs = to_vlist(vrets);
+            ATNN_ASSERT_EQ(vs.size(), tys.size());
+            for (size_t i = 0; i < vs.size(); ++i) vs[i].ptr->tangent = tys[i];
+            return vrets;
+        }
+
+        template <class Inputs, class Outputs, class D = Derived>
+        auto jvp(std::true_type, const Inputs& xs, const Outputs& ys, const Inputs& txs) {
+            return D::Function::jvp(dthis, xs, ys, txs);
+        }
+
+        template <class Inputs, class Outputs>
+        Outputs jvp(std::false_type, const Inputs&, const Outputs& ys, const Inputs&) {
+            throw_with_trace(std::runtime_error(std::string(typeid(Derived).name()) + " has no Function::jvp for forward mode"));
+            return ys;
+        }
+
+        static at::Tensor tangent_of(const Variable& v) { return v.tangent(); }
+
+        template <class T>
+        static at::Tensor tangent_of(const T&) { return at::Tensor(); }
+
+        static bool any_requires_grad() { return false; }
+
+        template <class T, class ... Args>
+        static bool any_requires_grad(const T&, const Args& ... args) { return any_requires_grad(args...); }
+
+        template <class ... Args>
+        static bool any_requires_grad(const Variable& v, const Args& ... args) {
+            return v.requires_grad() || any_requires_grad(args...);
+        }
+
+        /// false when the i-th Variable input of the running forward/backward needs no grad (e.g., input images).
+        /// Function::backward may return an undefined grad for it
+        bool needs_input_grad(size_t i) const {
+            auto node = current_node();
+            return node == nullptr || i >= node->vargs.size() || node->vargs[i].requires_grad();
+        }
+
+        template <class Inputs>
+        static void autocast(Inputs& xs) {
+            auto&& a = Autocast::current();
+            if (!a || !a->allows(typeid(Derived))) return;
+            for (auto&& x: xs) x = a->cast(x);
+        }
+
+        Variable forward_unary(Variable x) override {
+            constexpr auto arity = FixedArity<InputsOf<Derived>>::value;
+            return this->forward_unary_dispatch(std::integral_constant<bool, arity < 0 || arity == 1>(), x);
+        }
+
+        Variable forward_unary_dispatch(std::true_type, Variable x) { return single_output(this->forward(x)); }
+
+        Variable forward_unary_dispatch(std::false_type, Variable x) { return ModuleBase::forward_unary(x); }
+
+        /// stateless forward on tensors for inference. no Node is recorded
+        template <class ... Args>
+        auto predict(Args ... args) {
+            NoGradGuard guard;
+            NodeScope scope(nullptr); // nothing saved, even under ForwardModeGuard
+            return this->apply(InputsOf<Derived>{data_of(args)...});
+        }
+
+        /// runs Derived::Function::forward and the forward hooks
+        template <class D = Derived>
+        auto apply(InputsOf<D> xs) {
+            IntraOpGuard threads(this->num_threads);
+            if (this->forward_hooks.empty()) {
+                return D::Function::forward(dthis, std::move(xs));
+            }
+            auto ys = D::Function::forward(dthis, xs);
+            const auto inputs = list_cast<TList>(xs);
+            const auto outputs = list_cast<TList>(ys);
+            for (auto&& h: this->forward_hooks) {
+                (*h)(inputs, outputs);
+            }
+            return ys;
+        }
+
+        GradList backward(const GradList& grads) override {
+            return list_cast<GradList>(Derived::Function::backward(dthis, list_cast<GradOutputsOf<Derived>>(grads)));
+        }
+
+        TList infer(TList xs) override {
+            NoGradGuard guard;
+            return list_cast<TList>(this->apply(list_cast<InputsOf<Derived>>(xs)));
+        }
+
+        /// also kept for Function::jvp under ForwardModeGuard
+        void save_for_backward(TList tensors){
+            if (!saving()) return;
+            auto node = current_node();
+            ATNN_ASSERT_MSG(node != nullptr, "save_for_backward is only available inside Function::forward");
+            node->saved_tensors = tensors;
+        }
+
+        static bool saving() {
+            return GradMode::is_enabled() || (ForwardMode::is_enabled() && current_node() != nullptr);
+        }
+
+        /// declares that Function::forward wrote the input tensor t in place (its output may alias it)
+        void mark_dirty(const at::Tensor& t) {
+            if (!GradMode::is_enabled()) return;
+            auto node = current_node();
+            ATNN_ASSERT_MSG(node != nullptr, "mark_dirty is only available inside Function::forward");
+            node->dirty.push_back(t);
+        }
+
+        template <class L>
+        void save_for_backward(const L& tensors) {
+            if (!saving()) return;
+            this->save_for_backward(TList(tensors.begin(), tensors.end()));
         }
 
         void toBackend(at::Backend b) override {
             for (auto& p: this->parameters) {
+                if (!p.data().defined()) continue;
                 p.ptr->data = p.data().toBackend(b);
                 if (!is_empty(p.grad())) {
                     p.ptr->grad = p.grad().toBackend(b);
                 }
             }
-            for (auto& t: this->saved_tensors) {
-                t = t.toBackend(b);
-            }
             for (auto& m: this->submodules) {
                 m->toBackend(b);
             }
         }
+
+        void for_each_module(const Visitor& f) override {
+            f(*this, this->parameters);
+            for (auto& m: this->submodules) {
+                m->for_each_module(f);
+            }
+        }
     };
 
 
@@ -260,6 +1179,11 @@ namespace atnn {
         return v;
     }
 
+    template <size_t N>
+    VList to_vlist(const std::array<Variable, N>& vs) {
+        return VList(vs.begin(), vs.end());
+    }
+
     template <typename ... Ts>
     VList to_vlist(std::tuple<Ts...> vtuple) {
         auto varray = to_array(vtuple);
@@ -317,6 +1241,85 @@ namespace atnn {
             ATNN_ASSERT_MSG(allclose(inputs[i].grad(), ngs[i], rtol, atol), ss.str().c_str());
         }
     }
-} // namespace atnn
 
+/**
+   forward-mode J v of func at inputs along tangents: returns (outputs, output tangents).
+   the inputs are not modified and no tape is recorded (the modules in func need Function::jvp).
+*/
+    template <typename F>
+    std::pair<TList, TList> jvp(F func, TList inputs, TList tangents) {
+        ATNN_ASSERT_EQ(inputs.size(), tangents.size());
+        VList vs;
+        vs.reserve(inputs.size());
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            vs.emplace_back(inputs[i], false);
+            vs.back().set_tangent(tangents[i]);
+        }
+        ForwardModeGuard guard;
+        const auto outs = to_vlist(func(vs));
+        std::pair<TList, TList> result;
+        for (auto&& y: outs) {
+            result.first.push_back(y.data());
+            result.second.push_back(y.tangent());
+        }
+        return result;
+    }
+
+/**
+   grad_check along random directions v instead of each element: per direction, one forward-mode pass
+   gives J v, which is checked against the central difference (func(x + eps v) - func(x - eps v)) / 2 eps
+   and against the backward grads (sum_i <grad_i, v_i> = <grad_outputs, J v>).
+   2 forwards + 1 jvp per direction instead of the 2 * numel forwards of numeric_grad.
+*/
+    template <typename F>
+    void jvp_grad_check(F func, VList inputs, TList grad_outputs, long directions=3, float eps=1e-3, float rtol=1e-3, float atol=1e-5) {
+        auto outs = to_vlist(func(inputs));
+        ATNN_ASSERT_EQ(outs.size(), grad_outputs.size());
+        for (auto&& x: inputs) x.clear_grads();
+        for (size_t i = 0; i < outs.size(); ++i) outs[i].backward(grad_outputs[i]);
+        outs.clear();
+
+        TList xs, grads;
+        for (auto&& x: inputs) {
+            xs.push_back(x.data());
+            grads.push_back(x.grad());
+        }
+        for (long d = 0; d < directions; ++d) {
+            TList vs;
+            for (auto&& x: xs) vs.push_back(x.type().randn(x.sizes()));
+            const auto dual = jvp(func, xs, vs);
+            ATNN_ASSERT_EQ(dual.second.size(), grad_outputs.size());
+
+            TList plus, minus;
+            {
+                NoGradGuard guard;
+                for (size_t i = 0; i < xs.size(); ++i) xs[i].add_(vs[i], eps);
+                for (auto&& y: to_vlist(func(inputs))) plus.push_back(y.data().clone());
+                for (size_t i = 0; i < xs.size(); ++i) xs[i].add_(vs[i], -2 * eps);
+                for (auto&& y: to_vlist(func(inputs))) minus.push_back(y.data().clone());
+                for (size_t i = 0; i < xs.size(); ++i) xs[i].add_(vs[i], eps);
+            }
+
+            double forward = 0, backward = 0;
+            for (size_t m = 0; m < grad_outputs.size(); ++m) {
+                auto&& tangent = dual.second[m];
+                ATNN_ASSERT_MSG(tangent.defined(), "an output without tangent");
+                auto numeric = (plus[m] - minus[m]) / (2.0 * eps);
+                std::ostringstream ss;
+                ss << "jvp:\n" << limit_view(tangent) << "\n" << "numerical jvp:\n" << limit_view(numeric);
+                ATNN_ASSERT_MSG(allclose(tangent, numeric, rtol, atol), ss.str().c_str());
+                forward += at::Scalar((grad_outputs[m] * tangent).sum()).toDouble();
+            }
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (is_empty(grads[i])) continue; // no path to the outputs
+                backward += at::Scalar((grads[i] * vs[i]).sum()).toDouble();
+            }
+            std::ostringstream ss;
+            ss << "<grad_outputs, J v> = " << forward << " differs from <backprop grad, v> = " << backward;
+            ATNN_ASSERT_MSG(std::abs(forward - backward) <= atol * grad_outputs.size() + rtol * std::abs(backward), ss.str().c_str());
+        }
+    }
+} // namespace atnn
 
+// the lazy executor needs the complete Variable, Node and ModuleBase
+#include "lazy.hpp"
@@ -0,0 +1,23 @@
+/*
+
+  This header defines the input pipeline
+
+  - Source: pluggable sample stream
+  - ThreadPool: runs decode/augment transforms
+  - DataLoader: collates samples into reused batch tensors and prefetches them through a bounded queue
+  - Dataset: random access records (RecordFile, IdxFile) read through mmap
+  - ShuffleSource: block-level randomization + bounded shuffle buffer for out-of-core datasets
+  - BucketBatcher: groups variable-length samples of similar lengths (e.g., for packed sequences)
+
+ */
+
+#pragma once
+
+#include "data/queue.hpp"
+#include "data/thread_pool.hpp"
+#include "data/loader.hpp"
+#include "data/mmap.hpp"
+#include "data/dataset.hpp"
+#include "data/record.hpp"
+#include "data/idx.hpp"
+#include "data/bucket.hpp"
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "../autograd.hpp"
+#include "loader.hpp"
+
+namespace atnn {
+    namespace data {
+
+        struct BucketOptions {
+            long batch_size = 32;
+            std::vector<long> boundaries; // ascending. bucket i holds lengths in [boundaries[i - 1], boundaries[i])
+            bool drop_last = false;       // drops the partial buckets at the end of an epoch
+        };
+
+        struct BucketStats {
+            long batches = 0;
+            long samples = 0;
+            long tokens = 0;        // the sum of the lengths
+            long padded_tokens = 0; // batch size * the longest length, summed over the batches
+
+            /// the fraction of a padded batch that would be padding (0 for packed batches of the same lengths)
+            double padding_fraction() const {
+                return this->padded_tokens == 0 ? 0.0 : 1.0 - static_cast<double>(this->tokens) / this->padded_tokens;
+            }
+        };
+
+/**
+   BucketBatcher groups variable-length samples of similar lengths, e.g., for packed::pack.
+   the length of a sample is the size(0) of its length_field-th tensor. a bucket is emitted as soon as it holds
+   batch_size samples, and the rest are flushed (shortest bucket first) at the end of the epoch.
+   the samples are not collated: their shapes differ.
+
+   BucketBatcher batcher(std::make_shared<MySource>(...), {16, {10, 20, 40}});
+   std::vector<TList> batch;
+   while (batcher.next(batch)) { auto x = packed::pack(field(batch, 0)); ... }
+*/
+        struct BucketBatcher {
+            SourcePtr source;
+            BucketOptions options;
+            size_t length_field;
+            BucketStats stats;
+            std::vector<std::vector<TList>> buckets;
+            bool exhausted = false;
+
+            BucketBatcher(SourcePtr source, BucketOptions options, size_t length_field=0)
+                : source(source), options(options), length_field(length_field),
+                  buckets(options.boundaries.size() + 1) {
+                ATNN_ASSERT(options.batch_size > 0);
+                ATNN_ASSERT(std::is_sorted(options.boundaries.begin(), options.boundaries.end()));
+            }
+
+            size_t bucket_of(long length) const {
+                auto&& b = this->options.boundaries;
+                return std::upper_bound(b.begin(), b.end(), length) - b.begin();
+            }
+
+            /// returns false (and resets the source for the next epoch) when the epoch is over
+            bool next(std::vector<TList>& batch) {
+                TList sample;
+                while (!this->exhausted) {
+                    if (!this->source->next(sample)) {
+                        this->exhausted = true;
+                        break;
+                    }
+                    ATNN_ASSERT(this->length_field < sample.size());
+                    auto&& bucket = this->buckets[this->bucket_of(sample[this->length_field].size(0))];
+                    bucket.push_back(sample);
+                    if (static_cast<long>(bucket.size()) == this->options.batch_size) {
+                        return this->emit(bucket, batch);
+                    }
+                }
+                if (!this->options.drop_last) {
+                    for (auto&& bucket: this->buckets) {
+                        if (!bucket.empty()) return this->emit(bucket, batch);
+                    }
+                }
+                for (auto&& bucket: this->buckets) bucket.clear();
+                this->source->reset();
+                this->exhausted = false;
+                return false;
+            }
+
+        private:
+            bool emit(std::vector<TList>& bucket, std::vector<TList>& batch) {
+                batch.clear();
+                std::swap(batch, bucket);
+                long longest = 0;
+                for (auto&& s: batch) {
+                    const long length = s[this->length_field].size(0);
+                    this->stats.tokens += length;
+                    longest = std::max(longest, length);
+                }
+                this->stats.padded_tokens += longest * static_cast<long>(batch.size());
+                this->stats.samples += batch.size();
+                ++this->stats.batches;
+                return true;
+            }
+        };
+
+        /// the i-th tensor of each sample of a batch
+        inline TList field(const std::vector<TList>& batch, size_t i) {
+            TList f;
+            f.reserve(batch.size());
+            for (auto&& s: batch) f.push_back(s.at(i));
+            return f;
+        }
+
+    } // namespace data
+} // namespace atnn
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "loader.hpp"
+
+namespace atnn {
+    namespace data {
+
+/**
+   random access collection of samples.
+   get() should be cheap (e.g., a view into mapped memory) because sources call it in order on the producer thread.
+*/
+        struct Dataset {
+            virtual ~Dataset() {}
+            virtual long size() const = 0;
+            virtual TList get(long index) = 0;
+            /// readahead hint for the records [begin, end) that will be read soon
+            virtual void prefetch(long begin [[gnu::unused]], long end [[gnu::unused]]) {}
+        };
+
+        using DatasetPtr = std::shared_ptr<Dataset>;
+
+        /// concatenates the fields of datasets with the same length (e.g., MNIST images and labels)
+        struct ZipDataset : Dataset {
+            std::vector<DatasetPtr> datasets;
+
+            explicit ZipDataset(std::vector<DatasetPtr> datasets) : datasets(datasets) {
+                ATNN_ASSERT(!datasets.empty());
+                for (auto&& d: datasets) {
+                    ATNN_ASSERT_EQ(d->size(), datasets[0]->size());
+                }
+            }
+
+            long size() const override { return this->datasets[0]->size(); }
+
+            TList get(long index) override {
+                TList sample;
+                for (auto&& d: this->datasets) {
+                    auto fields = d->get(index);
+                    sample.insert(sample.end(), fields.begin(), fields.end());
+                }
+                return sample;
+            }
+
+            void prefetch(long begin, long end) override {
+                for (auto&& d: this->datasets) {
+                    d->prefetch(begin, end);
+                }
+            }
+        };
+
+        /// reads a dataset in order, prefetching `readahead` records ahead
+        struct SequentialSource : Source {
+            DatasetPtr dataset;
+            long readahead;
+            long index = 0;
+
+            explicit SequentialSource(DatasetPtr dataset, long readahead=1024)
+                : dataset(dataset), readahead(readahead) {}
+
+            bool next(TList& sample) override {
+                if (this->index >= this->dataset->size()) return false;
+                if (this->index % this->readahead == 0) {
+                    this->dataset->prefetch(this->index + this->readahead,
+                                            std::min(this->index + 2 * this->readahead, this->dataset->size()));
+                }
+                sample = this->dataset->get(this->index++);
+                return true;
+            }
+
+            void reset() override { this->index = 0; }
+        };
+
+        struct ShuffleOptions {
+            long block_size = 1024;   // records read contiguously
+            long buffer_size = 8192;  // samples held for local shuffling
+            unsigned seed = 0;
+        };
+
+/**
+   ShuffleSource shuffles datasets larger than memory at sequential I/O speed.
+
+   1. blocks of `block_size` contiguous records are visited in a random order, and the next block is prefetched
+   2. records of the current block stream into a bounded buffer and leave it from a random position
+
+   the buffer holds `buffer_size` samples at most. each epoch uses a new permutation derived from (seed, epoch).
+*/
+        struct ShuffleSource : Source {
+            DatasetPtr dataset;
+            ShuffleOptions options;
+
+            explicit ShuffleSource(DatasetPtr dataset, ShuffleOptions options={})
+                : dataset(dataset), options(options) {
+                ATNN_ASSERT(options.block_size > 0);
+                ATNN_ASSERT(options.buffer_size > 0);
+                this->buffer.reserve(options.buffer_size);
+                this->start_epoch();
+            }
+
+            bool next(TList& sample) override {
+                TList record;
+                while (static_cast<long>(this->buffer.size()) < this->options.buffer_size && this->read(record)) {
+                    this->buffer.push_back(std::move(record));
+                }
+                if (this->buffer.empty()) return false;
+                std::uniform_int_distribution<size_t> pick(0, this->buffer.size() - 1);
+                auto& chosen = this->buffer[pick(this->engine)];
+                sample = std::move(chosen);
+                chosen = std::move(this->buffer.back());
+                this->buffer.pop_back();
+                return true;
+            }
+
+            void reset() override {
+                ++this->epoch;
+                this->start_epoch();
+            }
+
+        private:
+            void start_epoch() {
+                this->engine.seed(this->options.seed + this->epoch);
+                const auto nblocks = (this->dataset->size() + this->options.block_size - 1) / this->options.block_size;
+                this->blocks.resize(nblocks);
+                std::iota(this->blocks.begin(), this->blocks.end(), 0);
+                std::shuffle(this->blocks.begin(), this->blocks.end(), this->engine);
+                this->buffer.clear();
+                this->next_block = 0;
+                this->index = this->end = 0;
+            }
+
+            void prefetch_block(size_t b) {
+                if (b >= this->blocks.size()) return;
+                auto begin = this->blocks[b] * this->options.block_size;
+                this->dataset->prefetch(begin, std::min(begin + this->options.block_size, this->dataset->size()));
+            }
+
+            bool read(TList& record) {
+                if (this->index >= this->end) {
+                    if (this->next_block >= this->blocks.size()) return false;
+                    if (this->next_block == 0) this->prefetch_block(0);
+                    this->index = this->blocks[this->next_block] * this->options.block_size;
+                    this->end = std::min(this->index + this->options.block_size, this->dataset->size());
+                    this->prefetch_block(++this->next_block);
+                }
+                record = this->dataset->get(this->index++);
+                return true;
+            }
+
+            std::vector<TList> buffer;
+            std::vector<long> blocks;
+            size_t next_block = 0;
+            long index = 0, end = 0;
+            unsigned epoch = 0;
+            std::mt19937 engine;
+        };
+
+    } // namespace data
+} // namespace atnn
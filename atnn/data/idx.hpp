@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "dataset.hpp"
+#include "mmap.hpp"
+
+namespace atnn {
+    namespace data {
+
+/**
+   IDX file reader (the MNIST format http://yann.lecun.com/exdb/mnist/ )
+
+   header: u8 0, u8 0, u8 dtype, u8 ndim, u32 sizes[ndim] (big endian), then data (big endian)
+   byte samples are zero-copy views of the mapped file. wider types are byte swapped into new tensors.
+   1-dim files (e.g., labels) yield samples of size {1}.
+*/
+        struct IdxFile : Dataset {
+            std::vector<int64_t> sizes; // of the whole array
+
+            explicit IdxFile(const std::string& path)
+                : file(std::make_shared<MappedFile>(path)) {
+                auto p = reinterpret_cast<const uint8_t*>(this->file->data());
+                if (this->file->size() < 4 || p[0] != 0 || p[1] != 0) {
+                    throw_with_trace(std::runtime_error("not an idx file " + path));
+                }
+                switch (p[2]) {
+                case 0x08: this->dtype = at::kByte; this->itemsize = 1; break;
+                case 0x09: this->dtype = at::kChar; this->itemsize = 1; break;
+                case 0x0B: this->dtype = at::kShort; this->itemsize = 2; break;
+                case 0x0C: this->dtype = at::kInt; this->itemsize = 4; break;
+                case 0x0D: this->dtype = at::kFloat; this->itemsize = 4; break;
+                case 0x0E: this->dtype = at::kDouble; this->itemsize = 8; break;
+                default: throw_with_trace(std::runtime_error("unknown idx dtype in " + path));
+                }
+                const auto ndim = p[3];
+                if (ndim == 0) throw_with_trace(std::runtime_error("no dimensions in idx file " + path));
+                this->header_size = 4 + 4 * ndim;
+                if (this->file->size() < this->header_size) {
+                    throw_with_trace(std::runtime_error("truncated idx header " + path));
+                }
+                for (int d = 0; d < ndim; ++d) {
+                    auto s = p + 4 + 4 * d;
+                    this->sizes.push_back((uint32_t(s[0]) << 24) | (uint32_t(s[1]) << 16) | (uint32_t(s[2]) << 8) | s[3]);
+                }
+                this->sample_sizes.assign(this->sizes.begin() + 1, this->sizes.end());
+                if (this->sample_sizes.empty()) this->sample_sizes.push_back(1);
+                // the bytes of the data, innermost dimension first: each product fits in the file or it is truncated
+                const size_t available = this->file->size() - this->header_size;
+                size_t bytes = this->itemsize;
+                for (int d = ndim - 1; d >= 0; --d) {
+                    const size_t s = this->sizes[d];
+                    if (s != 0 && bytes > available / s) throw_with_trace(std::runtime_error("truncated idx file " + path));
+                    bytes *= s;
+                    if (d == 1) this->sample_numel = bytes / this->itemsize;
+                }
+                if (ndim == 1) this->sample_numel = 1;
+                this->file->sequential();
+            }
+
+            long size() const override { return this->sizes[0]; }
+
+            TList get(long index) override {
+                ATNN_ASSERT(0 <= index && index < this->size());
+                auto p = this->file->data() + this->header_size + index * this->sample_numel * this->itemsize;
+                if (this->itemsize == 1) {
+                    auto file = this->file;
+                    return {CPU(this->dtype).tensorFromBlob(p, this->sample_sizes, [file](void*) {})};
+                }
+                auto t = CPU(this->dtype).tensor(this->sample_sizes);
+                auto dst = static_cast<char*>(t.data_ptr());
+                for (long i = 0; i < this->sample_numel; ++i) {
+                    std::reverse_copy(p + i * this->itemsize, p + (i + 1) * this->itemsize, dst + i * this->itemsize);
+                }
+                return {t};
+            }
+
+            void prefetch(long begin, long end) override {
+                const auto stride = this->sample_numel * this->itemsize;
+                this->file->will_need(this->header_size + begin * stride, this->header_size + end * stride);
+            }
+
+        private:
+            MappedFilePtr file;
+            at::ScalarType dtype;
+            size_t itemsize;
+            size_t header_size;
+            std::vector<int64_t> sample_sizes;
+            long sample_numel;
+        };
+
+        /// MNIST as {image (28x28 byte), label (1 byte)} samples
+        inline DatasetPtr mnist(const std::string& images_path, const std::string& labels_path) {
+            return std::make_shared<ZipDataset>(std::vector<DatasetPtr> {
+                    std::make_shared<IdxFile>(images_path), std::make_shared<IdxFile>(labels_path)});
+        }
+
+    } // namespace data
+} // namespace atnn
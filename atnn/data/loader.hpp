@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "../autograd.hpp"
+#include "queue.hpp"
+#include "thread_pool.hpp"
+
+namespace atnn {
+    namespace data {
+
+/**
+   Source yields samples one by one. a sample is a TList (e.g., {image, label}).
+   next() is only called from the loader's producer thread, so sources can read sequentially without locks.
+*/
+        struct Source {
+            virtual ~Source() {}
+            /// returns false at the end of an epoch
+            virtual bool next(TList& sample) = 0;
+            /// rewinds for the next epoch
+            virtual void reset() = 0;
+        };
+
+        using SourcePtr = std::shared_ptr<Source>;
+
+        /// iterates the first dimension of in-memory tensors
+        struct TensorSource : Source {
+            TList tensors;
+            long index = 0;
+
+            explicit TensorSource(TList tensors) : tensors(tensors) {
+                ATNN_ASSERT(!tensors.empty());
+                for (auto&& t: tensors) {
+                    ATNN_ASSERT_EQ(t.size(0), tensors[0].size(0));
+                }
+            }
+
+            bool next(TList& sample) override {
+                if (this->index >= this->tensors[0].size(0)) return false;
+                sample.clear();
+                for (auto&& t: this->tensors) {
+                    sample.push_back(t.select(0, this->index));
+                }
+                ++this->index;
+                return true;
+            }
+
+            void reset() override { this->index = 0; }
+        };
+
+        /// decode/augment stage applied to each sample on a worker thread
+        using Transform = std::function<TList(TList)>;
+
+        struct LoaderOptions {
+            long batch_size = 32;
+            size_t num_workers = 2; // decode/augment threads. 0 runs stages on the producer thread
+            size_t prefetch = 2;    // batches prepared ahead of the consumer
+            bool drop_last = false;
+        };
+
+        struct LoaderStats {
+            double stall_seconds = 0; // time the consumer waited inside next()
+            long batches = 0;
+            long samples = 0;
+        };
+
+/**
+   DataLoader overlaps data preparation with the training step.
+
+   a producer thread reads the source sequentially and hands each sample to the worker pool,
+   which runs the transforms and copies the result into a preallocated batch slot.
+   finished slots go through a bounded queue to the consumer and come back when it asks for the next batch,
+   so no batch tensor is allocated after the first round.
+
+   NOTE: tensors returned by next() are valid until the following call of next(). clone() them to keep.
+*/
+        struct DataLoader {
+            SourcePtr source;
+            LoaderOptions options;
+            std::vector<Transform> transforms;
+
+            DataLoader(SourcePtr source, LoaderOptions options={})
+                : source(source)
+                , options(options)
+                , pool(options.num_workers)
+                , slots(options.prefetch + 1)
+                , slot_mutexes(options.prefetch + 1)
+                , slot_shaped(options.prefetch + 1) {
+                ATNN_ASSERT(options.batch_size > 0);
+                ATNN_ASSERT(options.prefetch > 0);
+            }
+
+            ~DataLoader() {
+                this->stop();
+            }
+
+            DataLoader& add_transform(Transform t) {
+                ATNN_ASSERT_MSG(!this->running, "cannot add transforms during an epoch");
+                this->transforms.push_back(t);
+                return *this;
+            }
+
+            /// fetches the next batch. returns false at the end of an epoch; the following call starts a new one.
+            bool next(TList& batch) {
+                if (!this->running) this->start();
+                if (this->held >= 0) {
+                    this->free_slots->push(this->held);
+                    this->held = -1;
+                }
+
+                Filled filled;
+                auto start_time = std::chrono::high_resolution_clock::now();
+                bool ok = this->ready->pop(filled);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                this->loader_stats.stall_seconds += 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    end_time - start_time).count();
+
+                if (!ok) {
+                    this->stop();
+                    if (this->error) {
+                        auto e = this->error;
+                        this->error = nullptr;
+                        std::rethrow_exception(e);
+                    }
+                    return false;
+                }
+
+                this->held = filled.slot;
+                batch.clear();
+                for (auto&& t: this->slots[filled.slot]) {
+                    batch.push_back(filled.size == this->options.batch_size ? t : t.narrow(0, 0, filled.size));
+                }
+                ++this->loader_stats.batches;
+                this->loader_stats.samples += filled.size;
+                return true;
+            }
+
+            const LoaderStats& stats() const { return this->loader_stats; }
+
+            void reset_stats() { this->loader_stats = LoaderStats(); }
+
+        private:
+            struct Filled {
+                size_t slot;
+                long size;
+            };
+
+            void start() {
+                const auto nslots = this->slots.size();
+                this->free_slots = std::make_unique<BoundedQueue<size_t>>(nslots);
+                this->ready = std::make_unique<BoundedQueue<Filled>>(nslots);
+                for (size_t i = 0; i < nslots; ++i) {
+                    this->free_slots->push(i);
+                }
+                this->running = true;
+                this->stopped = false;
+                this->producer = std::thread([this] {
+                    try {
+                        this->produce();
+                    } catch (...) {
+                        this->error = std::current_exception();
+                    }
+                    this->ready->close();
+                });
+            }
+
+            void stop() {
+                if (!this->running) return;
+                this->stopped = true; // the closed free_slots still pops the slots left in it
+                this->free_slots->close();
+                this->ready->close();
+                this->producer.join();
+                this->source->reset();
+                this->held = -1;
+                this->running = false;
+            }
+
+            void produce() {
+                const auto batch_size = this->options.batch_size;
+                std::vector<std::future<void>> futures;
+                futures.reserve(batch_size);
+                size_t slot;
+                while (!this->stopped && this->free_slots->pop(slot)) {
+                    long n = 0;
+                    TList sample;
+                    this->slot_shaped[slot] = false;
+                    for (; n < batch_size && !this->stopped && this->source->next(sample); ++n) {
+                        futures.push_back(this->pool.submit([this, slot, n, sample] {
+                            this->collate(slot, n, this->apply_transforms(sample));
+                        }));
+                    }
+                    std::exception_ptr failed;
+                    for (auto& f: futures) {
+                        try {
+                            f.get();
+                        } catch (...) {
+                            if (!failed) failed = std::current_exception();
+                        }
+                    }
+                    futures.clear();
+                    if (failed) std::rethrow_exception(failed); // once no worker writes to the slot
+                    if (n == 0 || (n < batch_size && this->options.drop_last)) return;
+                    if (!this->ready->push({slot, n}) || n < batch_size) return; // closed by stop()
+                }
+            }
+
+            TList apply_transforms(TList sample) const {
+                for (auto&& f: this->transforms) {
+                    sample = f(sample);
+                }
+                return sample;
+            }
+
+            void collate(size_t slot, long index, const TList& sample) {
+                auto& dst = this->slots[slot];
+                {
+                    // (re)allocate the slot only when the sample layout changes, e.g., at the first batch.
+                    // the layout is then fixed until the batch is filled: the copies below run without the lock
+                    std::lock_guard<std::mutex> lock(this->slot_mutexes[slot]);
+                    bool fit = dst.size() == sample.size();
+                    for (size_t i = 0; fit && i < sample.size(); ++i) {
+                        auto a = dst[i].sizes();
+                        auto b = sample[i].sizes();
+                        fit = &dst[i].type() == &sample[i].type() && a.size() == b.size() + 1
+                            && std::equal(b.begin(), b.end(), a.begin() + 1);
+                    }
+                    if (!fit && this->slot_shaped[slot]) {
+                        throw_with_trace(std::runtime_error("samples of different shapes or types in one batch"));
+                    }
+                    this->slot_shaped[slot] = true;
+                    if (!fit) {
+                        dst.clear();
+                        for (auto&& t: sample) {
+                            std::vector<int64_t> shape = {this->options.batch_size};
+                            shape.insert(shape.end(), t.sizes().begin(), t.sizes().end());
+                            dst.push_back(t.type().tensor(shape));
+                        }
+                    }
+                }
+                for (size_t i = 0; i < sample.size(); ++i) {
+                    dst[i].select(0, index).copy_(sample[i]);
+                }
+            }
+
+            ThreadPool pool;
+            std::vector<TList> slots;
+            std::vector<std::mutex> slot_mutexes;
+            std::vector<char> slot_shaped; // the layout of the batch being filled is fixed (char: no shared bits across slots)
+            std::unique_ptr<BoundedQueue<size_t>> free_slots;
+            std::unique_ptr<BoundedQueue<Filled>> ready;
+            std::thread producer;
+            std::exception_ptr error;
+            bool running = false;
+            std::atomic<bool> stopped {false};
+            long held = -1;
+            LoaderStats loader_stats;
+        };
+
+    } // namespace data
+} // namespace atnn
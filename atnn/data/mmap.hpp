@@ -0,0 +1,74 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "../testing.hpp"
+
+namespace atnn {
+    namespace data {
+
+/**
+   read-only view of a whole file.
+   the mapping is private and writable so tensors viewing it can be modified without touching the file (copy-on-write).
+*/
+        struct MappedFile {
+            explicit MappedFile(const std::string& path) : path(path) {
+                int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0) throw_with_trace(std::runtime_error("cannot open " + path));
+                struct stat st;
+                if (::fstat(fd, &st) != 0) {
+                    ::close(fd);
+                    throw_with_trace(std::runtime_error("cannot stat " + path));
+                }
+                this->length = static_cast<size_t>(st.st_size);
+                if (this->length > 0) {
+                    this->addr = ::mmap(nullptr, this->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+                }
+                ::close(fd);
+                if (this->addr == MAP_FAILED) throw_with_trace(std::runtime_error("cannot mmap " + path));
+            }
+
+            ~MappedFile() {
+                if (this->length > 0) ::munmap(this->addr, this->length);
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            char* data() const { return static_cast<char*>(this->addr); }
+
+            size_t size() const { return this->length; }
+
+            /// readahead hint for the byte range [begin, end)
+            void will_need(size_t begin, size_t end) const { this->advise(begin, end, MADV_WILLNEED); }
+
+            void sequential() const { this->advise(0, this->length, MADV_SEQUENTIAL); }
+
+            void random() const { this->advise(0, this->length, MADV_RANDOM); }
+
+            const std::string path;
+
+        private:
+            void advise(size_t begin, size_t end, int advice) const {
+                if (end <= begin) return;
+                static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+                begin -= begin % page; // madvise requires a page aligned address
+                ::madvise(this->data() + begin, std::min(end, this->length) - begin, advice);
+            }
+
+            void* addr = nullptr;
+            size_t length = 0;
+        };
+
+        using MappedFilePtr = std::shared_ptr<MappedFile>;
+
+    } // namespace data
+} // namespace atnn
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace atnn {
+    namespace data {
+
+/**
+   blocking FIFO with a fixed capacity.
+   push blocks while full, pop blocks while empty.
+   after close(), push fails and pop drains the remaining items then fails.
+*/
+        template <typename T>
+        struct BoundedQueue {
+            explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+            bool push(T item) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->not_full.wait(lock, [this] { return this->closed || this->items.size() < this->capacity; });
+                if (this->closed) return false;
+                this->items.push_back(std::move(item));
+                this->not_empty.notify_one();
+                return true;
+            }
+
+            bool pop(T& item) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->not_empty.wait(lock, [this] { return this->closed || !this->items.empty(); });
+                if (this->items.empty()) return false;
+                item = std::move(this->items.front());
+                this->items.pop_front();
+                this->not_full.notify_one();
+                return true;
+            }
+
+            void close() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->closed = true;
+                this->not_full.notify_all();
+                this->not_empty.notify_all();
+            }
+
+            size_t size() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->items.size();
+            }
+
+            const size_t capacity;
+
+        private:
+            std::mutex mutex;
+            std::condition_variable not_full, not_empty;
+            std::deque<T> items;
+            bool closed = false;
+        };
+
+    } // namespace data
+} // namespace atnn
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "dataset.hpp"
+#include "mmap.hpp"
+
+namespace atnn {
+    namespace data {
+
+/**
+   record file layout (little endian, every section 8 byte aligned)
+
+   header: char magic[8] = "ATNNREC1", u64 num_records, u64 index_offset
+   record: u64 num_fields, then for each field
+           u32 dtype, u32 ndim, i64 sizes[ndim], data (contiguous, zero padded to 8 bytes)
+   index:  u64 offsets[num_records] (byte offset of each record)
+
+   aligned fields are returned as zero-copy tensors viewing the mapped file.
+*/
+        namespace record {
+            constexpr char magic[8] = {'A', 'T', 'N', 'N', 'R', 'E', 'C', '1'};
+
+            struct Header {
+                char magic[8];
+                uint64_t num_records;
+                uint64_t index_offset;
+            };
+
+            // stable on-disk codes; do not reorder
+            constexpr at::ScalarType dtypes[] = {
+                at::kByte, at::kChar, at::kShort, at::kInt, at::kLong, at::kHalf, at::kFloat, at::kDouble
+            };
+            constexpr size_t dtype_sizes[] = {1, 1, 2, 4, 8, 2, 4, 8};
+
+            inline uint32_t dtype_code(at::ScalarType t) {
+                for (uint32_t i = 0; i < sizeof(dtypes) / sizeof(dtypes[0]); ++i) {
+                    if (dtypes[i] == t) return i;
+                }
+                throw_with_trace(std::invalid_argument(std::string("unsupported dtype ") + at::toString(t)));
+                return 0;
+            }
+
+            inline size_t align8(size_t n) { return (n + 7) / 8 * 8; }
+        } // namespace record
+
+        struct RecordWriter {
+            explicit RecordWriter(const std::string& path)
+                : path(path), stream(path, std::ios::binary | std::ios::trunc) {
+                if (!this->stream) throw_with_trace(std::runtime_error("cannot open " + path));
+                record::Header header = {};
+                this->write(&header, sizeof(header)); // patched in close()
+            }
+
+            ~RecordWriter() {
+                if (this->stream.is_open()) this->close();
+            }
+
+            void append(const TList& sample) {
+                this->offsets.push_back(this->position);
+                uint64_t num_fields = sample.size();
+                this->write(&num_fields, sizeof(num_fields));
+                for (auto&& field: sample) {
+                    auto t = field.toBackend(at::kCPU).contiguous();
+                    const auto code = record::dtype_code(t.type().scalarType());
+                    // store scalars as {1} because zero dim tensors are empty in ATen
+                    std::vector<int64_t> sizes(t.sizes().begin(), t.sizes().end());
+                    if (sizes.empty()) sizes.push_back(1);
+                    uint32_t meta[2] = {code, static_cast<uint32_t>(sizes.size())};
+                    this->write(meta, sizeof(meta));
+                    this->write(sizes.data(), sizes.size() * sizeof(int64_t));
+                    const auto nbytes = t.numel() * record::dtype_sizes[code];
+                    this->write(t.data_ptr(), nbytes);
+                    this->pad();
+                }
+            }
+
+            void close() {
+                record::Header header;
+                std::memcpy(header.magic, record::magic, sizeof(header.magic));
+                header.num_records = this->offsets.size();
+                header.index_offset = this->position;
+                this->write(this->offsets.data(), this->offsets.size() * sizeof(uint64_t));
+                this->stream.seekp(0);
+                this->stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                this->stream.close();
+                if (!this->stream) throw_with_trace(std::runtime_error("cannot write " + this->path));
+            }
+
+            const std::string path;
+
+        private:
+            void write(const void* p, size_t n) {
+                this->stream.write(static_cast<const char*>(p), n);
+                this->position += n;
+            }
+
+            void pad() {
+                static const char zeros[8] = {};
+                this->write(zeros, record::align8(this->position) - this->position);
+            }
+
+            std::ofstream stream;
+            std::vector<uint64_t> offsets;
+            uint64_t position = 0;
+        };
+
+        /// mmap reader of RecordWriter's output
+        struct RecordFile : Dataset {
+            explicit RecordFile(const std::string& path)
+                : file(std::make_shared<MappedFile>(path)) {
+                if (this->file->size() < sizeof(record::Header)) {
+                    throw_with_trace(std::runtime_error("too short record file " + path));
+                }
+                auto header = reinterpret_cast<const record::Header*>(this->file->data());
+                if (std::memcmp(header->magic, record::magic, sizeof(record::magic)) != 0) {
+                    throw_with_trace(std::runtime_error("not a record file " + path));
+                }
+                this->num_records = header->num_records;
+                this->index_offset = header->index_offset;
+                const size_t size = this->file->size();
+                if (this->index_offset < sizeof(record::Header) || this->index_offset > size || this->index_offset % 8 != 0
+                    || header->num_records > (size - this->index_offset) / sizeof(uint64_t)) {
+                    throw_with_trace(std::runtime_error("truncated record file " + path));
+                }
+                this->offsets = reinterpret_cast<const uint64_t*>(this->file->data() + this->index_offset);
+                for (long i = 0; i < this->num_records; ++i) {
+                    const auto o = this->offsets[i];
+                    if (o < sizeof(record::Header) || o % 8 != 0 || o + sizeof(uint64_t) > this->index_offset) {
+                        throw_with_trace(std::runtime_error("corrupt record index in " + path));
+                    }
+                }
+            }
+
+            long size() const override { return this->num_records; }
+
+            TList get(long index) override {
+                ATNN_ASSERT(0 <= index && index < this->size());
+                auto p = this->file->data() + this->offsets[index];
+                // the records precede the index: every read stays below it
+                const auto end = this->file->data() + this->index_offset;
+                auto check = [&](bool ok) {
+                    if (!ok) throw_with_trace(std::runtime_error("corrupt record " + std::to_string(index) + " in " + this->file->path));
+                };
+                auto remaining = [&] { return static_cast<uint64_t>(end - p); };
+                uint64_t num_fields;
+                std::memcpy(&num_fields, p, sizeof(num_fields));
+                p += sizeof(num_fields);
+
+                TList sample;
+                for (uint64_t f = 0; f < num_fields; ++f) {
+                    uint32_t meta[2];
+                    check(sizeof(meta) <= remaining());
+                    std::memcpy(meta, p, sizeof(meta));
+                    p += sizeof(meta);
+                    check(meta[0] < sizeof(record::dtypes) / sizeof(record::dtypes[0]) && meta[1] <= remaining() / sizeof(int64_t));
+                    at::IntList sizes(reinterpret_cast<const int64_t*>(p), meta[1]);
+                    p += meta[1] * sizeof(int64_t);
+                    uint64_t bytes = record::dtype_sizes[meta[0]];
+                    for (auto s: sizes) {
+                        check(s >= 0 && (s == 0 || bytes <= remaining() / static_cast<uint64_t>(s)));
+                        bytes *= s;
+                    }
+                    check(record::align8(bytes) <= remaining());
+
+                    // the deleter keeps the mapping alive as long as the view
+                    auto file = this->file;
+                    sample.push_back(CPU(record::dtypes[meta[0]]).tensorFromBlob(p, sizes, [file](void*) {}));
+                    p += record::align8(bytes);
+                }
+                return sample;
+            }
+
+            void prefetch(long begin, long end) override {
+                if (begin >= end) return;
+                this->file->will_need(this->offset(begin), this->offset(end));
+            }
+
+        private:
+            size_t offset(long index) const {
+                return index < this->size() ? this->offsets[index] : this->index_offset;
+            }
+
+            MappedFilePtr file;
+            long num_records;
+            uint64_t index_offset;
+            const uint64_t* offsets;
+        };
+
+    } // namespace data
+} // namespace atnn
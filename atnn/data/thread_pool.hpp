@@ -0,0 +1,79 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace atnn {
+    namespace data {
+
+/**
+   fixed size worker pool. submit() returns a future that rethrows worker exceptions.
+   a pool of size 0 runs every task on the calling thread.
+*/
+        struct ThreadPool {
+            explicit ThreadPool(size_t num_threads) {
+                this->workers.reserve(num_threads);
+                for (size_t i = 0; i < num_threads; ++i) {
+                    this->workers.emplace_back([this] { this->loop(); });
+                }
+            }
+
+            ~ThreadPool() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopped = true;
+                }
+                this->cond.notify_all();
+                for (auto& w: this->workers) {
+                    w.join();
+                }
+            }
+
+            template <typename F>
+            std::future<void> submit(F f) {
+                auto task = std::make_shared<std::packaged_task<void()>>(std::move(f));
+                auto result = task->get_future();
+                if (this->workers.empty()) {
+                    (*task)();
+                    return result;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->tasks.emplace_back([task] { (*task)(); });
+                }
+                this->cond.notify_one();
+                return result;
+            }
+
+            size_t size() const { return this->workers.size(); }
+
+        private:
+            void loop() {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        this->cond.wait(lock, [this] { return this->stopped || !this->tasks.empty(); });
+                        if (this->tasks.empty()) return; // stopped
+                        task = std::move(this->tasks.front());
+                        this->tasks.pop_front();
+                    }
+                    task();
+                }
+            }
+
+            std::vector<std::thread> workers;
+            std::deque<std::function<void()>> tasks;
+            std::mutex mutex;
+            std::condition_variable cond;
+            bool stopped = false;
+        };
+
+    } // namespace data
+} // namespace atnn
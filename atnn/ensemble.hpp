@@ -0,0 +1,448 @@
+/*
+
+  This header defines ensembles of models with the same architecture run as one model
+
+  - Linear/Conv2d: the weights of E members stacked along a new leading dim, run by batched GEMMs
+    (one GEMM for all the members when they share the input)
+  - Ensemble: stacks the chains of E ModuleSets layer by layer and exposes each member's parameters and grads
+
+ */
+
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+
+namespace atnn {
+    namespace ensemble {
+
+        namespace detail {
+            /// (E, sizes...) of E tensors of the same sizes
+            inline at::Tensor stack(const TList& ts) {
+                std::vector<int64_t> sizes = {static_cast<int64_t>(ts.size())};
+                sizes.insert(sizes.end(), ts[0].sizes().begin(), ts[0].sizes().end());
+                auto s = ts[0].type().tensor(sizes);
+                for (size_t e = 0; e < ts.size(); ++e) {
+                    ATNN_ASSERT_SHAPE_EQ(ts[e].sizes(), ts[0].sizes());
+                    s[e].copy_(ts[e]);
+                }
+                return s;
+            }
+
+            /// the shapes of a convolution of one image
+            struct Geometry {
+                long channels, height, width;
+                long kh, kw, sh, sw, ph, pw;
+                long oh, ow;
+
+                long columns() const { return this->channels * this->kh * this->kw; }
+                long positions() const { return this->oh * this->ow; }
+            };
+
+            /// cols[k * ld + l] = the input of kernel element k (channel, i, j) at output position l. 0 in the padding
+            inline void im2col(const Geometry& g, const float* x, float* cols, long ld) {
+                for (long c = 0; c < g.channels; ++c) {
+                    for (long i = 0; i < g.kh; ++i) {
+                        for (long j = 0; j < g.kw; ++j) {
+                            auto row = cols + ((c * g.kh + i) * g.kw + j) * ld;
+                            for (long oy = 0; oy < g.oh; ++oy) {
+                                const long y = oy * g.sh - g.ph + i;
+                                for (long ox = 0; ox < g.ow; ++ox) {
+                                    const long x_ = ox * g.sw - g.pw + j;
+                                    const bool inside = 0 <= y && y < g.height && 0 <= x_ && x_ < g.width;
+                                    row[oy * g.ow + ox] = inside ? x[(c * g.height + y) * g.width + x_] : 0.0f;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            /// the adjoint of im2col: x (zeroed) += the columns scattered back to the pixels
+            inline void col2im(const Geometry& g, const float* cols, long ld, float* x) {
+                for (long c = 0; c < g.channels; ++c) {
+                    for (long i = 0; i < g.kh; ++i) {
+                        for (long j = 0; j < g.kw; ++j) {
+                            const auto row = cols + ((c * g.kh + i) * g.kw + j) * ld;
+                            for (long oy = 0; oy < g.oh; ++oy) {
+                                const long y = oy * g.sh - g.ph + i;
+                                if (y < 0 || y >= g.height) continue;
+                                for (long ox = 0; ox < g.ow; ++ox) {
+                                    const long x_ = ox * g.sw - g.pw + j;
+                                    if (0 <= x_ && x_ < g.width) x[(c * g.height + y) * g.width + x_] += row[oy * g.ow + ox];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            inline void flatten(const ModulePtr& m, std::vector<ModulePtr>& chain) {
+                if (auto set = std::dynamic_pointer_cast<ModuleSet>(m)) {
+                    for (auto&& c: set->modules) flatten(c, chain);
+                } else {
+                    chain.push_back(m);
+                }
+            }
+        } // namespace detail
+
+        /// a layer of stacked member layers
+        struct Stacked {
+            virtual ~Stacked() {}
+            /// copies the stacked parameters and grads to the members
+            virtual void scatter() const = 0;
+            /// copies the parameters of the members into the stacked ones
+            virtual void gather() = 0;
+        };
+
+/**
+   E modules::Linear run as one: weight (E, out, in) and bias (E, out).
+   x (N, in) is shared by the members: one (N, in) x (in, E * out) GEMM.
+   x (E, N, ...) holds an input per member (flattened to (E, N, in)): one batched GEMM.
+   y is (E, N, out).
+*/
+        struct Linear : atnn::Module<Linear>, Stacked {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    auto&& x = xs[0];
+                    auto&& w = ctx->weight.data();
+                    const long e = w.size(0), out = w.size(1), in = w.size(2);
+                    ctx->save_for_backward(xs);
+                    if (x.dim() == 2) {
+                        ATNN_ASSERT_EQ(x.size(1), in);
+                        const long n = x.size(0);
+                        auto y = x.mm(w.view({e * out, in}).t());
+                        if (ctx->bias.data().defined()) y += ctx->bias.data().view({1, e * out}).expand(y.sizes());
+                        return y.view({n, e, out}).transpose(0, 1).contiguous();
+                    }
+                    ATNN_ASSERT_EQ(x.size(0), e);
+                    const long n = x.size(1);
+                    auto x3 = x.contiguous().view({e, n, -1});
+                    ATNN_ASSERT_EQ(x3.size(2), in);
+                    at::Tensor y;
+                    if (ctx->bias.data().defined()) {
+                        y = ctx->bias.data().view({e, 1, out}).expand({e, n, out}).contiguous();
+                        y.baddbmm_(x3, w.transpose(1, 2));
+                    } else {
+                        y = at::bmm(x3, w.transpose(1, 2));
+                    }
+                    return y;
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    auto&& x = ctx->saved_tensors[0];
+                    auto&& w = ctx->weight.data();
+                    const long e = w.size(0), out = w.size(1), in = w.size(2);
+                    at::Tensor gx, grad_weight, grad_bias;
+                    if (x.dim() == 2) {
+                        const long n = x.size(0);
+                        auto g = gy[0].transpose(0, 1).contiguous().view({n, e * out});
+                        if (ctx->needs_input_grad(0)) gx = g.mm(w.view({e * out, in}));
+                        if (ctx->weight.requires_grad()) grad_weight = g.t().mm(x).view(w.sizes());
+                        grad_bias = g.sum(0).view({e, out});
+                    } else {
+                        const long n = x.size(1);
+                        auto g = gy[0].contiguous();
+                        auto x3 = x.contiguous().view({e, n, in});
+                        if (ctx->needs_input_grad(0)) gx = at::bmm(g, w).view(x.sizes());
+                        if (ctx->weight.requires_grad()) grad_weight = at::bmm(g.transpose(1, 2), x3);
+                        grad_bias = g.sum(1);
+                    }
+                    if (grad_weight.defined()) atnn::accumulate_grad(ctx->weight, grad_weight);
+                    if (ctx->bias.data().defined() && ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, grad_bias);
+                    return {gx};
+                }
+            };
+
+            Variable weight, bias;
+            std::vector<std::shared_ptr<modules::Linear>> members;
+
+            explicit Linear(const std::vector<std::shared_ptr<modules::Linear>>& members) : members(members) {
+                ATNN_ASSERT(!members.empty());
+                TList weights, biases;
+                for (auto&& m: members) {
+                    weights.push_back(m->weight.data());
+                    ATNN_ASSERT_EQ(m->bias.data().defined(), members[0]->bias.data().defined());
+                    if (m->bias.data().defined()) biases.push_back(m->bias.data());
+                }
+                this->weight = Variable(detail::stack(weights));
+                this->bias = Variable(biases.empty() ? at::Tensor{} : detail::stack(biases));
+                this->parameters = {this->weight};
+                if (!biases.empty()) this->parameters.push_back(this->bias);
+            }
+
+            void scatter() const override {
+                for (size_t e = 0; e < this->members.size(); ++e) {
+                    auto&& m = *this->members[e];
+                    for (size_t k = 0; k < this->parameters.size(); ++k) {
+                        auto&& p = this->parameters[k];
+                        auto&& q = m.parameters[k];
+                        q.ptr->data.copy_(p.data()[e]);
+                        if (!is_empty(p.grad())) q.ptr->grad = p.grad()[e].clone();
+                    }
+                }
+            }
+
+            void gather() override {
+                for (size_t e = 0; e < this->members.size(); ++e) {
+                    for (size_t k = 0; k < this->parameters.size(); ++k) {
+                        this->parameters[k].ptr->data[e].copy_(this->members[e]->parameters[k].data());
+                    }
+                }
+            }
+        };
+
+/**
+   E modules::Conv2d run as one: weight (E, out, in, kh, kw) and bias (E, out). CPU float.
+   x (N, in, H, W) is shared by the members: one im2col and one GEMM for all the members.
+   x (E, N, in, H, W) holds an input per member: one batched GEMM. y is (E, N, out, oh, ow).
+*/
+        struct Conv2d : atnn::Module<Conv2d>, Stacked {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    auto x = xs[0].contiguous();
+                    ATNN_ASSERT_MSG(x.type().backend() == at::kCPU && x.type().scalarType() == at::kFloat,
+                                    "ensemble::Conv2d runs on CPU float tensors");
+                    auto&& w = ctx->weight.data();
+                    const long e = w.size(0), out = w.size(1);
+                    const bool shared = x.dim() == 4;
+                    ATNN_ASSERT_MSG(shared || (x.dim() == 5 && x.size(0) == e), "x is (N, C, H, W) or (E, N, C, H, W)");
+                    const auto g = ctx->geometry(x);
+                    const long n = x.size(shared ? 0 : 1), m = shared ? 1 : e;
+                    const long k = g.columns(), l = g.positions();
+                    auto cols = x.type().tensor({m, k, n * l});
+                    const auto px = x.template data<float>();
+                    auto pc = cols.template data<float>();
+                    const long image = g.channels * g.height * g.width;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < m * n; ++i) {
+                        detail::im2col(g, px + i * image, pc + (i / n) * k * n * l + (i % n) * l, n * l);
+                    }
+                    ctx->save_for_backward({x, cols});
+                    auto y = shared ? w.view({e * out, k}).mm(cols[0]).view({e, out, n * l}) : at::bmm(w.view({e, out, k}), cols);
+                    y += ctx->bias.data().view({e, out, 1}).expand(y.sizes());
+                    return y.view({e, out, n, l}).transpose(1, 2).contiguous().view({e, n, out, g.oh, g.ow});
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    auto&& x = ctx->saved_tensors[0];
+                    auto&& cols = ctx->saved_tensors[1];
+                    auto&& w = ctx->weight.data();
+                    const long e = w.size(0), out = w.size(1);
+                    const bool shared = x.dim() == 4;
+                    const auto g = ctx->geometry(x);
+                    const long n = x.size(shared ? 0 : 1), m = shared ? 1 : e;
+                    const long k = g.columns(), l = g.positions();
+                    auto grad = gy[0].contiguous().view({e, n, out, l}).transpose(1, 2).contiguous().view({e, out, n * l});
+                    if (ctx->weight.requires_grad()) {
+                        auto grad_weight = shared ? grad.view({e * out, n * l}).mm(cols[0].t()) : at::bmm(grad, cols.transpose(1, 2));
+                        atnn::accumulate_grad(ctx->weight, grad_weight.view(w.sizes()));
+                    }
+                    if (ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, grad.sum(2));
+                    if (!ctx->needs_input_grad(0)) return {at::Tensor()};
+
+                    auto grad_cols = shared ? w.view({e * out, k}).t().mm(grad.view({e * out, n * l})).view({1, k, n * l})
+                        : at::bmm(w.view({e, out, k}).transpose(1, 2), grad);
+                    grad_cols = grad_cols.contiguous();
+                    auto gx = x.type().zeros_like(x);
+                    const auto pc = grad_cols.template data<float>();
+                    auto pgx = gx.template data<float>();
+                    const long image = g.channels * g.height * g.width;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < m * n; ++i) { // each image is written by one iteration
+                        detail::col2im(g, pc + (i / n) * k * n * l + (i % n) * l, n * l, pgx + i * image);
+                    }
+                    return {gx};
+                }
+            };
+
+            Variable weight, bias;
+            std::vector<int64_t> kernel_size, stride, padding;
+            std::vector<std::shared_ptr<modules::Conv2d>> members;
+
+            explicit Conv2d(const std::vector<std::shared_ptr<modules::Conv2d>>& members)
+                : kernel_size(members.at(0)->kernel_size), stride(members[0]->stride), padding(members[0]->padding), members(members) {
+                TList weights, biases;
+                for (auto&& m: members) {
+                    ATNN_ASSERT_MSG(m->kernel_size == this->kernel_size && m->stride == this->stride && m->padding == this->padding,
+                                    "the members have different convolutions");
+                    weights.push_back(m->weight.data().toBackend(at::kCPU));
+                    biases.push_back(m->bias.data().toBackend(at::kCPU));
+                }
+                this->weight = Variable(detail::stack(weights));
+                this->bias = Variable(detail::stack(biases));
+                this->parameters = {this->weight, this->bias};
+            }
+
+            detail::Geometry geometry(const at::Tensor& x) const {
+                const long d = x.dim();
+                const auto& w = this->weight.data();
+                ATNN_ASSERT_EQ(x.size(d - 3), w.size(2));
+                detail::Geometry g {x.size(d - 3), x.size(d - 2), x.size(d - 1),
+                        this->kernel_size[0], this->kernel_size[1], this->stride[0], this->stride[1], this->padding[0], this->padding[1], 0, 0};
+                g.oh = (g.height + 2 * g.ph - g.kh) / g.sh + 1;
+                g.ow = (g.width + 2 * g.pw - g.kw) / g.sw + 1;
+                return g;
+            }
+
+            void scatter() const override {
+                for (size_t e = 0; e < this->members.size(); ++e) {
+                    auto&& m = *this->members[e];
+                    for (size_t k = 0; k < this->parameters.size(); ++k) {
+                        auto&& p = this->parameters[k];
+                        auto&& q = m.parameters[k];
+                        q.ptr->data.copy_(p.data()[e]);
+                        if (is_empty(p.grad())) continue;
+                        // toBackend returns the same tensor on the same backend: clone so as not to alias the stack
+                        const auto b = q.ptr->data.type().backend();
+                        q.ptr->grad = p.grad().type().backend() == b ? p.grad()[e].clone() : p.grad()[e].toBackend(b);
+                    }
+                }
+            }
+
+            void gather() override {
+                for (size_t e = 0; e < this->members.size(); ++e) {
+                    for (size_t k = 0; k < this->parameters.size(); ++k) {
+                        this->parameters[k].ptr->data[e].copy_(this->members[e]->parameters[k].data());
+                    }
+                }
+            }
+
+            void toBackend(at::Backend b) override {
+                ATNN_ASSERT_MSG(b == at::kCPU, "ensemble::Conv2d runs on CPU");
+            }
+        };
+
+/**
+   E models of the same architecture as one chain of stacked layers.
+   the members are chains (ModuleSets are flattened and their modules applied in order, as freeze/pipeline do)
+   of Linear, Conv2d and elementwise modules (Threshold/ReLU, Sigmoid, Tanh, Scale, Dropout), which are shared.
+
+   auto ensemble = std::make_shared<ensemble::Ensemble>(members);
+   auto y = ensemble->forward(x); // (E, N, ...) for x (N, ...) or (E, N, ...)
+   y.backward(gy);
+   ensemble->parameters_of(e); // views of the e-th member's parameters and grads
+
+   the optimizer updates the stacked parameters (ModuleSet::for_each_module visits them).
+   scatter() writes them back to the member modules (e.g., to serve one member alone).
+*/
+        struct Ensemble : ModuleSet {
+            std::vector<ModulePtr> members;
+
+            explicit Ensemble(const std::vector<ModulePtr>& members) : members(members) {
+                ATNN_ASSERT(!members.empty());
+                std::vector<std::vector<ModulePtr>> chains(members.size());
+                for (size_t e = 0; e < members.size(); ++e) {
+                    detail::flatten(members[e], chains[e]);
+                    ATNN_ASSERT_MSG(chains[e].size() == chains[0].size(), "the members have different architectures");
+                }
+                for (size_t i = 0; i < chains[0].size(); ++i) {
+                    auto&& first = chains[0][i];
+                    for (auto&& c: chains) {
+                        ATNN_ASSERT_MSG(typeid(*c[i]) == typeid(*first), "the members have different architectures");
+                    }
+                    if (std::dynamic_pointer_cast<modules::Linear>(first)) {
+                        this->modules.push_back(std::make_shared<Linear>(layers<modules::Linear>(chains, i)));
+                    } else if (std::dynamic_pointer_cast<modules::Conv2d>(first)) {
+                        this->modules.push_back(std::make_shared<Conv2d>(layers<modules::Conv2d>(chains, i)));
+                    } else if (elementwise(first)) {
+                        for (auto&& c: chains) {
+                            if (!same_settings(c[i], first)) {
+                                throw_with_trace(std::runtime_error(std::string("the members have different settings of ") + typeid(*first).name()));
+                            }
+                        }
+                        this->modules.push_back(first);
+                    } else {
+                        throw_with_trace(std::runtime_error(std::string("ensemble cannot stack ") + typeid(*first).name()));
+                    }
+                }
+            }
+
+            long size() const { return this->members.size(); }
+
+            Variable forward(Variable x) {
+                for (auto&& m: this->modules) x = m->forward_unary(x);
+                return x;
+            }
+
+            Variable forward_unary(Variable x) override { return this->forward(x); }
+
+            /// views (sharing the storage) of the parameters and grads of the e-th member, in the order of its parameters
+            VList parameters_of(long e) const {
+                ATNN_ASSERT(0 <= e && e < this->size());
+                VList ps;
+                for (auto&& m: this->modules) {
+                    if (!std::dynamic_pointer_cast<Stacked>(m)) continue;
+                    m->for_each_module([&](ModuleBase&, VList& stacked) {
+                            for (auto&& p: stacked) {
+                                Variable v(p.data()[e], p.requires_grad());
+                                if (!is_empty(p.grad())) v.ptr->grad = p.grad()[e];
+                                ps.push_back(v);
+                            }
+                        });
+                }
+                return ps;
+            }
+
+            void scatter() const {
+                for (auto&& m: this->modules) {
+                    if (auto s = std::dynamic_pointer_cast<Stacked>(m)) s->scatter();
+                }
+            }
+
+            void gather() {
+                for (auto&& m: this->modules) {
+                    if (auto s = std::dynamic_pointer_cast<Stacked>(m)) s->gather();
+                }
+            }
+
+        private:
+            template <class M>
+            static std::vector<std::shared_ptr<M>> layers(const std::vector<std::vector<ModulePtr>>& chains, size_t i) {
+                std::vector<std::shared_ptr<M>> ls;
+                for (auto&& c: chains) ls.push_back(std::dynamic_pointer_cast<M>(c[i]));
+                return ls;
+            }
+
+            static bool elementwise(const ModulePtr& m) {
+                return std::dynamic_pointer_cast<modules::Threshold>(m) || std::dynamic_pointer_cast<modules::Sigmoid>(m)
+                    || std::dynamic_pointer_cast<modules::Tanh>(m) || std::dynamic_pointer_cast<modules::Scale>(m)
+                    || std::dynamic_pointer_cast<modules::Dropout>(m);
+            }
+
+            /// the shared module runs the settings of the first member: the others must match
+            static bool same_settings(const ModulePtr& m, const ModulePtr& first) {
+                if (auto t = std::dynamic_pointer_cast<modules::Threshold>(m)) {
+                    auto f = std::dynamic_pointer_cast<modules::Threshold>(first);
+                    return t->threshold.toDouble() == f->threshold.toDouble() && t->value.toDouble() == f->value.toDouble()
+                        && t->inplace == f->inplace;
+                }
+                if (auto s = std::dynamic_pointer_cast<modules::Scale>(m)) {
+                    return s->factor == std::dynamic_pointer_cast<modules::Scale>(first)->factor;
+                }
+                if (auto d = std::dynamic_pointer_cast<modules::Dropout>(m)) {
+                    auto f = std::dynamic_pointer_cast<modules::Dropout>(first);
+                    return d->p == f->p && d->training == f->training;
+                }
+                return true;
+            }
+        };
+
+    } // namespace ensemble
+} // namespace atnn
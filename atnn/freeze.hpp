@@ -0,0 +1,268 @@
+/*
+
+  This header defines inference graph freezing
+
+  - freeze: folds a trained chain of modules into an immutable forward-only Frozen
+  - Frozen: stages with pre-packed weights and no tape (Nodes, saved_tensors, column buffers)
+
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+#include "quantize.hpp"
+
+namespace atnn {
+    namespace freeze {
+
+        /// a forward-only step of Frozen. predict must not modify the stage.
+        struct Stage {
+            virtual ~Stage() {}
+            virtual at::Tensor predict(at::Tensor x) const = 0;
+            /// bytes of the weights owned by the stage
+            virtual size_t nbytes() const { return 0; }
+        };
+
+        using StagePtr = std::shared_ptr<const Stage>;
+
+        inline size_t nbytes_of(const at::Tensor& t) {
+            return t.defined() ? t.numel() * sizeof(float) : 0;
+        }
+
+        /// Linear with the weight pre-transposed to (in, out) so that x.mm(weight) reads both operands by rows
+        struct FrozenLinear : Stage {
+            at::Tensor weight, bias;
+
+            FrozenLinear(at::Tensor weight, at::Tensor bias)
+                : weight(weight.t().contiguous()), bias(bias.contiguous()) {}
+
+            at::Tensor predict(at::Tensor x) const override {
+                ATNN_ASSERT_EQ(x.dim(), 2);
+                auto y = x.mm(this->weight);
+                y += this->bias.expand(y.sizes());
+                return y;
+            }
+
+            size_t nbytes() const override { return nbytes_of(this->weight) + nbytes_of(this->bias); }
+        };
+
+        /// Conv2d whose column buffers live only during predict
+        struct FrozenConv2d : Stage {
+            at::Tensor weight, bias;
+            std::vector<int64_t> kernel_size, stride, padding;
+
+            FrozenConv2d(at::Tensor weight, at::Tensor bias, std::vector<int64_t> stride, std::vector<int64_t> padding)
+                : weight(weight.contiguous()), bias(bias.contiguous())
+                , kernel_size({weight.size(2), weight.size(3)}), stride(stride), padding(padding) {}
+
+            at::Tensor predict(at::Tensor x) const override {
+                ATNN_ASSERT_EQ(x.dim(), 4);
+                auto output = x.type().tensor();
+                auto finput = x.type().tensor();
+                auto fgrad_input = x.type().tensor();
+                return at::conv2d_forward_out(output, x, this->weight, this->kernel_size, this->bias,
+                                              this->stride, this->padding, finput, fgrad_input);
+            }
+
+            size_t nbytes() const override { return nbytes_of(this->weight) + nbytes_of(this->bias); }
+        };
+
+        /// any other module, run through its stateless ModuleBase::infer
+        struct ModuleStage : Stage {
+            ModulePtr module;
+
+            explicit ModuleStage(ModulePtr module) : module(module) {}
+
+            at::Tensor predict(at::Tensor x) const override {
+                return this->module->infer({x})[0];
+            }
+        };
+
+        /// int8 QuantizedLinear or QuantizedConv2d (float in, float out)
+        template <typename Q>
+        struct QuantizedStage : Stage {
+            Q q;
+
+            explicit QuantizedStage(Q q) : q(q) {}
+
+            at::Tensor predict(at::Tensor x) const override { return this->q.predict(x); }
+
+            size_t nbytes() const override { return this->q.nbytes(); }
+        };
+
+        /// immutable and thread-safe chain of stages
+        struct Frozen {
+            std::vector<StagePtr> stages;
+
+            at::Tensor predict(at::Tensor x) const {
+                NoGradGuard guard;
+                for (auto&& s: this->stages) {
+                    x = s->predict(x);
+                }
+                return x;
+            }
+
+            size_t nbytes() const {
+                size_t n = 0;
+                for (auto&& s: this->stages) n += s->nbytes();
+                return n;
+            }
+        };
+
+        struct FreezeOptions {
+            bool int8 = false; // quantize Linear/Conv2d with quantize::QuantizedLinear/QuantizedConv2d (CPU only)
+            TList calibration; // inputs of the chain to calibrate the int8 activation ranges
+        };
+
+        namespace detail {
+            /// Linear or Conv2d weights being folded. `module` is set instead for the other layers.
+            struct Layer {
+                at::Tensor weight, bias;
+                bool conv = false;
+                std::vector<int64_t> stride, padding;
+                ModulePtr module;
+
+                bool affine() const { return this->weight.defined(); }
+            };
+
+            inline void flatten(ModulePtr m, std::vector<ModulePtr>& chain) {
+                if (auto set = std::dynamic_pointer_cast<ModuleSet>(m)) {
+                    for (auto&& c: set->modules) flatten(c, chain);
+                } else {
+                    chain.push_back(m);
+                }
+            }
+
+            inline bool is_relu(const ModulePtr& m) {
+                auto t = std::dynamic_pointer_cast<modules::Threshold>(m);
+                return t && t->threshold.toDouble() == 0 && t->value.toDouble() == 0;
+            }
+
+            /// y = W x + b followed by y * scale + shift per output channel: W' = W * scale, b' = b * scale + shift
+            inline void fold(Layer& layer, at::Tensor scale, at::Tensor shift) {
+                const auto out = layer.weight.size(0);
+                ATNN_ASSERT_EQ(scale.size(0), out);
+                auto w = layer.weight.contiguous().view({out, -1});
+                layer.weight = (w * scale.view({out, 1}).expand(w.sizes())).view(layer.weight.sizes());
+                layer.bias = layer.bias * scale + shift;
+            }
+
+            inline std::vector<Layer> fold_chain(const std::vector<ModulePtr>& chain) {
+                std::vector<Layer> layers;
+                for (auto&& m: chain) {
+                    auto last = layers.empty() || !layers.back().affine() ? nullptr : &layers.back();
+                    if (auto linear = std::dynamic_pointer_cast<modules::Linear>(m)) {
+                        Layer l;
+                        l.weight = linear->weight.data().clone();
+                        l.bias = linear->bias.data().defined() ? linear->bias.data().clone()
+                            : l.weight.type().zeros({l.weight.size(0)});
+                        layers.push_back(l);
+                    } else if (auto conv = std::dynamic_pointer_cast<modules::Conv2d>(m)) {
+                        Layer l;
+                        l.weight = conv->weight.data().clone();
+                        l.bias = conv->bias.data().clone();
+                        l.conv = true;
+                        l.stride = conv->stride;
+                        l.padding = conv->padding;
+                        layers.push_back(l);
+                    } else if (auto bn = std::dynamic_pointer_cast<modules::BatchNorm>(m)) {
+                        ATNN_ASSERT_MSG(!bn->training, "set BatchNorm::training = false before freezing");
+                        if (last == nullptr) {
+                            layers.push_back({{}, {}, false, {}, {}, m});
+                            continue;
+                        }
+                        auto scale = (bn->running_var + bn->eps).rsqrt() * bn->weight.data();
+                        fold(*last, scale, bn->bias.data() - bn->running_mean * scale);
+                    } else if (auto s = std::dynamic_pointer_cast<modules::Scale>(m)) {
+                        if (last == nullptr) {
+                            layers.push_back({{}, {}, false, {}, {}, m});
+                            continue;
+                        }
+                        last->weight = last->weight * s->factor;
+                        last->bias = last->bias * s->factor;
+                    } else if (std::dynamic_pointer_cast<modules::Dropout>(m)) {
+                        continue; // identity at inference
+                    } else {
+                        layers.push_back({{}, {}, false, {}, {}, m});
+                    }
+                }
+                return layers;
+            }
+
+            inline StagePtr float_stage(const Layer& l) {
+                if (!l.affine()) return std::make_shared<ModuleStage>(l.module);
+                if (l.conv) return std::make_shared<FrozenConv2d>(l.weight, l.bias, l.stride, l.padding);
+                return std::make_shared<FrozenLinear>(l.weight, l.bias);
+            }
+        } // namespace detail
+
+/**
+   freezes a trained chain for deployment, e.g., freeze(net->modules) or freeze(net) for a ModuleSet
+   (nested ModuleSets are flattened and their modules are applied in order).
+
+   - BatchNorm (training = false) and Scale right after Linear/Conv2d are folded into its weight and bias
+   - Dropout is removed
+   - the weights are copied and pre-packed: transposed for Linear, or int8 per-channel with options.int8
+   - int8 Linear/Conv2d absorb a following ReLU into the GEMM epilogue
+
+   the result shares no state with the modules, so they can keep training.
+*/
+        inline Frozen freeze(const std::vector<ModulePtr>& modules, FreezeOptions options={}) {
+            std::vector<ModulePtr> chain;
+            for (auto&& m: modules) detail::flatten(m, chain);
+            const auto layers = detail::fold_chain(chain);
+
+            Frozen frozen;
+            for (auto&& l: layers) {
+                frozen.stages.push_back(detail::float_stage(l));
+            }
+            if (!options.int8) return frozen;
+
+            // observe the input range of each folded layer on the float chain
+            ATNN_ASSERT_MSG(!options.calibration.empty(), "int8 freezing needs calibration inputs");
+            std::vector<quantize::RangeObserver> observers(layers.size());
+            {
+                NoGradGuard guard;
+                for (auto x: options.calibration) {
+                    for (size_t i = 0; i < layers.size(); ++i) {
+                        if (layers[i].affine()) observers[i].observe(x);
+                        x = frozen.stages[i]->predict(x);
+                    }
+                }
+            }
+
+            Frozen quantized;
+            for (size_t i = 0; i < layers.size(); ++i) {
+                auto&& l = layers[i];
+                if (!l.affine()) {
+                    quantized.stages.push_back(frozen.stages[i]);
+                    continue;
+                }
+                const bool relu = i + 1 < layers.size() && !layers[i + 1].affine() && detail::is_relu(layers[i + 1].module);
+                const auto q = observers[i].qparams();
+                if (l.conv) {
+                    quantize::QuantizedConv2d c(l.weight, l.bias, l.stride, l.padding, q);
+                    c.relu = relu;
+                    quantized.stages.push_back(std::make_shared<QuantizedStage<quantize::QuantizedConv2d>>(c));
+                } else {
+                    quantize::QuantizedLinear c(l.weight, l.bias, q);
+                    c.relu = relu;
+                    quantized.stages.push_back(std::make_shared<QuantizedStage<quantize::QuantizedLinear>>(c));
+                }
+                if (relu) ++i;
+            }
+            return quantized;
+        }
+
+        inline Frozen freeze(std::shared_ptr<ModuleSet> set, FreezeOptions options={}) {
+            return freeze(std::vector<ModulePtr>{set}, options);
+        }
+
+    } // namespace freeze
+} // namespace atnn
@@ -0,0 +1,256 @@
+/*
+
+  This header defines the lazy executor of pointwise modules (included by autograd.hpp)
+
+  - LazyGuard: Module::forward of pointwise Functions returns unevaluated Variables
+  - Fused: a chain of pointwise ops on one input, evaluated in a single pass when data() is observed
+
+ */
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+namespace atnn {
+    namespace lazy {
+        /// longer chains are split by materializing the input
+        constexpr size_t max_ops = 16;
+
+        inline float apply(const Op& op, float x, float other) {
+            switch (op.kind) {
+            case Op::Sigmoid: return 1.0f / (1.0f + std::exp(-x));
+            case Op::Tanh: return std::tanh(x);
+            case Op::Threshold: return x > op.a ? x : op.b;
+            case Op::Scale: return x * op.a;
+            case Op::Add: return x + other;
+            }
+            return x;
+        }
+
+        /// dy/dx at x where y = apply(op, x, ...)
+        inline float derivative(const Op& op, float x, float y) {
+            switch (op.kind) {
+            case Op::Sigmoid: return y * (1.0f - y);
+            case Op::Tanh: return 1.0f - y * y;
+            case Op::Threshold: return x > op.a ? 1.0f : 0.0f;
+            case Op::Scale: return op.a;
+            case Op::Add: return 1.0f;
+            }
+            return 1.0f;
+        }
+
+        // unfused ATen versions for non CPU-float tensors
+        inline at::Tensor apply(const Op& op, at::Tensor x, at::Tensor other) {
+            switch (op.kind) {
+            case Op::Sigmoid: return x.sigmoid();
+            case Op::Tanh: return x.tanh();
+            case Op::Threshold: return at::threshold_forward(x, op.a, op.b, false);
+            case Op::Scale: return x * op.a;
+            case Op::Add: return x + other;
+            }
+            return x;
+        }
+
+        inline at::Tensor derivative(const Op& op, at::Tensor x, at::Tensor y) {
+            switch (op.kind) {
+            case Op::Sigmoid: return y * (-y + 1);
+            case Op::Tanh: return -(y * y) + 1;
+            case Op::Threshold: return x.gt(op.a).toType(x.type());
+            case Op::Scale: return x.type().ones_like(x) * op.a;
+            case Op::Add: return x.type().ones_like(x);
+            }
+            return x.type().ones_like(x);
+        }
+
+        /// the value of v without marking it observed (see VariableImpl::owned)
+        inline at::Tensor value_of(const Variable& v) {
+            if (v.ptr->pending) materialize(*v.ptr);
+            if (v.ptr->packed) v.ptr->unpack();
+            return v.ptr->data;
+        }
+
+/**
+   Fused is both the pending computation of a lazy Variable and the module of its Node.
+   intermediate results of the chain are never allocated: forward runs all ops per element,
+   and backward recomputes them per element instead of saving tensors.
+*/
+        struct Fused : ModuleBase {
+            Variable input;
+            VList operands; // the other inputs of Add ops, same shape as input
+            std::vector<Op> ops;
+            std::vector<SavedVersion> versions; // of input and operands when recorded
+
+            bool fusible(const at::Tensor& x) const {
+                return x.type().backend() == at::kCPU && x.type().scalarType() == at::kFloat;
+            }
+
+            TList operand_data(const at::Tensor& x) const {
+                TList os;
+                for (auto&& o: this->operands) {
+                    os.push_back(value_of(o).contiguous());
+                    ATNN_ASSERT_SHAPE_EQ(os.back().sizes(), x.sizes());
+                }
+                return os;
+            }
+
+            /// writes into the input when it is a lazy temporary nobody else refers to
+            at::Tensor run(bool inplace) const {
+                check_versions(this->versions);
+                auto x = value_of(this->input);
+                const auto os = this->operand_data(x);
+                if (!this->fusible(x)) {
+                    for (auto&& op: this->ops) {
+                        x = apply(op, x, op.kind == Op::Add ? os[op.operand] : at::Tensor());
+                    }
+                    return x;
+                }
+                x = x.contiguous();
+                auto y = inplace ? x : x.type().tensor(x.sizes());
+                std::vector<const float*> po;
+                for (auto&& o: os) po.push_back(o.data<float>());
+                const auto px = x.data<float>();
+                auto py = y.data<float>();
+                const long n = x.numel();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long i = 0; i < n; ++i) {
+                    float h = px[i];
+                    for (auto&& op: this->ops) {
+                        h = apply(op, h, op.kind == Op::Add ? po[op.operand][i] : 0.0f);
+                    }
+                    py[i] = h;
+                }
+                return y;
+            }
+
+            /// grads of {input, operands...}
+            GradList backward(const GradList& grads) override {
+                ATNN_ASSERT_EQ(grads.size(), 1);
+                const auto x = value_of(this->input).contiguous();
+                const auto os = this->operand_data(x);
+                auto gx = x.type().zeros_like(x);
+                TList gos;
+                for (auto&& o: os) gos.push_back(o.type().zeros_like(o));
+
+                if (this->fusible(x)) {
+                    const auto gy = grads[0].contiguous();
+                    std::vector<const float*> po;
+                    std::vector<float*> pgo;
+                    for (size_t k = 0; k < os.size(); ++k) {
+                        po.push_back(os[k].data<float>());
+                        pgo.push_back(gos[k].data<float>());
+                    }
+                    const auto px = x.data<float>();
+                    const auto pgy = gy.data<float>();
+                    auto pgx = gx.data<float>();
+                    const long n = x.numel();
+                    const auto nops = this->ops.size();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < n; ++i) {
+                        float h[max_ops + 1];
+                        h[0] = px[i];
+                        for (size_t k = 0; k < nops; ++k) {
+                            auto&& op = this->ops[k];
+                            h[k + 1] = apply(op, h[k], op.kind == Op::Add ? po[op.operand][i] : 0.0f);
+                        }
+                        float g = pgy[i];
+                        for (size_t k = nops; k-- > 0;) {
+                            auto&& op = this->ops[k];
+                            if (op.kind == Op::Add) pgo[op.operand][i] += g;
+                            else g *= derivative(op, h[k], h[k + 1]);
+                        }
+                        pgx[i] = g;
+                    }
+                } else {
+                    TList h = {x};
+                    for (auto&& op: this->ops) {
+                        h.push_back(apply(op, h.back(), op.kind == Op::Add ? os[op.operand] : at::Tensor()));
+                    }
+                    auto g = grads[0];
+                    for (size_t k = this->ops.size(); k-- > 0;) {
+                        auto&& op = this->ops[k];
+                        if (op.kind == Op::Add) gos[op.operand] += g;
+                        else g = g * derivative(op, h[k], h[k + 1]);
+                    }
+                    gx = g;
+                }
+
+                GradList gxs = {gx};
+                for (auto&& g: gos) gxs.push_back(g);
+                return gxs;
+            }
+
+            void toBackend(at::Backend) override {}
+
+            TList infer(TList) override {
+                ATNN_ASSERT_MSG(false, "never call this");
+                return {};
+            }
+        };
+
+        inline void materialize(VariableImpl& v) {
+            auto fused = std::move(v.pending);
+            v.pending.reset();
+            auto&& input = fused->input.ptr;
+            if (input->pending) materialize(*input);
+            // an unobserved lazy result that only this Fused refers to (no Node, no user Variable)
+            const bool inplace = input->owned && input.use_count() == 1;
+            v.data = fused->run(inplace);
+            v.owned = true;
+        }
+
+        inline Variable to_variable(const Variable& v) { return v; }
+
+        inline Variable to_variable(at::Tensor t) { return Variable(t, false); }
+
+        /// appends op to the pending chain of the first input, or starts a new chain
+        template <class ... Args>
+        Variable record(Op op, Args ... args) {
+            VList xs = {to_variable(args)...};
+            ATNN_ASSERT_EQ(xs.size(), op.arity());
+            if (xs.size() == 2 && !xs[0].ptr->pending && xs[1].ptr->pending) {
+                std::swap(xs[0], xs[1]); // Add commutes: extend the pending chain
+            }
+
+            auto fused = std::make_shared<Fused>();
+            auto prev = xs[0].ptr->pending;
+            if (prev && prev->ops.size() < max_ops) {
+                fused->input = prev->input;
+                fused->operands = prev->operands;
+                fused->ops = prev->ops;
+                fused->versions = prev->versions;
+            } else {
+                fused->input = xs[0];
+                fused->versions.push_back({xs[0].ptr->version, xs[0].ptr->version->value});
+            }
+            if (op.kind == Op::Add) {
+                op.operand = fused->operands.size();
+                fused->operands.push_back(xs[1]);
+                fused->versions.push_back({xs[1].ptr->version, xs[1].ptr->version->value});
+            }
+            fused->ops.push_back(op);
+
+            bool requires_grad = false;
+            for (auto&& x: xs) requires_grad = requires_grad || x.requires_grad();
+            Variable y(at::Tensor{}, GradMode::is_enabled() && requires_grad);
+            y.ptr->pending = fused;
+            if (y.requires_grad()) {
+                auto node = std::make_shared<Node>();
+                node->module = fused;
+                node->add_varg(fused->input);
+                for (auto&& o: fused->operands) node->add_varg(o);
+                node->vrets.push_back(y.ptr);
+                node->saved_versions = fused->versions;
+                y.set_node(node);
+            }
+            return y;
+        }
+    } // namespace lazy
+} // namespace atnn
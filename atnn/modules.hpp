@@ -1,28 +1,41 @@
 #pragma once
 
+#include <cmath>
+
 #include <ATen/ATen.h>
 #include <ATen/Functions.h>
 
+#include "allocator.hpp"
 #include "autograd.hpp"
+#include "random.hpp"
 #include "testing.hpp"
 
 #define ATNN_UNARY_STATIC_FUNCTION(module, prefix)                      \
     struct module : atnn::Module<module> {                              \
         using Function = struct {                                       \
             template <typename Context>                                 \
-            static auto forward(Context ctx, atnn::TList xs) {          \
+            static atnn::lazy::Op pointwise(Context) {                  \
+                return {atnn::lazy::Op::module};                        \
+            }                                                           \
+            template <typename Context>                                 \
+            static auto forward(Context ctx, atnn::TArray<1> xs) {      \
                 ATNN_ASSERT_EQ(xs.size(), 1);                           \
                 auto y = at::prefix##_forward(xs[0]);                   \
                 ctx->save_for_backward({y});                            \
                 return y;                                               \
             }                                                           \
             template <typename Context>                                 \
-            static atnn::TList backward(Context ctx, atnn::TList gy) {  \
+            static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) { \
                 ATNN_ASSERT_EQ(gy.size(), 1);                           \
                 auto y = ctx->saved_tensors[0];                         \
                 ATNN_ASSERT_SHAPE_EQ(gy[0].sizes(), y.sizes());         \
                 return {at::prefix##_backward(gy[0], y)};               \
             }                                                           \
+            /* elementwise: J v = J^T v */                              \
+            template <typename Context>                                 \
+            static at::Tensor jvp(Context, atnn::TArray<1>, at::Tensor y, atnn::TArray<1> tx) { \
+                return at::prefix##_backward(tx[0], y);                 \
+            }                                                           \
         };                                                              \
     }
 
@@ -30,20 +43,24 @@
     struct module : atnn::Module<module> {                              \
         using Function = struct {                                       \
             template <typename Context>                                 \
-            static auto forward(Context ctx, atnn::TList xs) {          \
+            static auto forward(Context ctx, atnn::TArray<1> xs) {      \
                 ATNN_ASSERT_EQ(xs.size(), 1);                           \
                 auto y = at::prefix##_forward(xs[0]);                   \
                 ctx->save_for_backward({xs[0], y});                     \
                 return y;                                               \
             }                                                           \
             template <typename Context>                                 \
-            static atnn::TList backward(Context ctx, atnn::TList gy) {  \
+            static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) { \
                 ATNN_ASSERT_EQ(gy.size(), 1);                           \
                 auto x = ctx->saved_tensors[0];                         \
                 auto y = ctx->saved_tensors[1];                         \
                 ATNN_ASSERT_SHAPE_EQ(gy[0].sizes(), x.sizes());         \
                 return {at::prefix##_backward(gy[0], x, y)};            \
             }                                                           \
+            template <typename Context>                                 \
+            static at::Tensor jvp(Context, atnn::TArray<1>, at::Tensor y, atnn::TArray<1> tx) { \
+                return atnn::modules::detail::prefix##_jvp(y, tx[0]);   \
+            }                                                           \
         };                                                              \
     }
 
@@ -52,6 +69,24 @@ namespace atnn {
 
     namespace modules {
 
+        namespace detail {
+            /// sum of p * t over the normalized dim (0 of 1-D, 1 otherwise) broadcast to the shape of t
+            inline at::Tensor class_sum(const at::Tensor& p, const at::Tensor& t) {
+                const long n = t.dim() == 1 ? 1 : t.size(0);
+                const long c = t.dim() == 1 ? t.size(0) : t.size(1);
+                auto pt = (p * t).contiguous().view({n, c, -1});
+                return pt.sum(1).view({n, 1, pt.size(2)}).expand(pt.sizes()).contiguous().view(t.sizes());
+            }
+
+            inline at::Tensor log_softmax_jvp(const at::Tensor& y, const at::Tensor& t) {
+                return t - class_sum(y.exp(), t);
+            }
+
+            inline at::Tensor softmax_jvp(const at::Tensor& y, const at::Tensor& t) {
+                return y * (t - class_sum(y, t));
+            }
+        } // namespace detail
+
         ATNN_UNARY_STATIC_FUNCTION(Sigmoid, _sigmoid);
         ATNN_UNARY_STATIC_FUNCTION(Tanh, _tanh);
         ATNN_NORMALIZED_STATIC_FUNCTION(LogSoftmax, log_softmax);
@@ -72,6 +107,12 @@ namespace atnn {
                     auto xs = ctx->saved_tensors;
                     return {at::nll_loss_backward(xs[0], xs[1], ctx->weight, ctx->size_average, ctx->ignore_index, ctx->total_weight)};
                 }
+
+                /// linear in the log probabilities
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TList xs, at::Tensor, atnn::TList tx) {
+                    return at::nll_loss_forward(tx[0], xs[1], ctx->weight, ctx->size_average, ctx->ignore_index, ctx->total_weight);
+                }
             };
 
             bool size_average;
@@ -95,11 +136,20 @@ namespace atnn {
                 static atnn::TList backward(Context ctx, atnn::TList gy) {
                     auto xs = ctx->saved_tensors;
 
-                    // TODO: support user-defined gy?
-                    at::Tensor grad_out;
-                    if (gy.size() == 0) { grad_out = xs[0].type().ones_like(xs[0]); }
-                    else { ATNN_ASSERT_EQ(gy.size(), 1); grad_out == 0; }
-                    return {at::mse_loss_backward(grad_out, xs[0], xs[1], ctx->size_average, ctx->reduce)};
+                    auto grad = at::mse_loss_backward(xs[0].type().ones_like(xs[0]), xs[0], xs[1], ctx->size_average, ctx->reduce);
+                    if (gy.size() == 0 || !gy[0].defined()) return {grad};
+                    // e.g., the loss scale of amp.hpp
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    if (ctx->reduce) grad *= at::Scalar(gy[0].sum());
+                    else grad *= gy[0];
+                    return {grad};
+                }
+
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TList xs, at::Tensor y, atnn::TList tx) {
+                    auto grad = at::mse_loss_backward(xs[0].type().ones_like(xs[0]), xs[0], xs[1], ctx->size_average, ctx->reduce);
+                    auto ty = grad * (tx[0] - tx[1]);
+                    return ctx->reduce ? ty.sum().view_as(y) : ty;
                 }
             };
 
@@ -113,18 +163,31 @@ namespace atnn {
         struct Threshold : atnn::Module<Threshold> {
             using Function = struct {
                 template <typename Context>
-                static auto forward(Context ctx, atnn::TList xs) {
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
                     ATNN_ASSERT_EQ(xs.size(), 1);
                     ctx->save_for_backward(xs);
+                    if (ctx->inplace) ctx->mark_dirty(xs[0]);
                     return at::threshold_forward(xs[0], ctx->threshold, ctx->value, ctx->inplace);
                 }
 
                 template <typename Context>
-                static atnn::TList backward(Context ctx, atnn::TList gy) {
+                static atnn::lazy::Op pointwise(Context ctx) {
+                    return {atnn::lazy::Op::Threshold, ctx->threshold.toFloat(), ctx->value.toFloat()};
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
                     ATNN_ASSERT_EQ(gy.size(), 1);
                     auto x = ctx->saved_tensors[0];
                     ATNN_ASSERT_SHAPE_EQ(gy[0].sizes(), x.sizes());
-                    return {at::threshold_backward(gy[0], x, ctx->threshold, ctx->value, ctx->inplace)};
+                    // never in place: gy may be shared with other grads (Variable::backward does not copy them).
+                    // x is the output when inplace, which gives the same mask for value <= threshold (e.g., ReLU)
+                    return {at::threshold_backward(gy[0], x, ctx->threshold, ctx->value, false)};
+                }
+
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TArray<1> xs, at::Tensor, atnn::TArray<1> tx) {
+                    return at::threshold_backward(tx[0], xs[0], ctx->threshold, ctx->value, false);
                 }
             };
 
@@ -143,47 +206,72 @@ namespace atnn {
             // https://github.com/chainer/chainer/blob/master/chainer/functions/connection/linear.py
             using Function = struct {
                 template <typename Context>
-                static auto forward(Context ctx, atnn::TList xs) {
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
                     ATNN_ASSERT_EQ(xs.size(), 1);
                     ctx->save_for_backward(xs);
 
-                    auto y = xs[0].mm(ctx->weight.data().t());
+                    auto y = atnn::alloc::empty(xs[0].type(), {xs[0].size(0), ctx->weight.data().size(0)});
+                    at::mm_out(y, xs[0], ctx->weight.data().t());
                     if (ctx->bias.data().defined()) {
                         y += ctx->bias.data().expand(y.sizes());
                     }
                     return y;
                 }
                 template <typename Context>
-                static atnn::TList backward(Context ctx, atnn::TList gy) {
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
                     ATNN_ASSERT_EQ(gy.size(), 1);
                     auto x = ctx->saved_tensors[0];
-                    auto gx = gy[0].mm(ctx->weight.data());
-                    auto grad_weight = gy[0].t().mm(x.t());
+                    at::Tensor gx;
+                    if (ctx->needs_input_grad(0)) {
+                        gx = atnn::alloc::empty_like(x);
+                        at::mm_out(gx, gy[0], ctx->weight.data());
+                    }
+                    if (auto per_sample = atnn::PerSampleGrad::current()) {
+                        if (ctx->weight.requires_grad() || ctx->bias.requires_grad()) {
+                            per_sample->add(ctx->weight, ctx->bias, x.contiguous().view({x.size(0), x.size(1), 1}),
+                                            gy[0].contiguous().view({x.size(0), gy[0].size(1), 1}));
+                        }
+                        return {gx};
+                    }
 
                     // FIXME: assign grad uniformliy instead of separately
                     // now: parameters.grad (set inside function), arguments.grad (set outside function)
                     // refactor: set them outside uniformly and call Funtion from Module
                     // Module<Derived>.forward(VList xs) { return this->function(this, this->parameters ++ xs) }
-                    if (ctx->weight.grad().defined())
-                        ctx->weight.ptr->grad += grad_weight;
-                    else ctx->weight.ptr->grad = grad_weight;
+                    auto&& grad_weight = ctx->weight.ptr->grad;
+                    if (ctx->weight.requires_grad()) {
+                        if (is_empty(grad_weight)) {
+                            auto g = atnn::alloc::empty_like(ctx->weight.data());
+                            atnn::accumulate_grad(ctx->weight, at::mm_out(g, gy[0].t(), x));
+                        } else grad_weight.addmm_(gy[0].t(), x, 1, atnn::GradAccumulation::scale()); // no temporary
+                    }
 
-                    at::Tensor grad_bias;
-                    if (ctx->bias.data().defined()) {
-                        grad_bias = gy[0].sum(0);
-                        if (ctx->bias.grad().defined())
-                            ctx->bias.ptr->grad += grad_bias;
-                        else ctx->bias.ptr->grad = grad_bias; 
+                    if (ctx->bias.data().defined() && ctx->bias.requires_grad()) {
+                        atnn::accumulate_grad(ctx->bias, gy[0].sum(0));
                     }
                     return {gx}; // FIXME: return {gx, gw, gb}
                 }
+
+                /// tx W^T + x tW^T + tb with the tangents of the parameters if any
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TArray<1> xs, at::Tensor, atnn::TArray<1> tx) {
+                    auto ty = tx[0].mm(ctx->weight.data().t());
+                    const auto tw = ctx->weight.tangent();
+                    if (tw.defined()) ty.addmm_(xs[0], tw.t());
+                    if (ctx->bias.data().defined() && ctx->bias.tangent().defined()) {
+                        ty += ctx->bias.tangent().expand(ty.sizes());
+                    }
+                    return ty;
+                }
             };
 
             Variable weight, bias;
             Linear(long in_features, long out_features, bool use_bias=true)
-                : weight(CPU(at::kFloat).randn({out_features, in_features}))
-                , bias(use_bias ? CPU(at::kFloat).randn({out_features}) : at::Tensor{})
-                {}
+                : weight(atnn::random::randn({out_features, in_features}))
+                , bias(use_bias ? atnn::random::randn({out_features}) : at::Tensor{}) {
+                this->parameters = {this->weight};
+                if (use_bias) this->parameters.push_back(this->bias);
+            }
         };
 
         struct Conv2d : atnn::Module<Conv2d> {
@@ -192,16 +280,23 @@ namespace atnn {
                 //   Tensor & output, const Tensor & input, const Tensor & weight, IntList kernel_size, const Tensor & bias,
                 //   IntList stride, IntList padding, const Tensor & finput, const Tensor & fgrad_input);
                 template <typename Context>
-                static auto forward(Context ctx, atnn::TList xs) {
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
                     ATNN_ASSERT_EQ(xs.size(), 1);
                     ATNN_ASSERT_EQ(xs[0].dim(), 4);
-                    ctx->save_for_backward(xs);
                     auto&& x = xs[0];
-                    at::Tensor output = x.type().zeros_like(x);
-                    atnn::to_backend_of(ctx->finput, x);
-                    atnn::to_backend_of(ctx->fgrad_input, x);
+                    const auto n = x.size(0);
+                    const auto oh = (x.size(2) + 2 * ctx->padding[0] - ctx->kernel_size[0]) / ctx->stride[0] + 1;
+                    const auto ow = (x.size(3) + 2 * ctx->padding[1] - ctx->kernel_size[1]) / ctx->stride[1] + 1;
+                    // in their final shapes (not resized by THNN) to come from the caching allocator (see allocator.hpp)
+                    at::Tensor output = atnn::alloc::empty(x.type(), {n, ctx->weight.data().size(0), oh, ow});
+                    // per-call column buffers: the module is shared by concurrent calls. CUDA fills one 2-D buffer reused per image
+                    at::Tensor finput = x.type().backend() == at::kCPU
+                        ? atnn::alloc::empty(x.type(), {n, x.size(1) * ctx->kernel_size[0] * ctx->kernel_size[1], oh * ow})
+                        : x.type().tensor();
+                    at::Tensor fgrad_input = x.type().tensor();
+                    ctx->save_for_backward({x, finput, fgrad_input});
                     return at::conv2d_forward_out(output, x, ctx->weight.data(), ctx->kernel_size, ctx->bias.data(),
-                                                  ctx->stride, ctx->padding, ctx->finput, ctx->fgrad_input);
+                                                  ctx->stride, ctx->padding, finput, fgrad_input);
                 }
 
                 // static inline std::tuple<Tensor &,Tensor &,Tensor &> conv2d_backward_out(
@@ -209,48 +304,330 @@ namespace atnn {
                 //   const Tensor & input, const Tensor & weight, IntList kernel_size, IntList stride, IntList padding,
                 //   const Tensor & finput, const Tensor & fgrad_input);
                 template <typename Context>
-                static atnn::TList backward(Context ctx, atnn::TList gy) {
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
                     ATNN_ASSERT_EQ(gy.size(), 1);
                     ATNN_ASSERT_EQ(gy[0].dim(), 4);
                     auto&& grad_output = gy[0];
                     auto&& x = ctx->saved_tensors[0];
-                    auto grad_input = x.type().zeros_like(x);
-                    atnn::to_backend_of(ctx->finput, x);
-                    atnn::to_backend_of(ctx->fgrad_input, x);
-                    // FIXME: increment grad instead of assign?
+                    auto&& finput = ctx->saved_tensors[1];
+                    auto&& fgrad_input = ctx->saved_tensors[2];
+                    const bool train = ctx->weight.requires_grad() || ctx->bias.requires_grad();
+                    const auto per_sample = atnn::PerSampleGrad::current();
+                    if (per_sample && train) {
+                        ATNN_ASSERT_MSG(finput.dim() == 3 && finput.size(0) == x.size(0), "per-sample grads need the im2col columns (CPU)");
+                        per_sample->add(ctx->weight, ctx->bias, finput, grad_output.contiguous().view({x.size(0), grad_output.size(1), -1}));
+                    }
+                    // e.g., the input images: no grad_input (col2im) at all from the CPU columns (n, in * kh * kw, oh * ow)
+                    if (!ctx->needs_input_grad(0) && finput.dim() == 3) {
+                        if (train && !per_sample) accumulate_parameter_grads(ctx, grad_output, finput);
+                        return {at::Tensor()};
+                    }
+                    // CUDA keeps no columns per image: the grad_input is computed as scratch when not needed
+                    auto grad_input = atnn::alloc::zeros_like(x);
+                    // conv2d_backward_out overwrites grad_weight and grad_bias: not the accumulated grads
                     at::Tensor grad_weight, grad_bias;
-                    grad_weight = gy[0].type().zeros(ctx->weight.sizes());
-                    grad_bias = gy[0].type().zeros(ctx->bias.sizes());
+                    grad_weight = atnn::alloc::zeros(gy[0].type(), ctx->weight.sizes());
+                    grad_bias = atnn::alloc::zeros(gy[0].type(), ctx->bias.sizes());
                     at::conv2d_backward_out(grad_input, grad_weight, grad_bias, grad_output,
                                             x, ctx->weight.data(), ctx->kernel_size, ctx->stride, ctx->padding,
-                                            ctx->finput, ctx->fgrad_input);
-
-                    if (ctx->weight.grad().defined())
-                        ctx->weight.ptr->grad += grad_weight;
-                    else ctx->weight.ptr->grad = grad_weight;
+                                            finput, fgrad_input);
+                    if (!ctx->needs_input_grad(0)) grad_input = at::Tensor();
+                    if (per_sample) return {grad_input}; // the batch grads are discarded
 
-                    if (ctx->bias.grad().defined())
-                        ctx->bias.ptr->grad += grad_bias;
-                    else ctx->bias.ptr->grad = grad_bias;
+                    if (ctx->weight.requires_grad()) atnn::accumulate_grad(ctx->weight, grad_weight);
+                    if (ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, grad_bias);
                     return {grad_input};
                 }
+
+                /// grad_weight = sum_n gy_n finput_n^T from the saved columns finput (n, in * kh * kw, out_h * out_w)
+                template <typename Context>
+                static void accumulate_parameter_grads(Context ctx, const at::Tensor& grad_output, const at::Tensor& finput) {
+                    const auto n = grad_output.size(0);
+                    const auto out_channels = grad_output.size(1);
+                    auto gy = grad_output.contiguous().view({n, out_channels, -1});
+                    if (ctx->weight.requires_grad()) {
+                        auto grad_weight = atnn::alloc::zeros(gy.type(), {out_channels, finput.size(1)});
+                        for (int64_t i = 0; i < n; ++i) {
+                            grad_weight.addmm_(gy[i], finput[i].t());
+                        }
+                        atnn::accumulate_grad(ctx->weight, grad_weight.view(ctx->weight.sizes()));
+                    }
+                    if (ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, gy.sum(2).sum(0));
+                }
+
+                /// conv(tx, W) + conv(x, tW) + tb with the tangents of the parameters if any
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TArray<1> xs, at::Tensor, atnn::TArray<1> tx) {
+                    auto&& w = ctx->weight.data();
+                    auto ty = conv(ctx, tx[0], w, w.type().zeros(ctx->bias.sizes()));
+                    auto tw = ctx->weight.tangent();
+                    auto tb = ctx->bias.tangent();
+                    if (tw.defined() || tb.defined()) {
+                        if (!tw.defined()) tw = w.type().zeros_like(w);
+                        if (!tb.defined()) tb = w.type().zeros(ctx->bias.sizes());
+                        ty += conv(ctx, xs[0], tw, tb);
+                    }
+                    return ty;
+                }
+
+                template <typename Context>
+                static at::Tensor conv(Context ctx, const at::Tensor& x, const at::Tensor& w, const at::Tensor& b) {
+                    auto output = x.type().tensor();
+                    auto finput = x.type().tensor();
+                    auto fgrad_input = x.type().tensor();
+                    return at::conv2d_forward_out(output, x, w, ctx->kernel_size, b, ctx->stride, ctx->padding, finput, fgrad_input);
+                }
             };
 
             atnn::Variable weight, bias;
-            at::Tensor finput, fgrad_input; // buffers
-            at::IntList kernel_size, stride, padding;
+            std::vector<int64_t> kernel_size, stride, padding; // owned: IntList arguments may be temporaries
 
             Conv2d(long in_channels, long out_channels, at::IntList kernel_size={3, 3}, at::IntList stride={1, 1}, at::IntList padding={0, 0})
                 // TODO: init nicely
-                : weight(CPU(at::kFloat).randn({out_channels, in_channels, kernel_size[0], kernel_size[1]}))
+                : weight(atnn::random::randn({out_channels, in_channels, kernel_size[0], kernel_size[1]}))
                 , bias(CPU(at::kFloat).zeros(out_channels))
-                , finput(CPU(at::kFloat).zeros(out_channels))
-                , fgrad_input(CPU(at::kFloat).zeros(out_channels))
-                , kernel_size(kernel_size)    
-                , stride(stride)
-                , padding(padding) {
+                , kernel_size(kernel_size.vec())
+                , stride(stride.vec())
+                , padding(padding.vec()) {
+                this->parameters = {this->weight, this->bias};
+            }
+        };
+
+        /// y = x * factor
+        struct Scale : atnn::Module<Scale> {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    ATNN_ASSERT_EQ(xs.size(), 1);
+                    return xs[0] * ctx->factor;
+                }
+
+                template <typename Context>
+                static atnn::lazy::Op pointwise(Context ctx) {
+                    return {atnn::lazy::Op::Scale, static_cast<float>(ctx->factor)};
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    return {gy[0] * ctx->factor};
+                }
+
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TArray<1>, at::Tensor, atnn::TArray<1> tx) {
+                    return tx[0] * ctx->factor;
+                }
+            };
+
+            double factor;
+            explicit Scale(double factor) : factor(factor) {}
+        };
+
+        /// zeroes each element with probability p and scales the others by 1 / (1 - p) in training.
+        /// saves (seed, offset) of its mask instead of the mask, and regenerates it in backward
+        struct Dropout : atnn::Module<Dropout> {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    ATNN_ASSERT_EQ(xs.size(), 1);
+                    if (!ctx->training || ctx->p == 0) return xs[0];
+                    auto stream = CPU(at::kLong).tensor({2});
+                    stream.template data<int64_t>()[0] = ctx->generator->seed;
+                    stream.template data<int64_t>()[1] = ctx->generator->reserve(xs[0].numel());
+                    ctx->save_for_backward({stream});
+                    return dropout(ctx, xs[0], stream);
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    if (ctx->saved_tensors.empty()) return {gy[0]}; // identity
+                    return {dropout(ctx, gy[0], ctx->saved_tensors[0])};
+                }
+
+                /// the mask of the call, regenerated from the (seed, offset) its forward saved
+                template <typename Context>
+                static at::Tensor jvp(Context ctx, atnn::TArray<1>, at::Tensor, atnn::TArray<1> tx) {
+                    if (ctx->saved_tensors.empty()) return tx[0]; // identity
+                    return dropout(ctx, tx[0], ctx->saved_tensors[0]);
+                }
+
+                template <typename Context>
+                static at::Tensor dropout(Context ctx, const at::Tensor& x, const at::Tensor& stream) {
+                    const auto s = stream.template data<int64_t>();
+                    return atnn::random::dropout(x, ctx->p, s[0], s[1]);
+                }
+            };
+
+            float p;
+            bool training = true; // false: identity
+            atnn::random::Generator* generator; // not owned
+
+            explicit Dropout(float p=0.5, atnn::random::Generator& generator=atnn::random::default_generator())
+                : p(p), generator(&generator) {
+                ATNN_ASSERT(0 <= p && p < 1);
+            }
+        };
+
+        /// batch normalization over the channel dim (1) of (N, C) or (N, C, H, W) inputs
+        struct BatchNorm : atnn::Module<BatchNorm> {
+            using Function = struct {
+                // (C) tensor broadcast to x viewed as (N, C, spatial)
+                static at::Tensor channels(at::Tensor c, const at::Tensor& x3) {
+                    return c.view({1, c.size(0), 1}).expand(x3.sizes());
+                }
+
+                // sum over all but the channel dim of (N, C, spatial)
+                static at::Tensor channel_sum(const at::Tensor& x3) {
+                    return x3.sum(2).sum(0);
+                }
+
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    ATNN_ASSERT_EQ(xs.size(), 1);
+                    auto&& x = xs[0];
+                    ATNN_ASSERT_EQ(x.size(1), ctx->weight.data().size(0));
+                    auto x3 = x.contiguous().view({x.size(0), x.size(1), -1});
+                    at::Tensor mean, invstd;
+                    if (ctx->training) {
+                        const double m = x3.size(0) * x3.size(2);
+                        mean = channel_sum(x3) / m;
+                        auto centered = x3 - channels(mean, x3);
+                        auto var = channel_sum(centered * centered) / m;
+                        invstd = (var + ctx->eps).rsqrt();
+                        ctx->running_mean = ctx->running_mean * (1 - ctx->momentum) + mean * ctx->momentum;
+                        ctx->running_var = ctx->running_var * (1 - ctx->momentum) + var * (ctx->momentum * m / std::max(m - 1, 1.0));
+                    } else {
+                        mean = ctx->running_mean;
+                        invstd = (ctx->running_var + ctx->eps).rsqrt();
+                    }
+                    ctx->save_for_backward({x, mean, invstd});
+                    auto scale = invstd * ctx->weight.data();
+                    auto y = (x3 - channels(mean, x3)) * channels(scale, x3) + channels(ctx->bias.data(), x3);
+                    return y.view(x.sizes());
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    auto&& x = ctx->saved_tensors[0];
+                    auto&& mean = ctx->saved_tensors[1];
+                    auto&& invstd = ctx->saved_tensors[2];
+                    auto x3 = x.contiguous().view({x.size(0), x.size(1), -1});
+                    auto gy3 = gy[0].contiguous().view(x3.sizes());
+                    auto xhat = (x3 - channels(mean, x3)) * channels(invstd, x3);
+                    auto grad_bias = channel_sum(gy3);
+                    auto grad_weight = channel_sum(gy3 * xhat);
+                    auto scale = invstd * ctx->weight.data();
+
+                    at::Tensor gx;
+                    if (ctx->training) {
+                        const double m = x3.size(0) * x3.size(2);
+                        gx = (gy3 - channels(grad_bias / m, x3) - xhat * channels(grad_weight / m, x3)) * channels(scale, x3);
+                    } else {
+                        gx = gy3 * channels(scale, x3);
+                    }
+
+                    if (ctx->weight.requires_grad()) atnn::accumulate_grad(ctx->weight, grad_weight);
+                    if (ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, grad_bias);
+                    return {gx.view(x.sizes())};
+                }
+            };
+
+            atnn::Variable weight, bias;
+            at::Tensor running_mean, running_var;
+            double eps, momentum;
+            bool training = true; // false uses the running statistics
+
+            BatchNorm(long num_features, double eps=1e-5, double momentum=0.1)
+                : weight(CPU(at::kFloat).ones({num_features}))
+                , bias(CPU(at::kFloat).zeros({num_features}))
+                , running_mean(CPU(at::kFloat).zeros({num_features}))
+                , running_var(CPU(at::kFloat).ones({num_features}))
+                , eps(eps)
+                , momentum(momentum) {
                 this->parameters = {this->weight, this->bias};
             }
+
+            void toBackend(at::Backend b) override {
+                atnn::Module<BatchNorm>::toBackend(b);
+                atnn::to_backend_of(this->running_mean, b);
+                atnn::to_backend_of(this->running_var, b);
+            }
+        };
+
+        /// one step of LSTM: (x (N, input), h (N, hidden), c (N, hidden)) -> (h', c'). apply it per time step
+        struct LSTMCell : atnn::Module<LSTMCell> {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<3> xs) {
+                    auto&& x = xs[0];
+                    auto&& h = xs[1];
+                    auto&& c = xs[2];
+                    const auto n = x.size(0);
+                    const auto hidden = ctx->hidden_size;
+                    // gates (N, 4 * hidden) in the order of input, forget, cell and output
+                    auto gates = ctx->bias.data().view({1, 4 * hidden}).expand({n, 4 * hidden}).contiguous();
+                    gates.addmm_(x, ctx->weight_ih.data().t());
+                    gates.addmm_(h, ctx->weight_hh.data().t());
+                    auto i = gates.narrow(1, 0, hidden).sigmoid();
+                    auto f = gates.narrow(1, hidden, hidden).sigmoid();
+                    auto g = gates.narrow(1, 2 * hidden, hidden).tanh();
+                    auto o = gates.narrow(1, 3 * hidden, hidden).sigmoid();
+                    auto c_next = f * c + i * g;
+                    auto tanh_c = c_next.tanh();
+                    ctx->save_for_backward({x, h, c, i, f, g, o, tanh_c});
+                    return atnn::TArray<2> {o * tanh_c, c_next};
+                }
+
+                template <typename Context>
+                static atnn::TArray<3> backward(Context ctx, atnn::TArray<2> gy) {
+                    auto&& s = ctx->saved_tensors;
+                    auto&& x = s[0];
+                    auto&& h = s[1];
+                    auto&& c = s[2];
+                    auto&& i = s[3];
+                    auto&& f = s[4];
+                    auto&& g = s[5];
+                    auto&& o = s[6];
+                    auto&& tanh_c = s[7];
+                    // undefined when the output is unused (e.g., c' of the last step)
+                    auto gh = gy[0].defined() ? gy[0] : atnn::alloc::zeros_like(h);
+                    auto gc = gy[1].defined() ? gy[1] : atnn::alloc::zeros_like(c);
+                    auto dc = gc + gh * o * (1 - tanh_c * tanh_c);
+                    auto dgates = at::cat(atnn::TList {dc * g * i * (1 - i),
+                                                       dc * c * f * (1 - f),
+                                                       dc * i * (1 - g * g),
+                                                       gh * tanh_c * o * (1 - o)}, 1);
+                    at::Tensor dx, dh, dc_prev;
+                    if (ctx->needs_input_grad(0)) dx = dgates.mm(ctx->weight_ih.data());
+                    if (ctx->needs_input_grad(1)) dh = dgates.mm(ctx->weight_hh.data());
+                    if (ctx->needs_input_grad(2)) dc_prev = dc * f;
+                    if (ctx->weight_ih.requires_grad()) atnn::accumulate_grad(ctx->weight_ih, dgates.t().mm(x));
+                    if (ctx->weight_hh.requires_grad()) atnn::accumulate_grad(ctx->weight_hh, dgates.t().mm(h));
+                    if (ctx->bias.requires_grad()) atnn::accumulate_grad(ctx->bias, dgates.sum(0));
+                    return {dx, dh, dc_prev};
+                }
+            };
+
+            atnn::Variable weight_ih, weight_hh, bias;
+            long input_size, hidden_size;
+
+            /// U(-1 / sqrt(hidden), 1 / sqrt(hidden)) as torch.nn.LSTMCell
+            LSTMCell(long input_size, long hidden_size)
+                : weight_ih(atnn::random::uniform({4 * hidden_size, input_size}, -1 / std::sqrt(hidden_size), 1 / std::sqrt(hidden_size)))
+                , weight_hh(atnn::random::uniform({4 * hidden_size, hidden_size}, -1 / std::sqrt(hidden_size), 1 / std::sqrt(hidden_size)))
+                , bias(atnn::random::uniform({4 * hidden_size}, -1 / std::sqrt(hidden_size), 1 / std::sqrt(hidden_size)))
+                , input_size(input_size)
+                , hidden_size(hidden_size) {
+                this->parameters = {this->weight_ih, this->weight_hh, this->bias};
+            }
+
+            /// zero (h, c) of n sequences on the backend of the parameters
+            atnn::TArray<2> zero_state(long n) const {
+                auto&& type = this->weight_ih.data().type();
+                return {type.zeros({n, this->hidden_size}), type.zeros({n, this->hidden_size})};
+            }
         };
 
     }
@@ -0,0 +1,250 @@
+/*
+
+  This header defines packed batches of variable-length sequences
+
+  - PackedSequence: the steps of the sequences sorted by length, step after step, without padding
+  - pack/unpack: from/to the list of sequences (T_i, ...)
+  - LSTM: runs an LSTMCell over a PackedSequence with a batch shrinking at each step
+
+  the rows of a PackedSequence line up with those of any other packed from sequences of the same lengths
+  (e.g., the targets), so row-wise modules (Linear, LogSoftmax, NLLLoss, ...) consume the packed data directly.
+
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <tuple>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+
+namespace atnn {
+    namespace packed {
+
+/**
+   step t occupies the rows [offset(t), offset(t) + batch_sizes[t]) of data: the t-th elements of the
+   batch_sizes[t] longest sequences, longest first. batch_sizes is non-increasing.
+*/
+        struct PackedSequence {
+            Variable data; // (sum of the lengths, ...)
+            std::vector<long> batch_sizes;
+            std::vector<long> sorted_indices; // the original index of the k-th longest sequence
+
+            long size() const { return this->batch_sizes.empty() ? 0 : this->batch_sizes[0]; }
+
+            /// the first row of each step
+            std::vector<long> offsets() const {
+                std::vector<long> offsets(this->batch_sizes.size(), 0);
+                std::partial_sum(this->batch_sizes.begin(), this->batch_sizes.end() - 1, offsets.begin() + 1);
+                return offsets;
+            }
+
+            /// the length of the k-th longest sequence: the first step with at most k sequences
+            long length(long k) const {
+                return std::lower_bound(this->batch_sizes.begin(), this->batch_sizes.end(), k, std::greater<long>())
+                    - this->batch_sizes.begin();
+            }
+
+            /// CPU kLong, e.g., an input of LSTM
+            at::Tensor batch_sizes_tensor() const {
+                auto t = CPU(at::kLong).tensor({static_cast<long>(this->batch_sizes.size())});
+                std::copy(this->batch_sizes.begin(), this->batch_sizes.end(), t.data<int64_t>());
+                return t;
+            }
+
+            /// the same layout with other data (e.g., the outputs of a row-wise module)
+            PackedSequence with_data(Variable data) const {
+                ATNN_ASSERT_EQ(data.data().size(0), this->data.data().size(0));
+                return {data, this->batch_sizes, this->sorted_indices};
+            }
+        };
+
+        /// sequences (T_i, ...) of the same trailing shape. the ties keep their order
+        inline PackedSequence pack(const TList& sequences, bool requires_grad=false) {
+            ATNN_ASSERT(!sequences.empty());
+            const long n = sequences.size();
+            PackedSequence packed;
+            packed.sorted_indices.resize(n);
+            std::iota(packed.sorted_indices.begin(), packed.sorted_indices.end(), 0);
+            std::stable_sort(packed.sorted_indices.begin(), packed.sorted_indices.end(), [&](long a, long b) {
+                    return sequences[a].size(0) > sequences[b].size(0);
+                });
+            const long steps = sequences[packed.sorted_indices[0]].size(0);
+            long total = 0;
+            for (long t = 0; t < steps; ++t) {
+                long size = 0;
+                while (size < n && sequences[packed.sorted_indices[size]].size(0) > t) ++size;
+                packed.batch_sizes.push_back(size);
+                total += size;
+            }
+            const auto& first = sequences[0];
+            std::vector<int64_t> shape = {total};
+            shape.insert(shape.end(), first.sizes().begin() + 1, first.sizes().end());
+            auto data = first.type().tensor(shape);
+            long row = 0;
+            for (long t = 0; t < steps; ++t) {
+                for (long k = 0; k < packed.batch_sizes[t]; ++k) {
+                    data[row++].copy_(sequences[packed.sorted_indices[k]][t]);
+                }
+            }
+            packed.data = Variable(data, requires_grad);
+            return packed;
+        }
+
+        /// the sequences in the original order
+        inline TList unpack(const PackedSequence& packed) {
+            const auto data = packed.data.data();
+            const auto offsets = packed.offsets();
+            TList sequences(packed.size());
+            for (long k = 0; k < packed.size(); ++k) {
+                const long length = packed.length(k);
+                std::vector<int64_t> shape = {length};
+                shape.insert(shape.end(), data.sizes().begin() + 1, data.sizes().end());
+                auto s = data.type().tensor(shape);
+                for (long t = 0; t < length; ++t) s[t].copy_(data[offsets[t] + k]);
+                sequences[packed.sorted_indices[k]] = s;
+            }
+            return sequences;
+        }
+
+/**
+   LSTM over packed sequences: step t runs batch_sizes[t] rows only, so no FLOP is spent on padding.
+   the input projections of all the steps run as one GEMM before the recurrence.
+
+   forward(data, batch_sizes, h0, c0) -> (outputs, h, c) where data and outputs are packed (rows, features),
+   batch_sizes is a CPU kLong Variable without grad (PackedSequence::batch_sizes_tensor) and h0, c0, h, c are
+   (sequences, hidden) in the sorted order. h and c hold the state after the last step of each sequence.
+   backward runs the recurrence in reverse over the same shrinking batches.
+*/
+        struct LSTM : atnn::Module<LSTM> {
+            using Function = struct {
+                static std::vector<long> batch_sizes_of(const at::Tensor& t) {
+                    const auto p = t.contiguous().data<int64_t>();
+                    return std::vector<long>(p, p + t.numel());
+                }
+
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<4> xs) {
+                    auto&& x = xs[0];
+                    const auto sizes = batch_sizes_of(xs[1]);
+                    auto&& h0 = xs[2];
+                    auto&& c0 = xs[3];
+                    auto&& cell = *ctx->cell;
+                    const long hidden = cell.hidden_size;
+                    const long n = x.size(0);
+                    ATNN_ASSERT_EQ(h0.size(0), sizes[0]);
+                    // activations of the gates (input, forget, cell, output) of every row, saved for backward
+                    auto gates = cell.bias.data().view({1, 4 * hidden}).expand({n, 4 * hidden}).contiguous();
+                    gates.addmm_(x, cell.weight_ih.data().t());
+                    auto outputs = x.type().tensor({n, hidden});
+                    auto cells = x.type().tensor({n, hidden});
+                    auto h = h0.clone();
+                    auto c = c0.clone();
+                    long offset = 0;
+                    for (auto size: sizes) {
+                        auto a = gates.narrow(0, offset, size);
+                        a.addmm_(h.narrow(0, 0, size), cell.weight_hh.data().t());
+                        auto i = a.narrow(1, 0, hidden);
+                        auto f = a.narrow(1, hidden, hidden);
+                        auto g = a.narrow(1, 2 * hidden, hidden);
+                        auto o = a.narrow(1, 3 * hidden, hidden);
+                        i.copy_(i.sigmoid());
+                        f.copy_(f.sigmoid());
+                        g.copy_(g.tanh());
+                        o.copy_(o.sigmoid());
+                        auto c_next = cells.narrow(0, offset, size);
+                        c_next.copy_(f * c.narrow(0, 0, size) + i * g);
+                        auto h_next = outputs.narrow(0, offset, size);
+                        h_next.copy_(o * c_next.tanh());
+                        h.narrow(0, 0, size).copy_(h_next);
+                        c.narrow(0, 0, size).copy_(c_next);
+                        offset += size;
+                    }
+                    ATNN_ASSERT_EQ(offset, n);
+                    ctx->save_for_backward({x, xs[1], h0, c0, gates, cells, outputs});
+                    return atnn::TArray<3> {outputs, h, c};
+                }
+
+                template <typename Context>
+                static atnn::TArray<4> backward(Context ctx, atnn::TArray<3> gy) {
+                    auto&& s = ctx->saved_tensors;
+                    auto&& x = s[0];
+                    const auto sizes = batch_sizes_of(s[1]);
+                    auto&& h0 = s[2];
+                    auto&& c0 = s[3];
+                    auto&& gates = s[4];
+                    auto&& cells = s[5];
+                    auto&& outputs = s[6];
+                    auto&& cell = *ctx->cell;
+                    const long hidden = cell.hidden_size;
+                    const long steps = sizes.size();
+                    std::vector<long> offsets(steps, 0);
+                    std::partial_sum(sizes.begin(), sizes.end() - 1, offsets.begin() + 1);
+
+                    // undefined when the output is unused
+                    auto dh = gy[1].defined() ? gy[1].clone() : h0.type().zeros_like(h0);
+                    auto dc = gy[2].defined() ? gy[2].clone() : c0.type().zeros_like(c0);
+                    auto dgates = x.type().tensor({x.size(0), 4 * hidden});
+                    at::Tensor grad_hh;
+                    if (cell.weight_hh.requires_grad()) grad_hh = x.type().zeros({4 * hidden, hidden});
+                    for (long t = steps - 1; t >= 0; --t) {
+                        const long size = sizes[t], offset = offsets[t];
+                        auto dh_t = dh.narrow(0, 0, size);
+                        if (gy[0].defined()) dh_t += gy[0].narrow(0, offset, size);
+                        auto a = gates.narrow(0, offset, size);
+                        auto i = a.narrow(1, 0, hidden);
+                        auto f = a.narrow(1, hidden, hidden);
+                        auto g = a.narrow(1, 2 * hidden, hidden);
+                        auto o = a.narrow(1, 3 * hidden, hidden);
+                        auto tanh_c = cells.narrow(0, offset, size).tanh();
+                        auto c_prev = t > 0 ? cells.narrow(0, offsets[t - 1], size) : c0.narrow(0, 0, size);
+                        auto h_prev = t > 0 ? outputs.narrow(0, offsets[t - 1], size) : h0.narrow(0, 0, size);
+                        auto dc_t = dc.narrow(0, 0, size);
+                        dc_t += dh_t * o * (1 - tanh_c * tanh_c);
+                        auto dg = dgates.narrow(0, offset, size);
+                        dg.narrow(1, 0, hidden).copy_(dc_t * g * i * (1 - i));
+                        dg.narrow(1, hidden, hidden).copy_(dc_t * c_prev * f * (1 - f));
+                        dg.narrow(1, 2 * hidden, hidden).copy_(dc_t * i * (1 - g * g));
+                        dg.narrow(1, 3 * hidden, hidden).copy_(dh_t * tanh_c * o * (1 - o));
+                        if (grad_hh.defined()) grad_hh.addmm_(dg.t(), h_prev);
+                        dh_t.copy_(dg.mm(cell.weight_hh.data()));
+                        dc_t *= f;
+                    }
+
+                    at::Tensor dx;
+                    if (ctx->needs_input_grad(0)) dx = dgates.mm(cell.weight_ih.data());
+                    if (cell.weight_ih.requires_grad()) atnn::accumulate_grad(cell.weight_ih, dgates.t().mm(x));
+                    if (grad_hh.defined()) atnn::accumulate_grad(cell.weight_hh, grad_hh);
+                    if (cell.bias.requires_grad()) atnn::accumulate_grad(cell.bias, dgates.sum(0));
+                    return {dx, at::Tensor(), ctx->needs_input_grad(2) ? dh : at::Tensor(), ctx->needs_input_grad(3) ? dc : at::Tensor()};
+                }
+            };
+
+            std::shared_ptr<modules::LSTMCell> cell; // shares its parameters
+
+            explicit LSTM(std::shared_ptr<modules::LSTMCell> cell) : cell(cell) {
+                this->parameters = cell->parameters;
+            }
+
+            LSTM(long input_size, long hidden_size) : LSTM(std::make_shared<modules::LSTMCell>(input_size, hidden_size)) {}
+
+            /// the outputs packed like x, and the last (h, c) of each sequence in the sorted order. zero initial state by default
+            std::tuple<PackedSequence, Variable, Variable> forward_packed(const PackedSequence& x, Variable h0={}, Variable c0={}) {
+                if (!h0.ptr || !c0.ptr) {
+                    auto zero = this->cell->zero_state(x.size());
+                    h0 = Variable(zero[0], false);
+                    c0 = Variable(zero[1], false);
+                }
+                auto y = this->forward(x.data, Variable(x.batch_sizes_tensor(), false), h0, c0);
+                return std::make_tuple(x.with_data(y[0]), y[1], y[2]);
+            }
+        };
+
+    } // namespace packed
+} // namespace atnn
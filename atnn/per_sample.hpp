@@ -0,0 +1,155 @@
+/*
+
+  This header defines per-example gradients of Linear and Conv2d (e.g., for differentially private SGD)
+
+  - Gradients: collects the inputs and output grads of one backward and computes from them, in batched GEMMs,
+    the norm of each example's grad, and the sum of the examples' grads clipped to max_norm
+
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+
+namespace atnn {
+    namespace per_sample {
+
+        /// the backward of one Linear/Conv2d call
+        struct Record {
+            Variable weight, bias;
+            at::Tensor x, gy; // (n, in features, positions), (n, out features, positions)
+            bool weight_grad, bias_grad;
+        };
+
+        /// ||gy[i] x[i]^T||^2 for each example without materializing the grads when it is cheaper
+        inline at::Tensor weight_squared_norms(const at::Tensor& x, const at::Tensor& gy) {
+            const long n = x.size(0), in = x.size(1), positions = x.size(2), out = gy.size(1);
+            if (positions == 1) { // an outer product: ||g x^T|| = ||g|| ||x||
+                return (x * x).view({n, in}).sum(1) * (gy * gy).view({n, out}).sum(1);
+            }
+            if (2 * positions * positions <= in * out) { // <x^T x, gy^T gy> over positions x positions
+                auto gram_x = at::bmm(x.transpose(1, 2), x);
+                auto gram_gy = at::bmm(gy.transpose(1, 2), gy);
+                return (gram_x * gram_gy).view({n, -1}).sum(1);
+            }
+            auto g = at::bmm(gy, x.transpose(1, 2));
+            return (g * g).view({n, -1}).sum(1);
+        }
+
+/**
+   per-example grads of the Linear and Conv2d parameters in one backward pass.
+   the batch grads of those modules are not accumulated while it is active: accumulate() adds
+   the sum of the examples' grads, each scaled by min(1, max_norm / its norm over all the recorded parameters).
+   the other modules accumulate their batch grads as usual.
+
+   auto grads = std::make_shared<per_sample::Gradients>(1.0);
+   {
+       PerSampleGuard guard(grads);
+       loss.backward(gy); // a sum (not mean) over the examples
+   }
+   grads->accumulate(); // clipped sum into the parameter grads
+*/
+        struct Gradients : PerSampleGrad {
+            double max_norm; // <= 0: no clipping
+            double eps = 1e-6;
+            std::vector<Record> records;
+            std::mutex mutex;
+
+            explicit Gradients(double max_norm=0) : max_norm(max_norm) {}
+
+            void add(const Variable& weight, const Variable& bias, const at::Tensor& x, const at::Tensor& gy) override {
+                Record r {weight, bias, x, gy, weight.requires_grad(), bias.ptr && bias.data().defined() && bias.requires_grad()};
+                ATNN_ASSERT_EQ(x.size(0), gy.size(0));
+                ATNN_ASSERT_EQ(x.size(2), gy.size(2));
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->records.push_back(r);
+            }
+
+            /// (n) the squared norm of each example's grad over all the recorded parameters.
+            /// a parameter recorded more than once (a module called twice) adds the norm of its summed grads
+            at::Tensor squared_norms() const {
+                at::Tensor sq;
+                auto add = [&](const at::Tensor& s) { sq = sq.defined() ? sq + s : s; };
+                auto squared = [](const at::Tensor& g) { return (g * g).contiguous().view({g.size(0), -1}).sum(1); };
+                Variable::Set seen;
+                for (auto&& r: this->records) {
+                    if (r.weight_grad && seen.insert(r.weight).second) {
+                        if (this->recorded(r.weight) == 1) add(weight_squared_norms(r.x, r.gy));
+                        else add(squared(this->grads(r.weight)));
+                    }
+                    if (r.bias_grad && seen.insert(r.bias).second) add(squared(this->grads(r.bias)));
+                }
+                ATNN_ASSERT_MSG(sq.defined(), "no per-sample grads were recorded");
+                return sq;
+            }
+
+            /// (n) the norm of each example's grad
+            at::Tensor norms() const {
+                return this->squared_norms().sqrt();
+            }
+
+            /// (n) the clipping factor of each example
+            at::Tensor scales() const {
+                auto norms = this->norms();
+                if (this->max_norm <= 0) return norms.type().ones_like(norms);
+                return (this->max_norm / (norms + this->eps)).clamp(0, 1);
+            }
+
+            /// unclipped (n, parameter sizes) grads of a recorded weight or bias (materialized)
+            at::Tensor grads(const Variable& p) const {
+                at::Tensor sum;
+                for (auto&& r: this->records) {
+                    const long n = r.x.size(0);
+                    at::Tensor g;
+                    if (r.weight == p && r.weight_grad) g = at::bmm(r.gy, r.x.transpose(1, 2));
+                    else if (r.bias == p && r.bias_grad) g = r.gy.sum(2);
+                    else continue;
+                    std::vector<int64_t> sizes = {n};
+                    const auto ps = p.data().sizes();
+                    sizes.insert(sizes.end(), ps.begin(), ps.end());
+                    g = g.contiguous().view(sizes);
+                    sum = sum.defined() ? sum + g : g; // a module called more than once
+                }
+                ATNN_ASSERT_MSG(sum.defined(), "not a recorded parameter");
+                return sum;
+            }
+
+            /// adds sum_i scale[i] * grad[i] into the parameter grads with one GEMM per record, and clears the records
+            void accumulate() {
+                const auto c = this->scales();
+                for (auto&& r: this->records) {
+                    const long n = r.x.size(0), in = r.x.size(1), positions = r.x.size(2), out = r.gy.size(1);
+                    auto gy = r.gy * c.view({n, 1, 1}).expand(r.gy.sizes());
+                    if (r.weight_grad) {
+                        auto gy2 = gy.transpose(0, 1).contiguous().view({out, n * positions});
+                        auto x2 = r.x.transpose(0, 1).contiguous().view({in, n * positions});
+                        atnn::accumulate_grad(r.weight, gy2.mm(x2.t()).view(r.weight.data().sizes()));
+                    }
+                    if (r.bias_grad) atnn::accumulate_grad(r.bias, gy.sum(2).sum(0));
+                }
+                this->clear();
+            }
+
+            void clear() {
+                this->records.clear();
+            }
+
+        private:
+            /// the number of records of the weight or bias p
+            size_t recorded(const Variable& p) const {
+                size_t count = 0;
+                for (auto&& r: this->records) {
+                    if ((r.weight_grad && r.weight == p) || (r.bias_grad && r.bias == p)) ++count;
+                }
+                return count;
+            }
+        };
+
+    } // namespace per_sample
+} // namespace atnn
@@ -0,0 +1,254 @@
+/*
+
+  This header defines pipeline-parallel execution of a chain of modules
+
+  - Pipeline: stages (consecutive modules) run by threads pinned to disjoint core groups
+  - micro-batches stream through bounded queues between the stages, scheduled by GPipe or 1F1B
+
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "data/queue.hpp"
+#include "threading.hpp"
+
+namespace atnn {
+    namespace pipeline {
+
+        enum class Schedule {
+            GPipe, // all forwards then all backwards: simple, keeps every micro-batch's activations
+            OneFOneB // one forward one backward after a warm up: at most (stages - stage) micro-batches in flight
+        };
+
+        struct PipelineOptions {
+            long micro_batches = 4;
+            Schedule schedule = Schedule::OneFOneB;
+            std::vector<std::vector<int>> cores; // per stage. empty: not pinned
+            int threads_per_stage = 0; // intra-op threads. 0: the size of the core group, or threading::set_num_threads
+        };
+
+        namespace detail {
+            inline void flatten(const ModulePtr& m, std::vector<ModulePtr>& chain) {
+                if (auto set = std::dynamic_pointer_cast<ModuleSet>(m)) {
+                    for (auto&& c: set->modules) flatten(c, chain);
+                } else {
+                    chain.push_back(m);
+                }
+            }
+
+            struct Stopped {}; // another stage failed
+        } // namespace detail
+
+/**
+   Pipeline splits a chain of modules with one input and one output (ModuleBase::forward_unary)
+   into stages, each run by its own thread on its own cores.
+
+   Pipeline pipe(net, {3, 3}, options); // two stages of three modules
+   auto y = pipe.train_step(x, [&](at::Tensor y, long i) { return grad of the loss w.r.t. y; });
+
+   train_step splits x into micro-batches along dim 0. stage s forwards micro-batch i while stage s + 1
+   forwards i - 1 or runs a backward, and the parameter grads are summed over the micro-batches
+   (scale them with GradAccumulation in output_grad for an average).
+   the stages own disjoint modules, so no lock is taken around the parameters.
+*/
+        struct Pipeline {
+            /// output_grad(y, i) is the grad of the i-th micro-batch output, called from the last stage
+            using OutputGrad = std::function<at::Tensor(at::Tensor y, long micro_batch)>;
+
+            Pipeline(const std::vector<ModulePtr>& modules, const std::vector<size_t>& stage_sizes, PipelineOptions options={})
+                : options(options) {
+                std::vector<ModulePtr> chain;
+                for (auto&& m: modules) detail::flatten(m, chain);
+                size_t begin = 0;
+                for (auto n: stage_sizes) {
+                    ATNN_ASSERT_MSG(n > 0 && begin + n <= chain.size(), "stage sizes exceed the modules");
+                    this->stages.emplace_back(chain.begin() + begin, chain.begin() + begin + n);
+                    begin += n;
+                }
+                ATNN_ASSERT_MSG(begin == chain.size(), "stage sizes do not cover the modules");
+                ATNN_ASSERT(options.micro_batches > 0);
+                ATNN_ASSERT(options.cores.empty() || options.cores.size() == this->stages.size());
+                for (size_t s = 0; s < this->stages.size(); ++s) {
+                    this->workers.emplace_back([this, s] { this->loop(s); });
+                }
+            }
+
+            Pipeline(std::shared_ptr<ModuleSet> set, const std::vector<size_t>& stage_sizes, PipelineOptions options={})
+                : Pipeline(std::vector<ModulePtr>{set}, stage_sizes, options) {}
+
+            ~Pipeline() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopped = true;
+                }
+                this->start.notify_all();
+                for (auto& w: this->workers) {
+                    w.join();
+                }
+            }
+
+            Pipeline(const Pipeline&) = delete;
+            Pipeline& operator=(const Pipeline&) = delete;
+
+            /// forward and backward of all the micro-batches of x (at least one sample). returns the outputs
+            at::Tensor train_step(at::Tensor x, OutputGrad output_grad) {
+                return this->run(x, output_grad);
+            }
+
+            /// pipelined forward without recording the tape
+            at::Tensor predict(at::Tensor x) {
+                return this->run(x, nullptr);
+            }
+
+            size_t size() const { return this->stages.size(); }
+
+            const PipelineOptions options;
+
+        private:
+            at::Tensor run(at::Tensor x, OutputGrad output_grad) {
+                const long n = x.size(0);
+                if (n == 0) throw_with_trace(std::runtime_error("empty batch: no micro-batch to run"));
+                const long m = std::min(this->options.micro_batches, n);
+                const long chunk = (n + m - 1) / m;
+                this->inputs.clear();
+                for (long i = 0; i < n; i += chunk) {
+                    this->inputs.push_back(x.narrow(0, i, std::min(chunk, n - i)));
+                }
+                const auto k = this->inputs.size();
+                this->outputs.assign(k, at::Tensor());
+                this->output_grad = output_grad;
+                // a micro-batch in flight per queue at most: k bounds both schedules
+                this->forward_queues.clear();
+                this->backward_queues.clear();
+                for (size_t s = 0; s < this->stages.size(); ++s) {
+                    this->forward_queues.emplace_back(new data::BoundedQueue<at::Tensor>(k));
+                    this->backward_queues.emplace_back(new data::BoundedQueue<at::Tensor>(k));
+                }
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->error = nullptr;
+                    this->finished = 0;
+                    ++this->step;
+                    this->start.notify_all();
+                    this->done.wait(lock, [this] { return this->finished == this->stages.size(); });
+                }
+                if (this->error) std::rethrow_exception(this->error);
+                return at::cat(this->outputs, 0);
+            }
+
+            void loop(size_t s) {
+                std::exception_ptr pin_error; // e.g., a core outside the cpuset: fails every step instead of the thread
+                try {
+                    threading::pin_current_thread(this->options.cores.empty() ? std::vector<int>() : this->options.cores[s]);
+                } catch (...) {
+                    pin_error = std::current_exception();
+                }
+                const int threads = this->options.threads_per_stage > 0 ? this->options.threads_per_stage
+                    : this->options.cores.empty() ? 0 : static_cast<int>(this->options.cores[s].size());
+                long seen = 0;
+                while (true) {
+                    {
+                        std::unique_lock<std::mutex> lock(this->mutex);
+                        this->start.wait(lock, [&] { return this->stopped || this->step > seen; });
+                        if (this->stopped) return;
+                        seen = this->step;
+                    }
+                    try {
+                        if (pin_error) std::rethrow_exception(pin_error);
+                        IntraOpGuard intra_op(threads); // the modules of the stage inherit it
+                        this->run_stage(s);
+                    } catch (detail::Stopped&) {
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        if (!this->error) this->error = std::current_exception();
+                        for (auto&& q: this->forward_queues) q->close();
+                        for (auto&& q: this->backward_queues) q->close();
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        ++this->finished;
+                    }
+                    this->done.notify_one();
+                }
+            }
+
+            void run_stage(size_t s) {
+                const bool train = static_cast<bool>(this->output_grad);
+                const bool last = s + 1 == this->stages.size();
+                const long k = this->inputs.size();
+                std::deque<std::pair<Variable, Variable>> inflight; // input and output of each micro-batch
+                std::vector<at::Tensor> last_grads(last ? k : 0);
+
+                auto forward = [&](long i) {
+                    at::Tensor x;
+                    if (s == 0) x = this->inputs[i];
+                    else if (!this->forward_queues[s]->pop(x)) throw detail::Stopped();
+                    Variable input(x, s > 0); // the first stage computes no input grad
+                    auto y = input;
+                    for (auto&& module: this->stages[s]) y = module->forward_unary(y);
+                    if (last) {
+                        this->outputs[i] = y.data();
+                        if (train) last_grads[i] = this->output_grad(y.data(), i);
+                    } else if (!this->forward_queues[s + 1]->push(y.data())) {
+                        throw detail::Stopped();
+                    }
+                    if (train) inflight.emplace_back(input, y);
+                };
+
+                auto backward = [&](long i) {
+                    auto io = inflight.front();
+                    inflight.pop_front();
+                    at::Tensor gy;
+                    if (last) gy = last_grads[i];
+                    else if (!this->backward_queues[s]->pop(gy)) throw detail::Stopped();
+                    io.second.backward(gy);
+                    if (s > 0 && !this->backward_queues[s - 1]->push(io.first.grad())) throw detail::Stopped();
+                };
+
+                if (!train) {
+                    NoGradGuard guard;
+                    for (long i = 0; i < k; ++i) forward(i);
+                    return;
+                }
+                const long warmup = this->options.schedule == Schedule::GPipe ? k
+                    : std::min<long>(this->stages.size() - s - 1, k);
+                for (long i = 0; i < warmup; ++i) forward(i);
+                for (long i = 0; i + warmup < k; ++i) {
+                    forward(i + warmup);
+                    backward(i);
+                }
+                for (long i = std::max<long>(k - warmup, 0); i < k; ++i) backward(i);
+            }
+
+            std::vector<std::vector<ModulePtr>> stages;
+            std::vector<std::thread> workers;
+
+            // the current step, written by run before the workers start
+            TList inputs, outputs;
+            OutputGrad output_grad;
+            std::vector<std::unique_ptr<data::BoundedQueue<at::Tensor>>> forward_queues, backward_queues;
+
+            std::mutex mutex;
+            std::condition_variable start, done;
+            long step = 0;
+            size_t finished = 0;
+            bool stopped = false;
+            std::exception_ptr error;
+        };
+
+    } // namespace pipeline
+} // namespace atnn
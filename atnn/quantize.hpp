@@ -0,0 +1,14 @@
+/*
+
+  This header defines post-training int8 quantization for CPU inference
+
+  - Calibrator: collects activation ranges through forward hooks of the float modules
+  - QuantizedLinear, QuantizedConv2d: per-channel int8 weights, uint8 activations
+  - kernels: u8 x s8 GEMM (AVX512-VNNI / AVX2 / scalar) with a fused requantize epilogue
+
+ */
+
+#pragma once
+
+#include "quantize/kernels.hpp"
+#include "quantize/modules.hpp"
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__AVX512VNNI__)
+#include <immintrin.h>
+#endif
+
+namespace atnn {
+    namespace quantize {
+        namespace kernels {
+
+            /// sum_k a[k] * b[k] of uint8 activations and int8 weights, exact in int32
+            inline int32_t dot_u8s8(const uint8_t* a, const int8_t* b, long k) {
+                long i = 0;
+                int32_t acc = 0;
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+                __m512i vacc = _mm512_setzero_si512();
+                for (; i + 64 <= k; i += 64) {
+                    auto va = _mm512_loadu_si512(a + i);
+                    auto vb = _mm512_loadu_si512(b + i);
+                    vacc = _mm512_dpbusd_epi32(vacc, va, vb);
+                }
+                acc += _mm512_reduce_add_epi32(vacc);
+#elif defined(__AVX2__)
+                // widen to int16 so that _mm256_madd_epi16 never saturates (unlike _mm256_maddubs_epi16)
+                __m256i vacc = _mm256_setzero_si256();
+                for (; i + 16 <= k; i += 16) {
+                    auto va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+                    auto vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+                    vacc = _mm256_add_epi32(vacc, _mm256_madd_epi16(va, vb));
+                }
+                auto s = _mm_add_epi32(_mm256_castsi256_si128(vacc), _mm256_extracti128_si256(vacc, 1));
+                s = _mm_hadd_epi32(s, s);
+                s = _mm_hadd_epi32(s, s);
+                acc += _mm_cvtsi128_si32(s);
+#endif
+                for (; i < k; ++i) {
+                    acc += int32_t(a[i]) * int32_t(b[i]);
+                }
+                return acc;
+            }
+
+/**
+   output stage fused into the GEMM.
+   y = scale_a * scale_b[n] * (acc - zero_point_a * sum_k b[n][k]) + bias[n], then optional ReLU,
+   stored as float or requantized to uint8 with (out_scale, out_zero_point).
+   outputs are addressed with strides, so the NCHW layout of conv outputs is written directly.
+*/
+            struct Epilogue {
+                float scale_a;
+                int32_t zero_point_a;
+                const float* scale_b;
+                const int32_t* sum_b;
+                const float* bias = nullptr;
+                bool relu = false;
+                float* out = nullptr;          // float output, or
+                uint8_t* out_q = nullptr;      // requantized output
+                float out_scale = 1;
+                int32_t out_zero_point = 0;
+                long stride_m, stride_n;
+
+                void operator()(long m, long n, int32_t acc) const {
+                    float y = this->scale_a * this->scale_b[n] * float(acc - this->zero_point_a * this->sum_b[n]);
+                    if (this->bias) y += this->bias[n];
+                    if (this->relu) y = std::max(y, 0.0f);
+                    const auto i = m * this->stride_m + n * this->stride_n;
+                    if (this->out_q) {
+                        auto q = std::nearbyint(y / this->out_scale) + this->out_zero_point;
+                        this->out_q[i] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, q)));
+                    } else {
+                        this->out[i] = y;
+                    }
+                }
+            };
+
+            /// a (m x k, row major uint8) times b^T (n x k, row major int8). both operands are contiguous along k
+            inline void gemm_u8s8(long m, long n, long k, const uint8_t* a, const int8_t* b, const Epilogue& epilogue) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long i = 0; i < m; ++i) {
+                    const auto ai = a + i * k;
+                    for (long j = 0; j < n; ++j) {
+                        epilogue(i, j, dot_u8s8(ai, b + j * k, k));
+                    }
+                }
+            }
+
+/**
+   unfolds one CHW image into (oh * ow) x (c * kh * kw) rows so that gemm_u8s8 reads both operands along k.
+   padded pixels take `pad_value` (the zero point, i.e., real 0).
+*/
+            template <typename T>
+            void im2row(const T* x, long c, long h, long w, long kh, long kw,
+                        long sh, long sw, long ph, long pw, T pad_value, T* rows) {
+                const long oh = (h + 2 * ph - kh) / sh + 1;
+                const long ow = (w + 2 * pw - kw) / sw + 1;
+                for (long oy = 0; oy < oh; ++oy) {
+                    for (long ox = 0; ox < ow; ++ox) {
+                        auto row = rows + (oy * ow + ox) * c * kh * kw;
+                        for (long ci = 0; ci < c; ++ci) {
+                            for (long ky = 0; ky < kh; ++ky) {
+                                const long iy = oy * sh + ky - ph;
+                                for (long kx = 0; kx < kw; ++kx) {
+                                    const long ix = ox * sw + kx - pw;
+                                    *row++ = (0 <= iy && iy < h && 0 <= ix && ix < w) ? x[(ci * h + iy) * w + ix] : pad_value;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+        } // namespace kernels
+    } // namespace quantize
+} // namespace atnn
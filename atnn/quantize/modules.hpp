@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "../autograd.hpp"
+#include "../modules.hpp"
+#include "kernels.hpp"
+
+namespace atnn {
+    namespace quantize {
+
+        /// real = scale * (q - zero_point) for uint8 q
+        struct QParams {
+            float scale = 1;
+            int32_t zero_point = 0;
+        };
+
+        /// running range of observed tensors
+        struct RangeObserver {
+            float min = std::numeric_limits<float>::infinity();
+            float max = -std::numeric_limits<float>::infinity();
+
+            void observe(const at::Tensor& t) {
+                this->min = std::min(this->min, at::Scalar(t.min()).toFloat());
+                this->max = std::max(this->max, at::Scalar(t.max()).toFloat());
+            }
+
+            bool empty() const { return this->min > this->max; }
+
+            /// asymmetric uint8 parameters covering [min, max] and the exact zero
+            QParams qparams() const {
+                ATNN_ASSERT_MSG(!this->empty(), "nothing observed");
+                const auto lo = std::min(this->min, 0.0f);
+                const auto hi = std::max(this->max, 0.0f);
+                QParams q;
+                q.scale = hi > lo ? (hi - lo) / 255.0f : 1.0f;
+                q.zero_point = static_cast<int32_t>(std::min(255.0f, std::max(0.0f, std::nearbyint(-lo / q.scale))));
+                return q;
+            }
+        };
+
+        /// input/output ranges of a module collected by Calibrator
+        struct Observation {
+            RangeObserver input, output;
+            std::mutex mutex;
+        };
+
+/**
+   Calibrator collects activation ranges while the existing float modules run (forward or predict).
+
+   auto calibrator = Calibrator();
+   auto observed = calibrator.attach(linear);
+   for (auto&& x: calibration_data) { net(x); }
+   auto q = QuantizedLinear(*linear, observed->input.qparams(), observed->output.qparams());
+
+   the hooks are removed when the calibrator is destroyed.
+*/
+        struct Calibrator {
+            std::shared_ptr<Observation> attach(ModulePtr module) {
+                auto observation = std::make_shared<Observation>();
+                auto hook = std::make_shared<ForwardHook>([observation](const TList& xs, const TList& ys) {
+                    std::lock_guard<std::mutex> lock(observation->mutex);
+                    observation->input.observe(xs[0]);
+                    observation->output.observe(ys[0]);
+                });
+                module->forward_hooks.push_back(hook);
+                this->attached.emplace_back(module, hook);
+                return observation;
+            }
+
+            ~Calibrator() {
+                for (auto&& a: this->attached) {
+                    auto& hooks = a.first->forward_hooks;
+                    hooks.erase(std::remove(hooks.begin(), hooks.end(), a.second), hooks.end());
+                }
+            }
+
+        private:
+            std::vector<std::pair<ModulePtr, std::shared_ptr<ForwardHook>>> attached;
+        };
+
+        /// uint8 activations
+        struct QTensor {
+            at::Tensor data; // kByte
+            QParams qparams;
+        };
+
+        inline QTensor quantize_tensor(at::Tensor x, QParams q) {
+            auto xc = x.toBackend(at::kCPU).contiguous();
+            ATNN_ASSERT(xc.type().scalarType() == at::kFloat);
+            auto out = CPU(at::kByte).tensor(xc.sizes());
+            auto src = xc.data<float>();
+            auto dst = out.data<uint8_t>();
+            const auto inv_scale = 1.0f / q.scale;
+            const auto n = xc.numel();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+            for (long i = 0; i < n; ++i) {
+                auto v = std::nearbyint(src[i] * inv_scale) + q.zero_point;
+                dst[i] = static_cast<uint8_t>(std::min(255.0f, std::max(0.0f, v)));
+            }
+            return {out, q};
+        }
+
+        inline at::Tensor dequantize(const QTensor& x) {
+            return (x.data.toType(at::kFloat) - x.qparams.zero_point) * x.qparams.scale;
+        }
+
+        /// per output channel symmetric int8 weight, flattened to (out, in * ...)
+        struct QWeight {
+            at::Tensor data; // kChar
+            std::vector<float> scale;
+            std::vector<int32_t> sum; // sum over k of data[n][k] for the zero point correction
+
+            explicit QWeight(at::Tensor weight) {
+                const auto n = weight.size(0);
+                auto w = weight.toBackend(at::kCPU).contiguous().view({n, -1});
+                const auto k = w.size(1);
+                this->data = CPU(at::kChar).tensor({n, k});
+                this->scale.resize(n);
+                this->sum.resize(n);
+                auto src = w.data<float>();
+                auto dst = this->data.data<int8_t>();
+                for (long i = 0; i < n; ++i) {
+                    float absmax = 0;
+                    for (long j = 0; j < k; ++j) absmax = std::max(absmax, std::abs(src[i * k + j]));
+                    this->scale[i] = absmax > 0 ? absmax / 127.0f : 1.0f;
+                    int32_t s = 0;
+                    for (long j = 0; j < k; ++j) {
+                        auto q = static_cast<int8_t>(std::nearbyint(src[i * k + j] / this->scale[i]));
+                        dst[i * k + j] = q;
+                        s += q;
+                    }
+                    this->sum[i] = s;
+                }
+            }
+
+            size_t nbytes() const {
+                return this->data.numel() + this->scale.size() * sizeof(float) + this->sum.size() * sizeof(int32_t);
+            }
+        };
+
+        inline std::vector<float> to_vector(at::Tensor t) {
+            if (!t.defined()) return {};
+            auto c = t.toBackend(at::kCPU).contiguous();
+            return std::vector<float>(c.data<float>(), c.data<float>() + c.numel());
+        }
+
+        /// common part of the int8 modules
+        struct QuantizedBase {
+            QWeight weight;
+            std::vector<float> bias;
+            QParams input, output;
+            bool requantize = false; // true when the output qparams are known
+            bool relu = false;       // fused into the epilogue
+
+            QuantizedBase(at::Tensor weight, at::Tensor bias, QParams input)
+                : weight(weight), bias(to_vector(bias)), input(input) {}
+
+            QuantizedBase(at::Tensor weight, at::Tensor bias, QParams input, QParams output)
+                : weight(weight), bias(to_vector(bias)), input(input), output(output), requantize(true) {}
+
+            kernels::Epilogue epilogue(const QParams& x, long stride_m, long stride_n) const {
+                kernels::Epilogue e;
+                e.scale_a = x.scale;
+                e.zero_point_a = x.zero_point;
+                e.scale_b = this->weight.scale.data();
+                e.sum_b = this->weight.sum.data();
+                e.bias = this->bias.empty() ? nullptr : this->bias.data();
+                e.relu = this->relu;
+                e.stride_m = stride_m;
+                e.stride_n = stride_n;
+                return e;
+            }
+
+            size_t nbytes() const {
+                return this->weight.nbytes() + this->bias.size() * sizeof(float);
+            }
+        };
+
+/**
+   int8 inference version of modules::Linear.
+   predict(at::Tensor) quantizes the input with the calibrated qparams and returns float,
+   predict(QTensor) returns uint8 requantized in the GEMM epilogue to chain quantized modules.
+*/
+        struct QuantizedLinear : QuantizedBase {
+            QuantizedLinear(const modules::Linear& linear, QParams input)
+                : QuantizedBase(linear.weight.data(), linear.bias.data(), input) {}
+
+            QuantizedLinear(const modules::Linear& linear, QParams input, QParams output)
+                : QuantizedBase(linear.weight.data(), linear.bias.data(), input, output) {}
+
+            /// from raw (out, in) weight and (out) bias, e.g., folded by freeze::freeze
+            QuantizedLinear(at::Tensor weight, at::Tensor bias, QParams input)
+                : QuantizedBase(weight, bias, input) {}
+
+            at::Tensor predict(at::Tensor x) const {
+                auto q = quantize_tensor(x, this->input);
+                auto y = CPU(at::kFloat).tensor({x.size(0), this->weight.data.size(0)});
+                auto e = this->epilogue(q.qparams, y.size(1), 1);
+                e.out = y.data<float>();
+                this->run(q, e);
+                return y;
+            }
+
+            QTensor predict(const QTensor& x) const {
+                ATNN_ASSERT_MSG(this->requantize, "output qparams are not calibrated");
+                QTensor y = {CPU(at::kByte).tensor({x.data.size(0), this->weight.data.size(0)}), this->output};
+                auto e = this->epilogue(x.qparams, y.data.size(1), 1);
+                e.out_q = y.data.data<uint8_t>();
+                e.out_scale = this->output.scale;
+                e.out_zero_point = this->output.zero_point;
+                this->run(x, e);
+                return y;
+            }
+
+        private:
+            void run(const QTensor& x, const kernels::Epilogue& e) const {
+                ATNN_ASSERT_EQ(x.data.dim(), 2);
+                ATNN_ASSERT_EQ(x.data.size(1), this->weight.data.size(1));
+                auto xc = x.data.contiguous();
+                kernels::gemm_u8s8(xc.size(0), this->weight.data.size(0), xc.size(1),
+                                   xc.data<uint8_t>(), this->weight.data.data<int8_t>(), e);
+            }
+        };
+
+        /// int8 inference version of modules::Conv2d (im2row + gemm_u8s8 per image)
+        struct QuantizedConv2d : QuantizedBase {
+            std::vector<int64_t> kernel_size, stride, padding;
+
+            QuantizedConv2d(const modules::Conv2d& conv, QParams input)
+                : QuantizedBase(conv.weight.data(), conv.bias.data(), input)
+                , kernel_size(conv.kernel_size), stride(conv.stride), padding(conv.padding) {}
+
+            QuantizedConv2d(const modules::Conv2d& conv, QParams input, QParams output)
+                : QuantizedBase(conv.weight.data(), conv.bias.data(), input, output)
+                , kernel_size(conv.kernel_size), stride(conv.stride), padding(conv.padding) {}
+
+            QuantizedConv2d(at::Tensor weight, at::Tensor bias, std::vector<int64_t> stride, std::vector<int64_t> padding, QParams input)
+                : QuantizedBase(weight, bias, input)
+                , kernel_size({weight.size(2), weight.size(3)}), stride(stride), padding(padding) {}
+
+            at::Tensor predict(at::Tensor x) const {
+                auto q = quantize_tensor(x, this->input);
+                auto y = CPU(at::kFloat).tensor(this->output_sizes(q));
+                this->run(q, [&](long b, kernels::Epilogue& e) { e.out = y.data<float>() + b * y.stride(0); });
+                return y;
+            }
+
+            QTensor predict(const QTensor& x) const {
+                ATNN_ASSERT_MSG(this->requantize, "output qparams are not calibrated");
+                QTensor y = {CPU(at::kByte).tensor(this->output_sizes(x)), this->output};
+                this->run(x, [&](long b, kernels::Epilogue& e) {
+                        e.out_q = y.data.data<uint8_t>() + b * y.data.stride(0);
+                        e.out_scale = this->output.scale;
+                        e.out_zero_point = this->output.zero_point;
+                    });
+                return y;
+            }
+
+        private:
+            std::vector<int64_t> output_sizes(const QTensor& x) const {
+                ATNN_ASSERT_EQ(x.data.dim(), 4);
+                return {x.data.size(0), this->weight.data.size(0),
+                        (x.data.size(2) + 2 * this->padding[0] - this->kernel_size[0]) / this->stride[0] + 1,
+                        (x.data.size(3) + 2 * this->padding[1] - this->kernel_size[1]) / this->stride[1] + 1};
+            }
+
+            template <typename F>
+            void run(const QTensor& x, F set_output) const {
+                auto xc = x.data.contiguous();
+                const auto sizes = this->output_sizes(x);
+                const long c = xc.size(1), h = xc.size(2), w = xc.size(3);
+                const long spatial = sizes[2] * sizes[3];
+                const long k = c * this->kernel_size[0] * this->kernel_size[1];
+                ATNN_ASSERT_EQ(k, this->weight.data.size(1));
+                std::vector<uint8_t> rows(spatial * k);
+                for (long b = 0; b < xc.size(0); ++b) {
+                    kernels::im2row(xc.data<uint8_t>() + b * c * h * w, c, h, w,
+                                    this->kernel_size[0], this->kernel_size[1], this->stride[0], this->stride[1],
+                                    this->padding[0], this->padding[1], static_cast<uint8_t>(x.qparams.zero_point),
+                                    rows.data());
+                    // rows are output pixels and columns are channels, i.e., NCHW strides (1, spatial)
+                    auto e = this->epilogue(x.qparams, 1, spatial);
+                    set_output(b, e);
+                    kernels::gemm_u8s8(spatial, this->weight.data.size(0), k, rows.data(), this->weight.data.data<int8_t>(), e);
+                }
+            }
+        };
+
+    } // namespace quantize
+} // namespace atnn
@@ -0,0 +1,170 @@
+/*
+
+  This header defines counter-based random numbers (Philox-4x32-10, Salmon et al. "Parallel random numbers: as easy as 1, 2, 3")
+
+  - philox: 128 random bits of a counter under a key. no state: any block of a stream is computed
+    by any thread in any order, so the results do not depend on the number of threads
+  - Generator: a seed and an offset. each tensor reserves a disjoint range of blocks of the stream
+  - uniform/randn: CPU float tensors filled in parallel (e.g., parameter initialization)
+  - dropout: applies the mask of (seed, offset) without storing it, so backward regenerates the same mask
+
+ */
+
+#pragma once
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+#include <ATen/ATen.h>
+
+#include "testing.hpp"
+
+namespace atnn {
+    namespace random {
+
+        using Block = std::array<uint32_t, 4>;
+
+        inline Block philox(Block counter, std::array<uint32_t, 2> key) {
+            constexpr uint32_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+            constexpr uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+            for (int round = 0; round < 10; ++round) {
+                const uint64_t p0 = static_cast<uint64_t>(m0) * counter[0];
+                const uint64_t p1 = static_cast<uint64_t>(m1) * counter[2];
+                counter = {static_cast<uint32_t>(p1 >> 32) ^ counter[1] ^ key[0], static_cast<uint32_t>(p1),
+                           static_cast<uint32_t>(p0 >> 32) ^ counter[3] ^ key[1], static_cast<uint32_t>(p0)};
+                key[0] += w0;
+                key[1] += w1;
+            }
+            return counter;
+        }
+
+        /// the index-th block of the stream of seed
+        inline Block philox(uint64_t seed, uint64_t index) {
+            return philox({static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32), 0, 0},
+                          {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)});
+        }
+
+        /// [0, 1) with 24 random bits
+        inline float to_uniform(uint32_t bits) {
+            return (bits >> 8) * (1.0f / 16777216.0f);
+        }
+
+/**
+   a stream of blocks (4 numbers each). reserve(n) returns the first block of n numbers and skips them,
+   so the tensors drawn from a generator are independent and reproducible given the order of the draws.
+*/
+        struct Generator {
+            uint64_t seed;
+            std::atomic<uint64_t> offset{0};
+
+            explicit Generator(uint64_t seed=0) : seed(seed) {}
+
+            uint64_t reserve(uint64_t n) {
+                return this->offset.fetch_add((n + 3) / 4);
+            }
+
+            void manual_seed(uint64_t s) {
+                this->seed = s;
+                this->offset = 0;
+            }
+        };
+
+        /// used by the parameter initialization and Dropout
+        inline Generator& default_generator() {
+            static Generator generator(0x5eed);
+            return generator;
+        }
+
+        inline void manual_seed(uint64_t seed) {
+            default_generator().manual_seed(seed);
+        }
+
+        namespace detail {
+            /// f(block, i) writes the 4 elements from i (fewer at the end) of n elements
+            template <class F>
+            void for_each_block(long n, uint64_t seed, uint64_t offset, F f) {
+                const long blocks = (n + 3) / 4;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long b = 0; b < blocks; ++b) {
+                    f(philox(seed, offset + b), 4 * b);
+                }
+            }
+
+            inline float* float_data(at::Tensor& t) {
+                ATNN_ASSERT(t.type().backend() == at::kCPU && t.type().scalarType() == at::kFloat);
+                ATNN_ASSERT(t.is_contiguous());
+                return t.data<float>();
+            }
+        } // namespace detail
+
+        /// t[i] = U[lo, hi) from the blocks offset, offset + 1, ... of seed. t is a contiguous CPU float tensor
+        inline void fill_uniform(at::Tensor t, float lo, float hi, uint64_t seed, uint64_t offset) {
+            auto p = detail::float_data(t);
+            const long n = t.numel();
+            detail::for_each_block(n, seed, offset, [=](const Block& r, long i) {
+                    for (long k = 0; k < 4 && i + k < n; ++k) p[i + k] = lo + (hi - lo) * to_uniform(r[k]);
+                });
+        }
+
+        /// t[i] = N(mean, std^2) by Box-Muller: two normals from each pair of a block
+        inline void fill_normal(at::Tensor t, float mean, float std, uint64_t seed, uint64_t offset) {
+            auto p = detail::float_data(t);
+            const long n = t.numel();
+            detail::for_each_block(n, seed, offset, [=](const Block& r, long i) {
+                    float z[4];
+                    for (int k = 0; k < 4; k += 2) {
+                        const float u = ((r[k] >> 8) + 1) * (1.0f / 16777216.0f); // (0, 1]: finite log
+                        const float radius = std::sqrt(-2.0f * std::log(u));
+                        const float theta = 6.2831853f * to_uniform(r[k + 1]);
+                        z[k] = radius * std::cos(theta);
+                        z[k + 1] = radius * std::sin(theta);
+                    }
+                    for (long k = 0; k < 4 && i + k < n; ++k) p[i + k] = mean + std * z[k];
+                });
+        }
+
+        inline at::Tensor uniform(at::IntList sizes, float lo=0, float hi=1, Generator& generator=default_generator()) {
+            auto t = CPU(at::kFloat).tensor(sizes);
+            fill_uniform(t, lo, hi, generator.seed, generator.reserve(t.numel()));
+            return t;
+        }
+
+        inline at::Tensor randn(at::IntList sizes, float mean=0, float std=1, Generator& generator=default_generator()) {
+            auto t = CPU(at::kFloat).tensor(sizes);
+            fill_normal(t, mean, std, generator.seed, generator.reserve(t.numel()));
+            return t;
+        }
+
+        /// y = x * mask / (1 - p), mask[i] = U[0, 1) >= p of the blocks from offset. the same (seed, offset) gives the same mask
+        inline at::Tensor dropout(const at::Tensor& x, float p, uint64_t seed, uint64_t offset) {
+            const float scale = 1.0f / (1.0f - p);
+            const long n = x.numel();
+            if (x.type().backend() == at::kCPU && x.type().scalarType() == at::kFloat) {
+                const auto src = x.contiguous();
+                auto y = src.type().tensor(src.sizes());
+                const auto px = src.data<float>();
+                auto py = y.data<float>();
+                detail::for_each_block(n, seed, offset, [=](const Block& r, long i) {
+                        for (long k = 0; k < 4 && i + k < n; ++k) py[i + k] = to_uniform(r[k]) >= p ? px[i + k] * scale : 0.0f;
+                    });
+                return y;
+            }
+            // e.g., CUDA: the scaled mask is made on CPU
+            auto mask = CPU(at::kFloat).tensor(x.sizes());
+            auto pm = mask.data<float>();
+            detail::for_each_block(n, seed, offset, [=](const Block& r, long i) {
+                    for (long k = 0; k < 4 && i + k < n; ++k) pm[i + k] = to_uniform(r[k]) >= p ? scale : 0.0f;
+                });
+            return x * mask.toType(x.type());
+        }
+
+    } // namespace random
+} // namespace atnn
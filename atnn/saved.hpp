@@ -0,0 +1,492 @@
+/*
+
+  This header defines storage policies of the tensors saved for backward (see SavedTensorPolicy)
+
+  - HalfPolicy: bf16 or fp16 copies (lossy, half the memory)
+  - SparsePolicy: bitmap + nonzero values (lossless, e.g., ReLU outputs)
+  - SpillPolicy: written to an unlinked scratch file in the background and read back ahead of backward
+
+  SavedTensorPolicyGuard guard(std::make_shared<atnn::saved::HalfPolicy>());
+  auto loss = net(x); // the saved tensors are packed at the end of each module's forward
+  loss.backward(...); // and unpacked right before its backward
+
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "data/thread_pool.hpp"
+
+namespace atnn {
+    namespace saved {
+
+        struct SavedStats {
+            long packs = 0;
+            long unpacks = 0;
+            size_t raw_bytes = 0; // of the packed tensors
+            size_t stored_bytes = 0; // held in memory by the policy (0 for SpillPolicy)
+            double pack_seconds = 0;
+            double unpack_seconds = 0; // including wait_seconds
+            double wait_seconds = 0; // for background reads to finish
+            size_t saved_bytes() const { return this->raw_bytes - this->stored_bytes; }
+        };
+
+        namespace detail {
+            using Clock = std::chrono::high_resolution_clock;
+
+            inline double seconds_since(Clock::time_point start) {
+                return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+            }
+
+            /// shared by a policy and its packed tensors, which may outlive it
+            struct StatsSink {
+                std::mutex mutex;
+                SavedStats stats;
+
+                void packed(size_t raw, size_t stored, double seconds) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    ++this->stats.packs;
+                    this->stats.raw_bytes += raw;
+                    this->stats.stored_bytes += stored;
+                    this->stats.pack_seconds += seconds;
+                }
+
+                void unpacked(double seconds, double wait=0) {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    ++this->stats.unpacks;
+                    this->stats.unpack_seconds += seconds;
+                    this->stats.wait_seconds += wait;
+                }
+            };
+
+            inline std::vector<int64_t> sizes_of(const at::Tensor& t) {
+                const auto s = t.sizes();
+                return std::vector<int64_t>(s.begin(), s.end());
+            }
+
+            inline uint16_t to_bf16(float f) {
+                uint32_t u;
+                std::memcpy(&u, &f, sizeof(u));
+                if ((u & 0x7fffffff) > 0x7f800000) return static_cast<uint16_t>((u >> 16) | 0x40); // quiet NaN
+                u += 0x7fff + ((u >> 16) & 1); // round to nearest even
+                return static_cast<uint16_t>(u >> 16);
+            }
+
+            inline float from_bf16(uint16_t h) {
+                const uint32_t u = static_cast<uint32_t>(h) << 16;
+                float f;
+                std::memcpy(&f, &u, sizeof(f));
+                return f;
+            }
+
+            inline uint16_t to_fp16(float f) {
+                uint32_t x;
+                std::memcpy(&x, &f, sizeof(x));
+                const uint32_t sign = (x >> 16) & 0x8000;
+                const int32_t e = static_cast<int32_t>((x >> 23) & 0xff);
+                uint32_t mant = x & 0x7fffff;
+                if (e == 0xff) return static_cast<uint16_t>(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf, NaN
+                const int32_t exp = e - 127 + 15;
+                if (exp >= 31) return static_cast<uint16_t>(sign | 0x7c00); // overflow
+                uint32_t shift = 13, h;
+                if (exp <= 0) { // subnormal
+                    if (exp < -10) return static_cast<uint16_t>(sign);
+                    mant |= 0x800000;
+                    shift = static_cast<uint32_t>(14 - exp);
+                    h = mant >> shift;
+                } else {
+                    h = (static_cast<uint32_t>(exp) << 10) | (mant >> shift);
+                }
+                const uint32_t rem = mant & ((1u << shift) - 1);
+                const uint32_t half = 1u << (shift - 1);
+                if (rem > half || (rem == half && (h & 1))) ++h; // a carry into the exponent is still correct
+                return static_cast<uint16_t>(sign | h);
+            }
+
+            inline float from_fp16(uint16_t h) {
+                const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+                uint32_t exp = (h >> 10) & 0x1f;
+                uint32_t mant = h & 0x3ff;
+                uint32_t x;
+                if (exp == 0 && mant == 0) {
+                    x = sign;
+                } else if (exp == 0) { // subnormal: normalize
+                    exp = 127 - 15 + 1;
+                    while (!(mant & 0x400)) {
+                        mant <<= 1;
+                        --exp;
+                    }
+                    x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+                } else if (exp == 31) {
+                    x = sign | 0x7f800000 | (mant << 13);
+                } else {
+                    x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+                }
+                float f;
+                std::memcpy(&f, &x, sizeof(f));
+                return f;
+            }
+        } // namespace detail
+
+/**
+   base of the policies: packs contiguous CPU float tensors of at least min_numel elements
+   (smaller ones are not worth the bookkeeping) and keeps the others as they are.
+   a packed tensor can be unpacked any number of times (e.g., backward with retained graphs).
+*/
+        struct Policy : SavedTensorPolicy {
+            size_t min_numel;
+
+            explicit Policy(size_t min_numel) : min_numel(min_numel) {}
+
+            PackedTensorPtr pack(const at::Tensor& t) override {
+                if (t.type().backend() != at::kCPU || t.type().scalarType() != at::kFloat) return nullptr;
+                if (static_cast<size_t>(t.numel()) < this->min_numel) return nullptr;
+                const auto start = detail::Clock::now();
+                size_t stored = 0;
+                auto p = this->pack_float(t.contiguous(), stored);
+                if (p) this->sink->packed(t.numel() * sizeof(float), stored, detail::seconds_since(start));
+                return p;
+            }
+
+            SavedStats stats() const {
+                std::lock_guard<std::mutex> lock(this->sink->mutex);
+                return this->sink->stats;
+            }
+
+            void reset_stats() {
+                std::lock_guard<std::mutex> lock(this->sink->mutex);
+                this->sink->stats = SavedStats();
+            }
+
+        protected:
+            /// t is a contiguous CPU float tensor. sets the bytes kept in memory
+            virtual PackedTensorPtr pack_float(at::Tensor t, size_t& stored) = 0;
+
+            std::shared_ptr<detail::StatsSink> sink = std::make_shared<detail::StatsSink>();
+        };
+
+        struct PackedHalf : PackedTensor {
+            std::vector<uint16_t> bits;
+            std::vector<int64_t> sizes;
+            at::Type* type;
+            bool bf16;
+            std::shared_ptr<detail::StatsSink> sink;
+
+            bool lossless() const override { return false; }
+
+            at::Tensor unpack() override {
+                const auto start = detail::Clock::now();
+                auto t = this->type->tensor(this->sizes);
+                auto p = t.data<float>();
+                const auto src = this->bits.data();
+                const long n = this->bits.size();
+                if (this->bf16) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < n; ++i) p[i] = detail::from_bf16(src[i]);
+                } else {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < n; ++i) p[i] = detail::from_fp16(src[i]);
+                }
+                this->sink->unpacked(detail::seconds_since(start));
+                return t;
+            }
+        };
+
+/**
+   rounds the saved tensors to 16 bits: bf16 keeps the float range with 8 significant bits,
+   fp16 keeps 11 significant bits but flushes |x| < 6e-8 to zero and overflows above 65504.
+   the gradients are approximate: use it for activations, not for exact grad_check.
+*/
+        struct HalfPolicy : Policy {
+            enum Format { BF16, FP16 };
+            Format format;
+
+            explicit HalfPolicy(Format format=BF16, size_t min_numel=4096)
+                : Policy(min_numel), format(format) {}
+
+        protected:
+            PackedTensorPtr pack_float(at::Tensor t, size_t& stored) override {
+                auto p = std::make_shared<PackedHalf>();
+                p->sizes = detail::sizes_of(t);
+                p->type = &t.type();
+                p->bf16 = this->format == BF16;
+                p->sink = this->sink;
+                const long n = t.numel();
+                p->bits.resize(n);
+                const auto src = t.data<float>();
+                auto dst = p->bits.data();
+                if (p->bf16) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < n; ++i) dst[i] = detail::to_bf16(src[i]);
+                } else {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                    for (long i = 0; i < n; ++i) dst[i] = detail::to_fp16(src[i]);
+                }
+                stored = n * sizeof(uint16_t);
+                return p;
+            }
+        };
+
+        /// 1 bit per element + the nonzero values, in chunks decoded independently
+        struct PackedSparse : PackedTensor {
+            static constexpr long chunk = 1024; // elements per chunk
+            static constexpr long words = chunk / 64; // bitmap words per chunk
+
+            std::vector<uint64_t> bitmap;
+            std::vector<size_t> offsets; // of the first value of each chunk
+            std::vector<float> values;
+            std::vector<int64_t> sizes;
+            long numel = 0;
+            at::Type* type;
+            std::shared_ptr<detail::StatsSink> sink;
+
+            at::Tensor unpack() override {
+                const auto start = detail::Clock::now();
+                auto t = this->type->zeros(this->sizes);
+                auto dst = t.data<float>();
+                const long chunks = this->offsets.size();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long c = 0; c < chunks; ++c) {
+                    const float* v = this->values.data() + this->offsets[c];
+                    for (long w = 0; w < words; ++w) {
+                        uint64_t bits = this->bitmap[c * words + w];
+                        while (bits) {
+                            const long i = c * chunk + w * 64 + __builtin_ctzll(bits);
+                            dst[i] = *v++;
+                            bits &= bits - 1;
+                        }
+                    }
+                }
+                this->sink->unpacked(detail::seconds_since(start));
+                return t;
+            }
+        };
+
+        constexpr long PackedSparse::chunk;
+        constexpr long PackedSparse::words;
+
+/**
+   stores the nonzero elements only. exact, so gradients are unchanged.
+   tensors denser than max_density are kept as they are (the bitmap costs 1/32 of the raw bytes).
+*/
+        struct SparsePolicy : Policy {
+            double max_density;
+
+            explicit SparsePolicy(double max_density=0.75, size_t min_numel=4096)
+                : Policy(min_numel), max_density(max_density) {}
+
+        protected:
+            PackedTensorPtr pack_float(at::Tensor t, size_t& stored) override {
+                using P = PackedSparse;
+                const long n = t.numel();
+                const long chunks = (n + P::chunk - 1) / P::chunk;
+                const auto src = t.data<float>();
+                std::vector<uint64_t> bitmap(chunks * P::words, 0);
+                std::vector<size_t> counts(chunks);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long c = 0; c < chunks; ++c) {
+                    size_t count = 0;
+                    const long end = std::min(n, (c + 1) * P::chunk);
+                    for (long i = c * P::chunk; i < end; ++i) {
+                        if (src[i] != 0.0f) {
+                            bitmap[i / 64] |= uint64_t(1) << (i % 64);
+                            ++count;
+                        }
+                    }
+                    counts[c] = count;
+                }
+                size_t nnz = 0;
+                for (auto&& k: counts) {
+                    const auto count = k;
+                    k = nnz; // exclusive prefix sum: the offsets
+                    nnz += count;
+                }
+                if (nnz > this->max_density * n) return nullptr;
+
+                auto p = std::make_shared<P>();
+                p->values.resize(nnz);
+                auto dst = p->values.data();
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long c = 0; c < chunks; ++c) {
+                    auto v = dst + counts[c];
+                    const long end = std::min(n, (c + 1) * P::chunk);
+                    for (long i = c * P::chunk; i < end; ++i) {
+                        if (src[i] != 0.0f) *v++ = src[i];
+                    }
+                }
+                p->bitmap = std::move(bitmap);
+                p->offsets = std::move(counts);
+                p->sizes = detail::sizes_of(t);
+                p->numel = n;
+                p->type = &t.type();
+                p->sink = this->sink;
+                stored = nnz * sizeof(float) + p->bitmap.size() * sizeof(uint64_t) + p->offsets.size() * sizeof(size_t);
+                return p;
+            }
+        };
+
+/**
+   an unlinked file (removed when closed) with one I/O thread.
+   the space is reused from the start once no packed tensor refers to it (e.g., after each backward).
+*/
+        struct ScratchFile {
+            explicit ScratchFile(const std::string& dir) {
+                auto path = dir + "/atnn-saved-XXXXXX";
+                std::vector<char> name(path.begin(), path.end());
+                name.push_back('\0');
+                this->fd = ::mkstemp(name.data());
+                if (this->fd < 0) throw_with_trace(std::runtime_error("cannot create a scratch file in " + dir));
+                ::unlink(name.data());
+            }
+
+            ~ScratchFile() { ::close(this->fd); }
+
+            ScratchFile(const ScratchFile&) = delete;
+            ScratchFile& operator=(const ScratchFile&) = delete;
+
+            size_t allocate(size_t nbytes) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                ++this->live;
+                const auto offset = this->end;
+                this->end += nbytes;
+                return offset;
+            }
+
+            void release() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (--this->live == 0) this->end = 0;
+            }
+
+            void write(const char* src, size_t nbytes, size_t offset) const {
+                while (nbytes > 0) {
+                    const auto k = ::pwrite(this->fd, src, nbytes, offset);
+                    if (k <= 0) throw_with_trace(std::runtime_error("cannot write a saved tensor to the scratch file"));
+                    src += k;
+                    nbytes -= k;
+                    offset += k;
+                }
+            }
+
+            void read(char* dst, size_t nbytes, size_t offset) const {
+                while (nbytes > 0) {
+                    const auto k = ::pread(this->fd, dst, nbytes, offset);
+                    if (k <= 0) throw_with_trace(std::runtime_error("cannot read a saved tensor from the scratch file"));
+                    dst += k;
+                    nbytes -= k;
+                    offset += k;
+                }
+            }
+
+            data::ThreadPool io{1}; // FIFO: a read is queued after the write of the same tensor
+
+        private:
+            int fd = -1;
+            std::mutex mutex;
+            size_t end = 0;
+            long live = 0;
+        };
+
+        struct PackedSpill : PackedTensor {
+            std::shared_ptr<ScratchFile> file;
+            size_t offset, nbytes;
+            std::vector<int64_t> sizes;
+            at::Type* type;
+            std::shared_ptr<detail::StatsSink> sink;
+            std::shared_future<void> written;
+            std::future<void> read;
+            at::Tensor loaded;
+
+            // the I/O tasks refer to this file and memory, which must outlive them
+            ~PackedSpill() {
+                if (this->written.valid()) this->written.wait();
+                if (this->read.valid()) this->read.wait();
+                this->file->release();
+            }
+
+            void prefetch() override {
+                if (this->read.valid()) return;
+                this->loaded = this->type->tensor(this->sizes);
+                const auto f = this->file.get();
+                const auto dst = reinterpret_cast<char*>(this->loaded.data<float>());
+                const auto n = this->nbytes;
+                const auto o = this->offset;
+                this->read = this->file->io.submit([=] { f->read(dst, n, o); });
+            }
+
+            at::Tensor unpack() override {
+                const auto start = detail::Clock::now();
+                this->prefetch();
+                const auto wait_start = detail::Clock::now();
+                this->written.get(); // rethrows write errors
+                this->read.get();
+                const auto wait = detail::seconds_since(wait_start);
+                auto t = this->loaded;
+                this->loaded = at::Tensor();
+                this->sink->unpacked(detail::seconds_since(start), wait);
+                return t;
+            }
+        };
+
+/**
+   moves the saved tensors to disk during forward and prefetches them in reverse order during backward
+   (the tensors of the next node to run backward are read while the current one computes).
+   memory is released once a write completes, so peak memory depends on the disk bandwidth.
+   set `dir` to a local disk: a tmpfs only moves the bytes to the page cache.
+*/
+        struct SpillPolicy : Policy {
+            explicit SpillPolicy(const std::string& dir="/tmp", size_t min_numel=1 << 16)
+                : Policy(min_numel), file(std::make_shared<ScratchFile>(dir)) {}
+
+        protected:
+            PackedTensorPtr pack_float(at::Tensor t, size_t& stored) override {
+                auto p = std::make_shared<PackedSpill>();
+                p->file = this->file;
+                p->nbytes = t.numel() * sizeof(float);
+                p->offset = this->file->allocate(p->nbytes);
+                p->sizes = detail::sizes_of(t);
+                p->type = &t.type();
+                p->sink = this->sink;
+                const auto f = this->file.get();
+                const auto n = p->nbytes;
+                const auto o = p->offset;
+                // t is referenced by the task until written
+                p->written = this->file->io.submit([=] { f->write(reinterpret_cast<const char*>(t.data<float>()), n, o); }).share();
+                stored = 0;
+                return p;
+            }
+
+            std::shared_ptr<ScratchFile> file;
+        };
+
+    } // namespace saved
+} // namespace atnn
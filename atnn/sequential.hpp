@@ -0,0 +1,177 @@
+/*
+
+  This header defines a compile-time chain of modules
+
+  - Sequential<M1, M2, ...>: one Module (one Node per call) running the stages' Functions with static dispatch
+
+ */
+
+#pragma once
+
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+
+namespace atnn {
+    template <class ... Ms>
+    struct Sequential;
+
+    namespace detail {
+        template <size_t I>
+        using Index = std::integral_constant<size_t, I>;
+
+        template <class M>
+        struct IsSequential : std::false_type {};
+
+        template <class ... Ms>
+        struct IsSequential<Sequential<Ms...>> : std::true_type {};
+
+        template <class ... Ms>
+        constexpr bool any_sequential() {
+            const bool nested[] = {false, IsSequential<Ms>::value...};
+            for (auto n: nested) {
+                if (n) return true;
+            }
+            return false;
+        }
+
+        // features (dim 1) of the output given the features of the input (-1: unknown)
+        inline long out_features(const ModuleBase&, long) { return -1; }
+
+        inline long out_features(const modules::Threshold&, long in) { return in; }
+        inline long out_features(const modules::Sigmoid&, long in) { return in; }
+        inline long out_features(const modules::Tanh&, long in) { return in; }
+        inline long out_features(const modules::Scale&, long in) { return in; }
+
+        inline long out_features(const modules::BatchNorm& m, long in) {
+            const auto c = m.weight.data().size(0);
+            ATNN_ASSERT_MSG(in < 0 || in == c, "BatchNorm features do not match the previous stage");
+            return c;
+        }
+
+        inline long out_features(const modules::Linear& m, long in) {
+            ATNN_ASSERT_MSG(in < 0 || in == m.weight.data().size(1), "Linear in_features do not match the previous stage");
+            return m.weight.data().size(0);
+        }
+
+        inline long out_features(const modules::Conv2d& m, long in) {
+            ATNN_ASSERT_MSG(in < 0 || in == m.weight.data().size(1), "Conv2d in_channels do not match the previous stage");
+            return m.weight.data().size(0);
+        }
+    } // namespace detail
+
+/**
+   Sequential chains the Functions of its stages at compile time.
+
+   auto net = std::make_shared<Sequential<M::Conv2d, M::BatchNorm, M::ReLU>>(conv, bn, relu);
+   auto y = net->forward(x);
+
+   unlike ModuleSet with a hand-written operator(), a call records a single Node, and the stages'
+   forward/backward are called directly (inlinable) instead of through ModuleBase.
+   the saved tensors of each stage are kept in Node::stage_tensors.
+   feature counts of adjacent Linear/Conv2d/BatchNorm stages are checked at construction.
+*/
+    template <class ... Ms>
+    struct Sequential : Module<Sequential<Ms...>> {
+        static_assert(sizeof...(Ms) > 0, "Sequential needs at least one stage");
+        // the Node keeps one TList of saved tensors per stage, not the per-stage lists of a nested chain
+        static_assert(!detail::any_sequential<Ms...>(), "a stage of Sequential cannot be a Sequential (list its stages instead)");
+        static constexpr size_t size = sizeof...(Ms);
+        template <size_t I>
+        using Stage = std::tuple_element_t<I, std::tuple<Ms...>>;
+
+        // values between stages keep the container types of the stages' Functions (e.g., TArray<1>)
+        using Function = struct {
+            template <typename Context>
+            static auto forward(Context ctx, InputsOf<Stage<0>> xs) {
+                if (GradMode::is_enabled()) current_node()->stage_tensors.resize(size);
+                return forward_from(ctx, std::move(xs), detail::Index<0>());
+            }
+
+            template <typename Context>
+            static auto backward(Context ctx, GradOutputsOf<Stage<size - 1>> gy) {
+                return backward_from(ctx, std::move(gy), detail::Index<size - 1>());
+            }
+
+            template <typename Context, class Xs>
+            static auto forward_from(Context ctx, Xs xs, detail::Index<size - 1> i) {
+                return stage_forward(ctx, std::move(xs), i);
+            }
+
+            template <typename Context, class Xs, size_t I>
+            static auto forward_from(Context ctx, Xs xs, detail::Index<I> i) {
+                return forward_from(ctx, stage_forward(ctx, std::move(xs), i), detail::Index<I + 1>());
+            }
+
+            template <typename Context, class Gy>
+            static auto backward_from(Context ctx, Gy gy, detail::Index<0> i) {
+                return stage_backward(ctx, std::move(gy), i);
+            }
+
+            template <typename Context, class Gy, size_t I>
+            static auto backward_from(Context ctx, Gy gy, detail::Index<I> i) {
+                return backward_from(ctx, stage_backward(ctx, std::move(gy), i), detail::Index<I - 1>());
+            }
+
+            // runs the stage with a temporary Node so that its save_for_backward does not clobber the others
+            template <typename Context, class Xs, size_t I>
+            static auto stage_forward(Context ctx, Xs xs, detail::Index<I>) {
+                auto&& layer = std::get<I>(ctx->layers);
+                auto inputs = list_cast<InputsOf<Stage<I>>>(std::move(xs));
+                layer->autocast(inputs);
+                if (!GradMode::is_enabled()) return layer->apply(std::move(inputs));
+                auto node = current_node();
+                Node stage;
+                NodeScope scope(&stage);
+                auto ys = layer->apply(std::move(inputs));
+                node->stage_tensors[I] = std::move(stage.saved_tensors);
+                node->dirty.insert(node->dirty.end(), stage.dirty.begin(), stage.dirty.end());
+                return ys;
+            }
+
+            template <typename Context, class Gy, size_t I>
+            static auto stage_backward(Context ctx, Gy gy, detail::Index<I>) {
+                auto&& layer = std::get<I>(ctx->layers);
+                auto& saved = current_node()->stage_tensors[I];
+                Node stage;
+                // the first stage sees the inputs of the call: Module::needs_input_grad prunes it as outside Sequential
+                if (I == 0) {
+                    for (auto&& v: current_node()->vargs) stage.add_varg(v);
+                }
+                std::swap(stage.saved_tensors, saved); // swapped back to allow another backward
+                NodeScope scope(&stage);
+                auto gx = Stage<I>::Function::backward(layer.get(), list_cast<GradOutputsOf<Stage<I>>>(std::move(gy)));
+                std::swap(stage.saved_tensors, saved);
+                return gx;
+            }
+        };
+
+        std::tuple<std::shared_ptr<Ms>...> layers;
+
+        explicit Sequential(std::shared_ptr<Ms> ... layers) : layers(layers...) {
+            this->submodules = {layers...};
+            long features = -1;
+            int check[] = {(features = detail::out_features(*layers, features), 0)...};
+            (void) check;
+        }
+
+        /// the I-th stage
+        template <size_t I>
+        auto& get() { return std::get<I>(this->layers); }
+    };
+
+    template <class ... Ms>
+    constexpr size_t Sequential<Ms...>::size;
+
+    /// deduces the stage types, e.g., make_sequential(conv, relu)
+    template <class ... Ms>
+    auto make_sequential(std::shared_ptr<Ms> ... layers) {
+        return std::make_shared<Sequential<Ms...>>(layers...);
+    }
+} // namespace atnn
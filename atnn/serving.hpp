@@ -0,0 +1,514 @@
+/*
+
+  This header defines in-process inference serving
+
+  - BatchingServer: coalesces concurrent single-sample requests into batched forwards
+  - StreamingServer: advances recurrent state of many streams, one batched step for all of them
+  - SessionCache: per-session state with LRU eviction and expiry
+
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "autograd.hpp"
+#include "modules.hpp"
+
+namespace atnn {
+    namespace serving {
+
+        struct BatchingOptions {
+            long max_batch = 32;
+            // how long the oldest request may wait for the batch to fill
+            std::chrono::microseconds max_latency = std::chrono::microseconds(1000);
+            size_t num_workers = 1; // batches running forward concurrently
+        };
+
+        struct BatchingStats {
+            long requests = 0;
+            long batches = 0;
+            double mean_batch_size() const { return this->batches == 0 ? 0.0 : double(this->requests) / this->batches; }
+        };
+
+/**
+   BatchingServer turns single-sample requests into batched forwards.
+
+   a worker takes the queued requests when `max_batch` of them are waiting or when the oldest one
+   has waited `max_latency`, stacks them along a new first dimension, runs `forward` once
+   and fulfils each request's future with its row of the output.
+
+   `forward` is called from several workers when num_workers > 1, so use a thread-safe one
+   such as Module::predict, e.g., [=](at::Tensor x) { return linear->predict(x); }
+*/
+        struct BatchingServer {
+            using Forward = std::function<at::Tensor(at::Tensor)>;
+
+            BatchingServer(Forward forward, BatchingOptions options={})
+                : forward(forward), options(options) {
+                ATNN_ASSERT(options.max_batch > 0);
+                ATNN_ASSERT(options.num_workers > 0);
+                for (size_t i = 0; i < options.num_workers; ++i) {
+                    this->workers.emplace_back([this] { this->loop(); });
+                }
+            }
+
+            /// serves the pending requests and stops
+            ~BatchingServer() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopped = true;
+                }
+                this->cond.notify_all();
+                for (auto& w: this->workers) {
+                    w.join();
+                }
+            }
+
+            /// `sample` has no batch dimension. the result neither.
+            std::future<at::Tensor> submit(at::Tensor sample) {
+                Request r;
+                r.sample = sample;
+                r.arrival = Clock::now();
+                auto result = r.promise.get_future();
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    ATNN_ASSERT_MSG(!this->stopped, "submit to a stopped server");
+                    this->queue.push_back(std::move(r));
+                }
+                this->cond.notify_one();
+                return result;
+            }
+
+            BatchingStats stats() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->batching_stats;
+            }
+
+            const Forward forward;
+            const BatchingOptions options;
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            struct Request {
+                at::Tensor sample;
+                std::promise<at::Tensor> promise;
+                Clock::time_point arrival;
+            };
+
+            bool take(std::vector<Request>& batch) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while (true) {
+                    this->cond.wait(lock, [this] { return this->stopped || !this->queue.empty(); });
+                    if (this->queue.empty()) return false; // stopped
+                    const auto deadline = this->queue.front().arrival + this->options.max_latency;
+                    const auto full = [this] {
+                        return this->stopped || static_cast<long>(this->queue.size()) >= this->options.max_batch;
+                    };
+                    this->cond.wait_until(lock, deadline, full);
+                    // another worker may have taken the requests meanwhile
+                    if (!this->queue.empty()) break;
+                }
+                const auto n = std::min<long>(this->queue.size(), this->options.max_batch);
+                for (long i = 0; i < n; ++i) {
+                    batch.push_back(std::move(this->queue.front()));
+                    this->queue.pop_front();
+                }
+                this->batching_stats.requests += n;
+                ++this->batching_stats.batches;
+                if (!this->queue.empty()) this->cond.notify_one();
+                return true;
+            }
+
+            void loop() {
+                std::vector<Request> batch;
+                batch.reserve(this->options.max_batch);
+                while (this->take(batch)) {
+                    try {
+                        const auto& first = batch[0].sample;
+                        std::vector<int64_t> shape = {static_cast<int64_t>(batch.size())};
+                        shape.insert(shape.end(), first.sizes().begin(), first.sizes().end());
+                        auto x = first.type().tensor(shape);
+                        for (size_t i = 0; i < batch.size(); ++i) {
+                            x.select(0, i).copy_(batch[i].sample);
+                        }
+                        auto y = this->forward(x);
+                        ATNN_ASSERT_EQ(y.size(0), static_cast<int64_t>(batch.size()));
+                        for (size_t i = 0; i < batch.size(); ++i) {
+                            batch[i].promise.set_value(y.select(0, i));
+                        }
+                    } catch (...) {
+                        for (auto& r: batch) {
+                            try {
+                                r.promise.set_exception(std::current_exception());
+                            } catch (const std::future_error&) {} // already fulfilled
+                        }
+                    }
+                    batch.clear();
+                }
+            }
+
+            std::vector<std::thread> workers;
+            std::deque<Request> queue;
+            std::mutex mutex;
+            std::condition_variable cond;
+            bool stopped = false;
+            BatchingStats batching_stats;
+        };
+
+        using SessionId = uint64_t;
+
+        struct SessionCacheStats {
+            long hits = 0;
+            long misses = 0;      // new, evicted or expired sessions
+            long evictions = 0;   // the least recently used beyond the capacity
+            long expirations = 0; // unused longer than the ttl
+        };
+
+/**
+   SessionCache keeps the state of up to `capacity` sessions, evicting the least recently used one,
+   and drops the sessions unused for `ttl`. it is thread-safe. get and put are O(1) (amortized for expiry).
+*/
+        template <class State>
+        struct SessionCache {
+            using Clock = std::chrono::steady_clock;
+
+            SessionCache(size_t capacity, Clock::duration ttl) : capacity(capacity), ttl(ttl) {
+                ATNN_ASSERT(capacity > 0);
+            }
+
+            /// false when the session is unknown, evicted or expired
+            bool get(SessionId id, State& state) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                const auto now = Clock::now();
+                this->expire(now);
+                auto it = this->index.find(id);
+                if (it == this->index.end()) {
+                    ++this->cache_stats.misses;
+                    return false;
+                }
+                ++this->cache_stats.hits;
+                this->touch(it->second, now);
+                state = it->second->state;
+                return true;
+            }
+
+            void put(SessionId id, State state) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                const auto now = Clock::now();
+                this->expire(now);
+                auto it = this->index.find(id);
+                if (it != this->index.end()) {
+                    it->second->state = std::move(state);
+                    this->touch(it->second, now);
+                    return;
+                }
+                this->entries.push_front({id, std::move(state), now});
+                this->index[id] = this->entries.begin();
+                while (this->entries.size() > this->capacity) {
+                    this->index.erase(this->entries.back().id);
+                    this->entries.pop_back();
+                    ++this->cache_stats.evictions;
+                }
+            }
+
+            void erase(SessionId id) {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                auto it = this->index.find(id);
+                if (it == this->index.end()) return;
+                this->entries.erase(it->second);
+                this->index.erase(it);
+            }
+
+            size_t size() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->entries.size();
+            }
+
+            SessionCacheStats stats() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->cache_stats;
+            }
+
+            const size_t capacity;
+            const Clock::duration ttl;
+
+        private:
+            struct Entry {
+                SessionId id;
+                State state;
+                Clock::time_point last_use;
+            };
+            using Iterator = typename std::list<Entry>::iterator;
+
+            void touch(Iterator it, Clock::time_point now) {
+                it->last_use = now;
+                this->entries.splice(this->entries.begin(), this->entries, it);
+            }
+
+            /// the entries are ordered by last use, so the expired ones are at the back
+            void expire(Clock::time_point now) {
+                while (!this->entries.empty() && now - this->entries.back().last_use > this->ttl) {
+                    this->index.erase(this->entries.back().id);
+                    this->entries.pop_back();
+                    ++this->cache_stats.expirations;
+                }
+            }
+
+            std::list<Entry> entries; // the most recently used first
+            std::unordered_map<SessionId, Iterator> index;
+            std::mutex mutex;
+            SessionCacheStats cache_stats;
+        };
+
+        struct StreamingOptions {
+            long max_batch = 64; // sessions stepped together
+            std::chrono::microseconds max_latency = std::chrono::microseconds(1000);
+            size_t num_workers = 1;
+            size_t max_sessions = 10000; // cached states (LRU)
+            std::chrono::seconds ttl = std::chrono::seconds(300);
+        };
+
+        struct StreamingStats {
+            long requests = 0;
+            long batches = 0;
+            long steps = 0; // calls of Step
+            long rows = 0;  // frames over all the steps
+            double mean_rows_per_step() const { return this->steps == 0 ? 0.0 : double(this->rows) / this->steps; }
+        };
+
+/**
+   StreamingServer serves a recurrent module to many concurrent streams (sessions).
+
+   submit(session, frames) advances the session by its new frames (T, input) only, from the state
+   cached at the end of its previous request, and returns the outputs (T, output).
+   a worker takes the requests of up to max_batch distinct sessions and steps them in lockstep:
+   step t stacks the t-th new frame of every session having one into a single call of `step` (one GEMM),
+   whatever the time offset of each session. the requests are sorted by length, so the sessions still
+   running are a prefix of the batch and their states are narrowed in place.
+
+   StreamingServer server(lstm); // modules::LSTMCell: the outputs are h
+   auto y = server.submit(session, frames).get();
+
+   the requests of a session run in the order of submission. an evicted or expired session starts over
+   from the initial state. `step` must be thread-safe with num_workers > 1 (e.g., Module::predict).
+*/
+        struct StreamingServer {
+            /// the next state of x (N, input) and state (each (N, ...)). the output of the step is the next state[0]
+            using Step = std::function<TList(at::Tensor x, const TList& state)>;
+            /// the state of n new sessions
+            using InitialState = std::function<TList(long n)>;
+
+            StreamingServer(Step step, InitialState initial_state, StreamingOptions options={})
+                : step(step), initial_state(initial_state), options(options)
+                , cache(options.max_sessions, options.ttl) {
+                ATNN_ASSERT(options.max_batch > 0);
+                ATNN_ASSERT(options.num_workers > 0);
+                for (size_t i = 0; i < options.num_workers; ++i) {
+                    this->workers.emplace_back([this] { this->loop(); });
+                }
+            }
+
+            explicit StreamingServer(std::shared_ptr<modules::LSTMCell> cell, StreamingOptions options={})
+                : StreamingServer([cell](at::Tensor x, const TList& s) {
+                        auto next = cell->predict(x, s[0], s[1]);
+                        return TList {next[0], next[1]};
+                    }, [cell](long n) {
+                        auto zero = cell->zero_state(n);
+                        return TList {zero[0], zero[1]};
+                    }, options) {}
+
+            /// serves the pending requests and stops
+            ~StreamingServer() {
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    this->stopped = true;
+                }
+                this->cond.notify_all();
+                for (auto& w: this->workers) {
+                    w.join();
+                }
+            }
+
+            /// frames (T, ...) of one session. the result is (T, ...) of the outputs
+            std::future<at::Tensor> submit(SessionId session, at::Tensor frames) {
+                ATNN_ASSERT(frames.dim() >= 2 && frames.size(0) > 0);
+                Request r;
+                r.session = session;
+                r.frames = frames;
+                r.arrival = Clock::now();
+                auto result = r.promise.get_future();
+                {
+                    std::lock_guard<std::mutex> lock(this->mutex);
+                    ATNN_ASSERT_MSG(!this->stopped, "submit to a stopped server");
+                    if (this->queued[session]++ == 0 && !this->running.count(session)) ++this->runnable_sessions;
+                    this->queue.push_back(std::move(r));
+                }
+                this->cond.notify_one();
+                return result;
+            }
+
+            /// forgets the state of a finished session
+            void end(SessionId session) { this->cache.erase(session); }
+
+            StreamingStats stats() {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                return this->streaming_stats;
+            }
+
+            SessionCacheStats cache_stats() { return this->cache.stats(); }
+
+            const Step step;
+            const InitialState initial_state;
+            const StreamingOptions options;
+
+        private:
+            using Clock = std::chrono::steady_clock;
+
+            struct Request {
+                SessionId session;
+                at::Tensor frames;
+                std::promise<at::Tensor> promise;
+                Clock::time_point arrival;
+            };
+
+            /// the queued sessions that no worker is running
+            long runnable() const { return this->runnable_sessions; }
+
+            bool take(std::vector<Request>& batch) {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while (true) {
+                    this->cond.wait(lock, [this] { return (this->stopped && this->queue.empty()) || this->runnable() > 0; });
+                    if (this->queue.empty()) return false; // stopped
+                    if (this->runnable() == 0) continue; // woken by stopped: wait for the running sessions
+                    const auto deadline = this->queue.front().arrival + this->options.max_latency;
+                    this->cond.wait_until(lock, deadline, [this] {
+                            return this->stopped || this->runnable() >= this->options.max_batch;
+                        });
+                    // another worker may have taken the requests meanwhile
+                    if (this->runnable() > 0) break;
+                }
+                // the oldest request of each session: later ones wait for its state
+                for (auto it = this->queue.begin(); it != this->queue.end() && static_cast<long>(batch.size()) < this->options.max_batch;) {
+                    if (this->running.count(it->session)) {
+                        ++it;
+                        continue;
+                    }
+                    this->running.insert(it->session);
+                    --this->runnable_sessions;
+                    auto q = this->queued.find(it->session);
+                    if (--q->second == 0) this->queued.erase(q);
+                    batch.push_back(std::move(*it));
+                    it = this->queue.erase(it);
+                }
+                this->streaming_stats.requests += batch.size();
+                ++this->streaming_stats.batches;
+                if (this->runnable() > 0) this->cond.notify_one();
+                return true;
+            }
+
+            void loop() {
+                std::vector<Request> batch;
+                batch.reserve(this->options.max_batch);
+                while (this->take(batch)) {
+                    long steps = 0, rows = 0;
+                    try {
+                        this->run(batch, steps, rows);
+                    } catch (...) {
+                        for (auto& r: batch) {
+                            try {
+                                r.promise.set_exception(std::current_exception());
+                            } catch (const std::future_error&) {} // already fulfilled
+                        }
+                    }
+                    {
+                        std::lock_guard<std::mutex> lock(this->mutex);
+                        for (auto&& r: batch) {
+                            this->running.erase(r.session);
+                            if (this->queued.count(r.session)) ++this->runnable_sessions;
+                        }
+                        this->streaming_stats.steps += steps;
+                        this->streaming_stats.rows += rows;
+                    }
+                    this->cond.notify_all(); // the next requests of these sessions became runnable
+                    batch.clear();
+                }
+            }
+
+            void run(std::vector<Request>& batch, long& steps, long& rows) {
+                std::stable_sort(batch.begin(), batch.end(), [](const Request& a, const Request& b) {
+                        return a.frames.size(0) > b.frames.size(0);
+                    });
+                const long n = batch.size();
+                auto state = this->initial_state(n);
+                for (long i = 0; i < n; ++i) {
+                    TList cached;
+                    if (!this->cache.get(batch[i].session, cached)) continue;
+                    for (size_t s = 0; s < state.size(); ++s) state[s][i].copy_(cached[s]);
+                }
+
+                const auto& first = batch[0].frames;
+                std::vector<int64_t> shape = {n};
+                shape.insert(shape.end(), first.sizes().begin() + 1, first.sizes().end());
+                auto frames = first.type().tensor(shape);
+                TList outputs(n);
+                long active = n;
+                for (long t = 0; t < first.size(0); ++t) {
+                    while (batch[active - 1].frames.size(0) <= t) --active;
+                    auto x = frames.narrow(0, 0, active);
+                    for (long i = 0; i < active; ++i) x[i].copy_(batch[i].frames[t]);
+                    TList current;
+                    for (auto&& s: state) current.push_back(s.narrow(0, 0, active));
+                    const auto next = this->step(x, current);
+                    ATNN_ASSERT_EQ(next.size(), state.size());
+                    for (size_t s = 0; s < state.size(); ++s) current[s].copy_(next[s]);
+                    for (long i = 0; i < active; ++i) {
+                        if (t == 0) {
+                            std::vector<int64_t> out_shape = {batch[i].frames.size(0)};
+                            out_shape.insert(out_shape.end(), next[0].sizes().begin() + 1, next[0].sizes().end());
+                            outputs[i] = next[0].type().tensor(out_shape);
+                        }
+                        outputs[i][t].copy_(next[0][i]);
+                    }
+                    ++steps;
+                    rows += active;
+                }
+
+                for (long i = 0; i < n; ++i) {
+                    TList last;
+                    for (auto&& s: state) last.push_back(s[i].clone());
+                    this->cache.put(batch[i].session, last);
+                    batch[i].promise.set_value(outputs[i]);
+                }
+            }
+
+            SessionCache<TList> cache;
+            std::vector<std::thread> workers;
+            std::deque<Request> queue;
+            std::unordered_set<SessionId> running; // sessions in the batches of the workers
+            std::unordered_map<SessionId, long> queued; // requests in the queue per session
+            long runnable_sessions = 0; // sessions in queued but not in running, updated instead of scanning the queue
+            std::mutex mutex;
+            std::condition_variable cond;
+            bool stopped = false;
+            StreamingStats streaming_stats;
+        };
+
+    } // namespace serving
+} // namespace atnn
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <initializer_list>
+#include <iterator>
+#include <vector>
+
+namespace atnn {
+
+/**
+   SmallVector keeps up to N elements inline and moves them to the heap beyond that.
+   it has the subset of the std::vector interface used by the tape (Node, grads).
+*/
+    template <class T, size_t N>
+    struct SmallVector {
+        using value_type = T;
+        using iterator = T*;
+        using const_iterator = const T*;
+
+        SmallVector() {}
+
+        SmallVector(std::initializer_list<T> xs) : SmallVector(xs.begin(), xs.end()) {}
+
+        template <class It>
+        SmallVector(It first, It last) {
+            this->reserve(std::distance(first, last));
+            for (; first != last; ++first) this->push_back(*first);
+        }
+
+        void push_back(T x) {
+            if (!this->spilled && this->n < N) {
+                this->local[this->n++] = std::move(x);
+                return;
+            }
+            if (!this->spilled) this->spill(N + 1);
+            this->heap.push_back(std::move(x));
+        }
+
+        void reserve(size_t k) {
+            if (k <= N) return;
+            if (!this->spilled) this->spill(k);
+            else this->heap.reserve(k);
+        }
+
+        void clear() {
+            std::fill(this->local.begin(), this->local.begin() + this->n, T()); // release the references
+            this->n = 0;
+            this->heap.clear();
+            this->spilled = false;
+        }
+
+        size_t size() const { return this->spilled ? this->heap.size() : this->n; }
+        bool empty() const { return this->size() == 0; }
+
+        T* data() { return this->spilled ? this->heap.data() : this->local.data(); }
+        const T* data() const { return this->spilled ? this->heap.data() : this->local.data(); }
+
+        T& operator[](size_t i) { return this->data()[i]; }
+        const T& operator[](size_t i) const { return this->data()[i]; }
+        T& back() { return this->data()[this->size() - 1]; }
+
+        T* begin() { return this->data(); }
+        T* end() { return this->data() + this->size(); }
+        const T* begin() const { return this->data(); }
+        const T* end() const { return this->data() + this->size(); }
+
+    private:
+        void spill(size_t capacity) {
+            this->heap.reserve(capacity);
+            for (size_t i = 0; i < this->n; ++i) {
+                this->heap.push_back(std::move(this->local[i]));
+                this->local[i] = T();
+            }
+            this->n = 0;
+            this->spilled = true;
+        }
+
+        std::array<T, N> local;
+        size_t n = 0;
+        bool spilled = false;
+        std::vector<T> heap;
+    };
+}
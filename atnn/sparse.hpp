@@ -0,0 +1,14 @@
+/*
+
+  This header defines pruned Linear layers with block sparse weights for CPU training and inference
+
+  - SparseLinear: weight stored as BSR (block sparse rows, CSR for 1x1 blocks), grads of the kept blocks only
+  - prune: magnitude pruning of a trained modules::Linear
+  - kernels: SpMM, transposed SpMM and SDDMM vectorized across the batch (AVX2 / scalar)
+
+ */
+
+#pragma once
+
+#include "sparse/kernels.hpp"
+#include "sparse/modules.hpp"
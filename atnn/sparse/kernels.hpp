@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace atnn {
+    namespace sparse {
+        namespace kernels {
+
+            /// y[i] += a * x[i]
+            inline void axpy(long n, float a, const float* x, float* y) {
+                long i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+                const auto va = _mm256_set1_ps(a);
+                for (; i + 8 <= n; i += 8) {
+                    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+                }
+#endif
+                for (; i < n; ++i) {
+                    y[i] += a * x[i];
+                }
+            }
+
+            /// sum_i x[i] * y[i]
+            inline float dot(long n, const float* x, const float* y) {
+                long i = 0;
+                float acc = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+                auto vacc = _mm256_setzero_ps();
+                for (; i + 8 <= n; i += 8) {
+                    vacc = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), vacc);
+                }
+                auto s = _mm_add_ps(_mm256_castps256_ps128(vacc), _mm256_extractf128_ps(vacc, 1));
+                s = _mm_hadd_ps(s, s);
+                s = _mm_hadd_ps(s, s);
+                acc += _mm_cvtss_f32(s);
+#endif
+                for (; i < n; ++i) {
+                    acc += x[i] * y[i];
+                }
+                return acc;
+            }
+
+/**
+   read-only view of a block sparse row (BSR) matrix of rows x cols with block_rows x block_cols blocks.
+   the blocks of block row i are row_ptr[i] ... row_ptr[i + 1] - 1, at block column col_idx[b],
+   with values[b * block_rows * block_cols ...] in row major. CSR is the 1 x 1 case.
+*/
+            struct BSR {
+                long rows, cols;
+                long block_rows, block_cols;
+                const int64_t* row_ptr;
+                const int64_t* col_idx;
+                const float* values;
+
+                long block_size() const { return this->block_rows * this->block_cols; }
+            };
+
+/**
+   the batch is the innermost (contiguous) dim of the dense operands, i.e., they are transposed activations
+   (features x n). each nonzero is one axpy/dot of length n, vectorized across the batch.
+*/
+
+            /// yt (rows x n) += W xt (cols x n). parallel over block rows
+            inline void spmm(const BSR& w, const float* xt, long n, float* yt) {
+                const long block_rows = w.rows / w.block_rows;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4)
+#endif
+                for (long br = 0; br < block_rows; ++br) {
+                    for (auto b = w.row_ptr[br]; b < w.row_ptr[br + 1]; ++b) {
+                        const auto v = w.values + b * w.block_size();
+                        const auto col = w.col_idx[b] * w.block_cols;
+                        for (long r = 0; r < w.block_rows; ++r) {
+                            for (long c = 0; c < w.block_cols; ++c) {
+                                axpy(n, v[r * w.block_cols + c], xt + (col + c) * n, yt + (br * w.block_rows + r) * n);
+                            }
+                        }
+                    }
+                }
+            }
+
+            /// xt (cols x n) += W^T yt (rows x n). block rows scatter into shared columns,
+            /// so the threads split the batch instead (no atomics, the same sums for any number of threads)
+            inline void spmm_t(const BSR& w, const float* yt, long n, float* xt) {
+                constexpr long slice = 64;
+                const long slices = (n + slice - 1) / slice;
+                const long block_rows = w.rows / w.block_rows;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+                for (long s = 0; s < slices; ++s) {
+                    const long j = s * slice;
+                    const long m = std::min(slice, n - j);
+                    for (long br = 0; br < block_rows; ++br) {
+                        for (auto b = w.row_ptr[br]; b < w.row_ptr[br + 1]; ++b) {
+                            const auto v = w.values + b * w.block_size();
+                            const auto col = w.col_idx[b] * w.block_cols;
+                            for (long r = 0; r < w.block_rows; ++r) {
+                                for (long c = 0; c < w.block_cols; ++c) {
+                                    axpy(m, v[r * w.block_cols + c], yt + (br * w.block_rows + r) * n + j, xt + (col + c) * n + j);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            /// grad_values (the nonzeros of W only) = (yt xt^T) sampled at the blocks of W
+            inline void sddmm(const BSR& w, const float* yt, const float* xt, long n, float* grad_values) {
+                const long block_rows = w.rows / w.block_rows;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4)
+#endif
+                for (long br = 0; br < block_rows; ++br) {
+                    for (auto b = w.row_ptr[br]; b < w.row_ptr[br + 1]; ++b) {
+                        auto g = grad_values + b * w.block_size();
+                        const auto col = w.col_idx[b] * w.block_cols;
+                        for (long r = 0; r < w.block_rows; ++r) {
+                            for (long c = 0; c < w.block_cols; ++c) {
+                                g[r * w.block_cols + c] = dot(n, yt + (br * w.block_rows + r) * n, xt + (col + c) * n);
+                            }
+                        }
+                    }
+                }
+            }
+
+        } // namespace kernels
+    } // namespace sparse
+} // namespace atnn
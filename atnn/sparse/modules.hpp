@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <ATen/ATen.h>
+
+#include "../autograd.hpp"
+#include "../modules.hpp"
+#include "kernels.hpp"
+
+namespace atnn {
+    namespace sparse {
+
+        /// {1, 1}: CSR. e.g., {4, 4} or {8, 1} (8 outputs sharing an input) amortize the indices over a block
+        struct BlockShape {
+            long rows = 1;
+            long cols = 1;
+        };
+
+/**
+   modules::Linear with a block sparse weight (CPU float).
+   only the retained blocks are stored and trained: `values` (blocks, block rows, block cols) is the parameter,
+   and its grad is computed for those blocks only (kernels::sddmm). the pattern is fixed after construction.
+
+   auto sparse = sparse::prune(*linear, 0.9, {4, 4}); // keeps 10% of the 4x4 blocks
+*/
+        struct SparseLinear : atnn::Module<SparseLinear> {
+            using Function = struct {
+                template <typename Context>
+                static auto forward(Context ctx, atnn::TArray<1> xs) {
+                    ATNN_ASSERT_EQ(xs.size(), 1);
+                    auto&& x = xs[0];
+                    ATNN_ASSERT_MSG(x.type().backend() == at::kCPU && x.type().scalarType() == at::kFloat,
+                                    "SparseLinear runs on CPU float tensors");
+                    ATNN_ASSERT_EQ(x.dim(), 2);
+                    ATNN_ASSERT_EQ(x.size(1), ctx->in_features);
+                    const auto n = x.size(0);
+                    auto xt = x.t().contiguous(); // the batch is contiguous in the kernels
+                    ctx->save_for_backward({xt});
+                    auto yt = x.type().tensor({ctx->out_features, n});
+                    if (ctx->bias.data().defined()) yt.copy_(ctx->bias.data().view({ctx->out_features, 1}).expand({ctx->out_features, n}));
+                    else yt.zero_();
+                    kernels::spmm(ctx->bsr(), xt.template data<float>(), n, yt.template data<float>());
+                    return yt.t().contiguous();
+                }
+
+                template <typename Context>
+                static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+                    ATNN_ASSERT_EQ(gy.size(), 1);
+                    auto xt = ctx->saved_tensors[0];
+                    const auto n = xt.size(1);
+                    auto gyt = gy[0].t().contiguous();
+                    const auto w = ctx->bsr();
+                    at::Tensor gx;
+                    if (ctx->needs_input_grad(0)) {
+                        auto gxt = xt.type().zeros({ctx->in_features, n});
+                        kernels::spmm_t(w, gyt.template data<float>(), n, gxt.template data<float>());
+                        gx = gxt.t().contiguous();
+                    }
+                    if (ctx->values.requires_grad()) {
+                        auto grad_values = xt.type().tensor(ctx->values.sizes());
+                        kernels::sddmm(w, gyt.template data<float>(), xt.template data<float>(), n, grad_values.template data<float>());
+                        atnn::accumulate_grad(ctx->values, grad_values);
+                    }
+                    if (ctx->bias.data().defined() && ctx->bias.requires_grad()) {
+                        atnn::accumulate_grad(ctx->bias, gy[0].sum(0));
+                    }
+                    return {gx};
+                }
+            };
+
+            Variable values, bias;
+            at::Tensor row_ptr, col_idx; // CPU kLong
+            long in_features, out_features;
+            BlockShape block;
+
+            /// keeps the blocks of weight (out, in) with any nonzero
+            SparseLinear(at::Tensor weight, at::Tensor bias, BlockShape block={})
+                : SparseLinear(weight, bias, block, nonzero_blocks(weight, block)) {}
+
+            /// keeps the blocks of weight (out, in) with keep[block row * (in / block cols) + block col]
+            SparseLinear(at::Tensor weight, at::Tensor bias, BlockShape block, const std::vector<bool>& keep)
+                : in_features(weight.size(1)), out_features(weight.size(0)), block(block) {
+                const auto w = dense_blocks(weight, block);
+                const long block_rows = this->out_features / block.rows;
+                const long block_cols = this->in_features / block.cols;
+                ATNN_ASSERT_EQ(static_cast<long>(keep.size()), block_rows * block_cols);
+                const long nnz = std::count(keep.begin(), keep.end(), true);
+                this->row_ptr = CPU(at::kLong).tensor({block_rows + 1});
+                this->col_idx = CPU(at::kLong).tensor({std::max(nnz, 1L)});
+                auto values = CPU(at::kFloat).tensor({std::max(nnz, 1L), block.rows, block.cols});
+                auto rp = this->row_ptr.data<int64_t>();
+                auto ci = this->col_idx.data<int64_t>();
+                auto v = values.data<float>();
+                const auto src = w.data<float>();
+                long b = 0;
+                for (long br = 0; br < block_rows; ++br) {
+                    rp[br] = b;
+                    for (long bc = 0; bc < block_cols; ++bc) {
+                        if (!keep[br * block_cols + bc]) continue;
+                        ci[b] = bc;
+                        for (long r = 0; r < block.rows; ++r) {
+                            for (long c = 0; c < block.cols; ++c) {
+                                *v++ = src[(br * block.rows + r) * this->in_features + bc * block.cols + c];
+                            }
+                        }
+                        ++b;
+                    }
+                }
+                rp[block_rows] = b;
+                if (nnz == 0) values.zero_(); // an unused block: ATen has no zero-sized tensors
+                this->values = Variable(values);
+                this->bias = Variable(bias.defined() ? bias.toBackend(at::kCPU).clone() : at::Tensor{});
+                this->parameters = {this->values};
+                if (bias.defined()) this->parameters.push_back(this->bias);
+            }
+
+            kernels::BSR bsr() const {
+                return {this->out_features, this->in_features, this->block.rows, this->block.cols,
+                        this->row_ptr.data<int64_t>(), this->col_idx.data<int64_t>(), this->values.data().data<float>()};
+            }
+
+            /// scatters blocks (e.g., values or its grad) into a dense (out, in) matrix
+            at::Tensor to_dense(const at::Tensor& blocks) const {
+                auto dense = CPU(at::kFloat).zeros({this->out_features, this->in_features});
+                const auto src = blocks.contiguous();
+                const auto v = src.data<float>();
+                auto d = dense.data<float>();
+                const auto rp = this->row_ptr.data<int64_t>();
+                const auto ci = this->col_idx.data<int64_t>();
+                const auto size = this->block.rows * this->block.cols;
+                for (long br = 0; br < this->out_features / this->block.rows; ++br) {
+                    for (auto b = rp[br]; b < rp[br + 1]; ++b) {
+                        for (long r = 0; r < this->block.rows; ++r) {
+                            for (long c = 0; c < this->block.cols; ++c) {
+                                d[(br * this->block.rows + r) * this->in_features + ci[b] * this->block.cols + c] = v[b * size + r * this->block.cols + c];
+                            }
+                        }
+                    }
+                }
+                return dense;
+            }
+
+            at::Tensor dense_weight() const { return this->to_dense(this->values.data()); }
+
+            /// stored weights / dense weights
+            double density() const {
+                const auto blocks = this->row_ptr.data<int64_t>()[this->row_ptr.numel() - 1];
+                return static_cast<double>(blocks * this->block.rows * this->block.cols) / (this->out_features * this->in_features);
+            }
+
+            size_t nbytes() const {
+                return this->values.data().numel() * sizeof(float) + (this->row_ptr.numel() + this->col_idx.numel()) * sizeof(int64_t)
+                    + (this->bias.data().defined() ? this->bias.data().numel() * sizeof(float) : 0);
+            }
+
+            void toBackend(at::Backend b) override {
+                ATNN_ASSERT_MSG(b == at::kCPU, "SparseLinear runs on CPU");
+            }
+
+        private:
+            static at::Tensor dense_blocks(const at::Tensor& weight, BlockShape block) {
+                ATNN_ASSERT_EQ(weight.dim(), 2);
+                ATNN_ASSERT_MSG(weight.size(0) % block.rows == 0 && weight.size(1) % block.cols == 0,
+                                "the weight is not divisible into the blocks");
+                return weight.toBackend(at::kCPU).contiguous();
+            }
+
+            static std::vector<bool> nonzero_blocks(const at::Tensor& weight, BlockShape block) {
+                const auto w = dense_blocks(weight, block);
+                const long in = w.size(1);
+                const long block_cols = in / block.cols;
+                std::vector<bool> keep((w.size(0) / block.rows) * block_cols, false);
+                const auto src = w.data<float>();
+                for (long i = 0; i < w.size(0); ++i) {
+                    for (long j = 0; j < in; ++j) {
+                        if (src[i * in + j] != 0) keep[(i / block.rows) * block_cols + j / block.cols] = true;
+                    }
+                }
+                return keep;
+            }
+        };
+
+/**
+   magnitude pruning of a trained dense Linear: keeps the round((1 - sparsity) * blocks) blocks of the largest L1 norms.
+   the result starts from the same weights (restricted to the kept blocks) and bias.
+*/
+        inline std::shared_ptr<SparseLinear> prune(const modules::Linear& linear, double sparsity, BlockShape block={}) {
+            ATNN_ASSERT(0 <= sparsity && sparsity <= 1);
+            const auto w = linear.weight.data().toBackend(at::kCPU).contiguous();
+            const long out = w.size(0), in = w.size(1);
+            ATNN_ASSERT_MSG(out % block.rows == 0 && in % block.cols == 0, "the weight is not divisible into the blocks");
+            const long block_cols = in / block.cols;
+            std::vector<float> norms((out / block.rows) * block_cols, 0.0f);
+            const auto src = w.data<float>();
+            for (long i = 0; i < out; ++i) {
+                for (long j = 0; j < in; ++j) {
+                    norms[(i / block.rows) * block_cols + j / block.cols] += std::abs(src[i * in + j]);
+                }
+            }
+            const auto kept = static_cast<long>(std::lround((1 - sparsity) * norms.size()));
+            std::vector<long> order(norms.size());
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            std::nth_element(order.begin(), order.begin() + std::min<long>(kept, order.size() - 1), order.end(),
+                             [&](long a, long b) { return norms[a] > norms[b]; });
+            std::vector<bool> keep(norms.size(), false);
+            for (long i = 0; i < kept; ++i) keep[order[i]] = true;
+            return std::make_shared<SparseLinear>(w, linear.bias.data(), block, keep);
+        }
+
+    } // namespace sparse
+} // namespace atnn
@@ -0,0 +1,110 @@
+/*
+
+  This header defines the control of the threads running modules
+
+  - set_num_threads: process-wide intra-op threads of the ATen/TH ops (OpenMP)
+  - set_thread_budget: intra-op threads of one module during its forward/backward (ModuleBase::num_threads)
+  - pin_current_thread: binds a thread (and the OpenMP threads it starts) to cores
+
+  e.g., two models on one host without oversubscription:
+
+  threading::set_thread_budget(small, 1);
+  threading::set_thread_budget(big, n - 1);
+  std::thread([&] { threading::pin_current_thread({0}); serve(small); });
+  std::thread([&] { threading::pin_current_thread(threading::core_range(1, n)); serve(big); });
+
+ */
+
+#pragma once
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "autograd.hpp"
+
+namespace atnn {
+    namespace threading {
+
+        /// applies to every thread at its outermost module call, and to the calling thread at once
+        inline void set_num_threads(int n) {
+            IntraOp::threads() = n;
+#ifdef _OPENMP
+            if (n > 0) omp_set_num_threads(n);
+#endif
+        }
+
+        /// the intra-op threads of the calling thread
+        inline int num_threads() {
+#ifdef _OPENMP
+            return omp_get_max_threads();
+#else
+            return 1;
+#endif
+        }
+
+        /// n <= 0 lets the module inherit the count of its caller
+        inline void set_thread_budget(ModuleBase& module, int n) {
+            module.num_threads = n;
+        }
+
+        inline void set_thread_budget(const ModulePtr& module, int n) {
+            set_thread_budget(*module, n);
+        }
+
+        /// the cores [begin, end)
+        inline std::vector<int> core_range(int begin, int end) {
+            std::vector<int> cores;
+            for (int c = begin; c < end; ++c) cores.push_back(c);
+            return cores;
+        }
+
+        inline int num_cores() {
+            return std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        /// threads started later by this thread (e.g., its OpenMP team) inherit the cores. empty: no-op
+        inline void pin_current_thread(const std::vector<int>& cores) {
+#ifdef __linux__
+            if (cores.empty()) return;
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (auto c: cores) {
+                if (c < 0 || c >= CPU_SETSIZE) throw_with_trace(std::runtime_error("core id out of range: " + std::to_string(c)));
+                CPU_SET(c, &set);
+            }
+            if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+                throw_with_trace(std::runtime_error("cannot pin the thread to the cores"));
+            }
+#else
+            (void) cores;
+#endif
+        }
+
+        /// the cores the calling thread may run on
+        inline std::vector<int> current_cores() {
+            std::vector<int> cores;
+#ifdef __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+                for (int c = 0; c < CPU_SETSIZE; ++c) {
+                    if (CPU_ISSET(c, &set)) cores.push_back(c);
+                }
+            }
+#endif
+            return cores;
+        }
+
+    } // namespace threading
+} // namespace atnn
@@ -0,0 +1,63 @@
+#include <chrono>
+
+#include <atnn/atnn.hpp>
+#include <atnn/allocator.hpp>
+
+namespace M = atnn::modules;
+namespace A = atnn::alloc;
+
+template <typename F>
+double per_call(F f, int n=20) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+/// training steps of a small CNN and of an MLP with the default allocator vs the caching allocator
+int main() {
+    auto conv1 = std::make_shared<M::Conv2d>(3, 32, at::IntList {3, 3}, at::IntList {1, 1}, at::IntList {1, 1});
+    auto conv2 = std::make_shared<M::Conv2d>(32, 32, at::IntList {3, 3}, at::IntList {2, 2}, at::IntList {1, 1});
+    auto relu = std::make_shared<M::ReLU>();
+    auto fc = std::make_shared<M::Linear>(32 * 16 * 16, 10);
+    auto l1 = std::make_shared<M::Linear>(1024, 1024);
+    auto l2 = std::make_shared<M::Linear>(1024, 1024);
+    auto l3 = std::make_shared<M::Linear>(1024, 10);
+    auto clear = [](std::vector<atnn::ModulePtr> ms) {
+        for (auto&& m: ms) m->for_each_module([](atnn::ModuleBase&, atnn::VList& ps) { for (auto p: ps) p.clear_grads(); });
+    };
+
+    const long batch = 64;
+    auto image = CPU(at::kFloat).randn({batch, 3, 32, 32});
+    auto features = CPU(at::kFloat).randn({batch, 1024});
+    auto gy = CPU(at::kFloat).randn({batch, 10});
+    auto cnn = [&] {
+        clear({conv1, conv2, fc});
+        auto h = relu->forward(conv2->forward(relu->forward(conv1->forward(atnn::Variable(image, false)))));
+        fc->forward(atnn::Variable(h.data().view({batch, -1}), false)).backward(gy);
+        h.backward(gy.mm(fc->weight.data()).view(h.data().sizes()));
+    };
+    auto mlp = [&] {
+        clear({l1, l2, l3});
+        l3->forward(relu->forward(l2->forward(relu->forward(l1->forward(atnn::Variable(features, false)))))).backward(gy);
+    };
+
+    std::cout << "model, default [ms], caching [ms], speedup, hit rate, peak [MiB]" << std::endl;
+    for (auto&& model: {std::make_pair("cnn", std::function<void()>(cnn)), std::make_pair("mlp", std::function<void()>(mlp))}) {
+        double base, cached;
+        {
+            A::CachingAllocatorGuard guard(false);
+            base = per_call(model.second);
+        }
+        {
+            A::CachingAllocatorGuard guard;
+            A::reset_stats();
+            cached = per_call(model.second);
+        }
+        const auto s = A::stats();
+        std::cout << model.first << ", " << 1e3 * base << ", " << 1e3 * cached << ", " << base / cached << ", "
+                  << s.hit_rate() << ", " << s.peak_bytes / double(1 << 20) << std::endl;
+        A::empty_cache();
+    }
+}
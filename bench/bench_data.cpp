@@ -0,0 +1,61 @@
+#include <chrono>
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/data.hpp>
+
+namespace D = atnn::data;
+
+// synthetic MNIST-like stream
+struct RandomSource : D::Source {
+    long n, index = 0;
+    explicit RandomSource(long n) : n(n) {}
+
+    bool next(atnn::TList& sample) override {
+        if (this->index++ >= this->n) return false;
+        sample = {CPU(at::kByte).zeros({28, 28}), CPU(at::kLong).zeros({1})};
+        return true;
+    }
+
+    void reset() override { this->index = 0; }
+};
+
+template <typename F>
+double elapsed(F f) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+}
+
+int main() {
+    const long nsamples = 4096;
+    const auto decode_cost = std::chrono::microseconds(200);
+    auto w = CPU(at::kFloat).randn({28 * 28, 1024});
+
+    std::cout << "workers, prefetch, total [sec], stall [sec], stall ratio" << std::endl;
+    for (size_t workers: {0, 1, 2, 4, 8}) {
+        for (size_t prefetch: {1, 4}) {
+            D::LoaderOptions options;
+            options.batch_size = 64;
+            options.num_workers = workers;
+            options.prefetch = prefetch;
+            D::DataLoader loader(std::make_shared<RandomSource>(nsamples), options);
+            loader.add_transform([=](atnn::TList s) {
+                std::this_thread::sleep_for(decode_cost); // emulates jpeg decode / augmentation
+                return atnn::TList {s[0].toType(at::kFloat) / 255.0, s[1]};
+            });
+
+            auto total = elapsed([&] {
+                atnn::TList batch;
+                while (loader.next(batch)) {
+                    // emulates forward/backward
+                    auto h = batch[0].view({batch[0].size(0), -1}).mm(w);
+                    h.t().mm(h);
+                }
+            });
+            auto stall = loader.stats().stall_seconds;
+            std::cout << workers << ", " << prefetch << ", " << total << ", " << stall << ", " << stall / total << std::endl;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#include <chrono>
+
+#include <atnn/atnn.hpp>
+#include <atnn/ensemble.hpp>
+
+namespace M = atnn::modules;
+namespace E = atnn::ensemble;
+
+template <typename F>
+double per_call(F f, int n=20) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+/// forward and backward of E small MLPs (64-64-64-10) one after another vs stacked into an Ensemble
+int main() {
+    const long batch = 32;
+    auto x = CPU(at::kFloat).randn({batch, 64});
+    std::cout << "members, sequential [ms], ensemble [ms], speedup" << std::endl;
+    for (long size: {4, 16, 64}) {
+        std::vector<atnn::ModulePtr> members;
+        for (long e = 0; e < size; ++e) {
+            auto net = std::make_shared<atnn::ModuleSet>();
+            net->modules = {std::make_shared<M::Linear>(64, 64), std::make_shared<M::ReLU>(),
+                            std::make_shared<M::Linear>(64, 64), std::make_shared<M::ReLU>(),
+                            std::make_shared<M::Linear>(64, 10)};
+            members.push_back(net);
+        }
+        auto ensemble = std::make_shared<E::Ensemble>(members);
+        auto gy = CPU(at::kFloat).randn({batch, 10});
+        auto sequential = per_call([&] {
+                for (auto&& m: members) {
+                    atnn::Variable y(x, false);
+                    for (auto&& layer: std::static_pointer_cast<atnn::ModuleSet>(m)->modules) y = layer->forward_unary(y);
+                    y.backward(gy);
+                }
+            });
+        auto stacked_gy = CPU(at::kFloat).randn({size, batch, 10});
+        auto stacked = per_call([&] {
+                auto y = ensemble->forward(atnn::Variable(x, false));
+                y.backward(stacked_gy);
+            });
+        std::cout << size << ", " << 1e3 * sequential << ", " << 1e3 * stacked << ", " << sequential / stacked << std::endl;
+    }
+}
@@ -0,0 +1,61 @@
+#include <chrono>
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/pipeline.hpp>
+
+namespace M = atnn::modules;
+namespace P = atnn::pipeline;
+
+template <typename F>
+double per_call(F f, int n=5) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+int main() {
+    // a deep MLP split into equal stages
+    const long batch = 512, width = 1024, depth = 16;
+    const int cores = std::max(1u, std::thread::hardware_concurrency());
+    auto net = std::make_shared<atnn::ModuleSet>();
+    for (long i = 0; i < depth; ++i) {
+        net->modules.push_back(std::make_shared<M::Linear>(width, width));
+        net->modules.push_back(std::make_shared<M::Tanh>());
+    }
+    auto x = CPU(at::kFloat).randn({batch, width});
+    auto gy = CPU(at::kFloat).randn({batch, width});
+
+    std::cout << "mode, stages, threads/stage, micro-batches, step [ms], samples/s, speedup" << std::endl;
+    atnn::threading::set_num_threads(cores);
+    const auto t0 = per_call([&] {
+            auto y = atnn::Variable(x);
+            for (auto&& m: net->modules) y = m->forward_unary(y);
+            y.backward(gy);
+        });
+    std::cout << "single stream, 1, " << cores << ", 1, " << 1e3 * t0 << ", " << batch / t0 << ", 1" << std::endl;
+
+    for (int stages: {2, 4, 8}) {
+        if (stages > cores || 2 * depth % stages != 0) continue;
+        for (long micro_batches: {long(stages), 2L * stages, 4L * stages}) {
+            for (auto schedule: {P::Schedule::GPipe, P::Schedule::OneFOneB}) {
+                P::PipelineOptions options;
+                options.micro_batches = micro_batches;
+                options.schedule = schedule;
+                const int per_stage = cores / stages;
+                for (int s = 0; s < stages; ++s) {
+                    options.cores.emplace_back();
+                    for (int c = 0; c < per_stage; ++c) options.cores.back().push_back(s * per_stage + c);
+                }
+                P::Pipeline pipe(net, std::vector<size_t>(stages, 2 * depth / stages), options);
+                const auto t = per_call([&] {
+                        pipe.train_step(x, [&](at::Tensor y, long i) { return gy.narrow(0, i * (batch / micro_batches), y.size(0)); });
+                    });
+                std::cout << (schedule == P::Schedule::GPipe ? "gpipe, " : "1f1b, ") << stages << ", " << per_stage << ", "
+                          << micro_batches << ", " << 1e3 * t << ", " << batch / t << ", " << t0 / t << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#include <chrono>
+
+#include <atnn/atnn.hpp>
+#include <atnn/quantize.hpp>
+
+namespace M = atnn::modules;
+namespace Q = atnn::quantize;
+
+template <typename F>
+double per_call(F f, int n=50) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+int main() {
+    std::cout << "module, batch, float [ms], int8 [ms], speedup, float weight [KB], int8 weight [KB]" << std::endl;
+    for (long batch: {1, 16, 128}) {
+        auto linear = std::make_shared<M::Linear>(1024, 1024);
+        Q::RangeObserver range;
+        auto x = CPU(at::kFloat).randn({batch, 1024});
+        range.observe(x);
+        Q::QuantizedLinear q(*linear, range.qparams());
+        auto tf = per_call([&] { linear->predict(x); });
+        auto tq = per_call([&] { q.predict(x); });
+        std::cout << "Linear(1024, 1024), " << batch << ", " << 1e3 * tf << ", " << 1e3 * tq << ", " << tf / tq << ", "
+                  << linear->weight.data().numel() * 4 / 1024 << ", " << q.nbytes() / 1024 << std::endl;
+    }
+    for (long batch: {1, 16}) {
+        auto conv2d = std::make_shared<M::Conv2d>(64, 64, at::IntList {3, 3}, at::IntList {1, 1}, at::IntList {1, 1});
+        Q::RangeObserver range;
+        auto x = CPU(at::kFloat).randn({batch, 64, 32, 32});
+        range.observe(x);
+        Q::QuantizedConv2d q(*conv2d, range.qparams());
+        auto tf = per_call([&] { conv2d->predict(x); }, 10);
+        auto tq = per_call([&] { q.predict(x); }, 10);
+        std::cout << "Conv2d(64, 64, 3x3), " << batch << ", " << 1e3 * tf << ", " << 1e3 * tq << ", " << tf / tq << ", "
+                  << conv2d->weight.data().numel() * 4 / 1024 << ", " << q.nbytes() / 1024 << std::endl;
+    }
+}
@@ -0,0 +1,54 @@
+#include <chrono>
+
+#include <atnn/atnn.hpp>
+#include <atnn/saved.hpp>
+
+namespace M = atnn::modules;
+namespace S = atnn::saved;
+
+template <typename F>
+double per_call(F f, int n=10) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+int main() {
+    // an MLP whose saved tensors are mostly ReLU outputs
+    const long batch = 256, width = 2048, depth = 6;
+    std::vector<std::shared_ptr<M::Linear>> linears;
+    for (long i = 0; i < depth; ++i) linears.push_back(std::make_shared<M::Linear>(width, width));
+    auto relu = std::make_shared<M::ReLU>();
+    auto x = CPU(at::kFloat).randn({batch, width});
+    auto gy = CPU(at::kFloat).randn({batch, width});
+    auto step = [&] {
+        atnn::Variable h(x, false);
+        for (auto&& l: linears) h = relu->forward(l->forward(h));
+        h.clear_grads();
+        h.backward(gy);
+    };
+
+    const auto t0 = per_call(step);
+    std::cout << "policy, step [ms], overhead, packed [MB/step], stored [MB/step], saved, pack [ms/step], unpack [ms/step], io wait [ms/step]" << std::endl;
+    std::cout << "none, " << 1e3 * t0 << ", 1, 0, 0, 0, 0, 0, 0" << std::endl;
+    auto report = [&](const std::string& name, std::shared_ptr<S::Policy> policy) {
+        atnn::SavedTensorPolicyGuard guard(policy);
+        step(); // warm up
+        policy->reset_stats();
+        const int n = 10;
+        const auto t = per_call(step, n);
+        const auto s = policy->stats();
+        const double steps = n + 1; // per_call warms up once more
+        std::cout << name << ", " << 1e3 * t << ", " << t / t0 << ", "
+                  << s.raw_bytes / steps / 1e6 << ", " << s.stored_bytes / steps / 1e6 << ", "
+                  << 1.0 - double(s.stored_bytes) / s.raw_bytes << ", "
+                  << 1e3 * s.pack_seconds / steps << ", " << 1e3 * s.unpack_seconds / steps << ", "
+                  << 1e3 * s.wait_seconds / steps << std::endl;
+    };
+    report("bf16", std::make_shared<S::HalfPolicy>(S::HalfPolicy::BF16));
+    report("fp16", std::make_shared<S::HalfPolicy>(S::HalfPolicy::FP16));
+    report("sparse", std::make_shared<S::SparsePolicy>());
+    report("spill", std::make_shared<S::SpillPolicy>("/tmp"));
+}
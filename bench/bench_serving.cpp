@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/serving.hpp>
+
+namespace M = atnn::modules;
+using Clock = std::chrono::steady_clock;
+
+// closed-loop clients: each sends a request and waits for its result before sending the next one
+void run(long max_batch, int clients, std::function<at::Tensor(at::Tensor)> forward) {
+    atnn::serving::BatchingOptions options;
+    options.max_batch = max_batch;
+    options.max_latency = std::chrono::microseconds(500);
+    atnn::serving::BatchingServer server(forward, options);
+
+    const auto duration = std::chrono::seconds(2);
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    const auto start_time = Clock::now();
+    for (int c = 0; c < clients; ++c) {
+        threads.emplace_back([&, c] {
+            auto x = CPU(at::kFloat).randn({256});
+            while (Clock::now() - start_time < duration) {
+                auto t0 = Clock::now();
+                server.submit(x).get();
+                latencies[c].push_back(1e-3 * std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+            }
+        });
+    }
+    for (auto& t: threads) t.join();
+    const auto elapsed = 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time).count();
+
+    std::vector<double> all;
+    for (auto&& l: latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) { return all[std::min(all.size() - 1, size_t(p * all.size()))]; };
+    std::cout << max_batch << ", " << clients << ", " << all.size() / elapsed << ", "
+              << server.stats().mean_batch_size() << ", "
+              << percentile(0.5) << ", " << percentile(0.9) << ", " << percentile(0.99) << std::endl;
+}
+
+int main() {
+    auto l1 = std::make_shared<M::Linear>(256, 1024);
+    auto relu = std::make_shared<M::ReLU>();
+    auto l2 = std::make_shared<M::Linear>(1024, 10);
+    auto forward = [=](at::Tensor x) { return l2->predict(relu->predict(l1->predict(x))); };
+
+    std::cout << "max_batch, clients, throughput [req/sec], mean batch, p50 [ms], p90 [ms], p99 [ms]" << std::endl;
+    for (int clients: {1, 4, 16, 64}) {
+        for (long max_batch: {1, 8, 32, 64}) {
+            run(max_batch, clients, forward);
+        }
+    }
+}
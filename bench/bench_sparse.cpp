@@ -0,0 +1,45 @@
+#include <chrono>
+
+#include <atnn/atnn.hpp>
+#include <atnn/sparse.hpp>
+
+namespace M = atnn::modules;
+namespace S = atnn::sparse;
+
+template <typename F>
+double per_call(F f, int n=20) {
+    f(); // warm up
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < n; ++i) f();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    return 1e-9 * std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count() / n;
+}
+
+/// forward and backward of Linear(1024, 1024) vs its pruned versions
+int main() {
+    const long batch = 64;
+    auto linear = std::make_shared<M::Linear>(1024, 1024);
+    auto x = CPU(at::kFloat).randn({batch, 1024});
+    auto gy = CPU(at::kFloat).randn({batch, 1024});
+    auto step = [&](atnn::ModuleBase& m) {
+        return [&] {
+            atnn::Variable xv(x);
+            auto y = m.forward_unary(xv);
+            y.clear_grads();
+            y.backward(gy);
+        };
+    };
+    auto tf = per_call([&] { linear->predict(x); });
+    auto tb = per_call(step(*linear));
+    std::cout << "block, sparsity, forward [ms], dense [ms], speedup, forward+backward [ms], dense [ms], speedup, weight [KB]" << std::endl;
+    for (S::BlockShape block: {S::BlockShape {1, 1}, S::BlockShape {4, 4}, S::BlockShape {8, 1}}) {
+        for (double sparsity: {0.5, 0.8, 0.9, 0.95, 0.99}) {
+            auto sparse = S::prune(*linear, sparsity, block);
+            auto sf = per_call([&] { sparse->predict(x); });
+            auto sb = per_call(step(*sparse));
+            std::cout << block.rows << "x" << block.cols << ", " << sparsity << ", "
+                      << 1e3 * sf << ", " << 1e3 * tf << ", " << tf / sf << ", "
+                      << 1e3 * sb << ", " << 1e3 * tb << ", " << tb / sb << ", " << sparse->nbytes() / 1024 << std::endl;
+        }
+    }
+}
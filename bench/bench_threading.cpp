@@ -0,0 +1,71 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/threading.hpp>
+
+namespace M = atnn::modules;
+namespace T = atnn::threading;
+
+struct Workload {
+    std::shared_ptr<M::Linear> linear;
+    at::Tensor x;
+    std::vector<int> cores; // empty: not pinned
+    long calls = 0;
+};
+
+// a small and a big model served concurrently for `seconds`
+void run(Workload& small, Workload& big, double seconds) {
+    std::atomic<bool> stop{false};
+    auto serve = [&](Workload& w) {
+        T::pin_current_thread(w.cores);
+        while (!stop) {
+            w.linear->predict(w.x);
+            ++w.calls;
+        }
+    };
+    small.calls = big.calls = 0;
+    std::thread a(serve, std::ref(small)), b(serve, std::ref(big));
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    a.join();
+    b.join();
+}
+
+int main() {
+    const int cores = T::num_cores();
+    const double seconds = 3;
+    Workload small{std::make_shared<M::Linear>(128, 128), CPU(at::kFloat).randn({16, 128}), {}};
+    Workload big{std::make_shared<M::Linear>(2048, 2048), CPU(at::kFloat).randn({256, 2048}), {}};
+
+    std::cout << "config, small [calls/s], big [calls/s]" << std::endl;
+    auto report = [&](const std::string& name) {
+        run(small, big, seconds);
+        std::cout << name << ", " << small.calls / seconds << ", " << big.calls / seconds << std::endl;
+    };
+
+    T::set_num_threads(cores);
+    report("all threads for both"); // oversubscribed: 2x cores OpenMP threads
+
+    T::set_thread_budget(small.linear, 1);
+    T::set_thread_budget(big.linear, std::max(1, cores - 1));
+    report("budgets 1 + " + std::to_string(std::max(1, cores - 1)));
+
+    if (cores > 1) {
+        small.cores = {0};
+        big.cores = T::core_range(1, cores);
+        report("budgets + pinning");
+    }
+
+    // alone, for reference
+    small.cores = big.cores = {};
+    T::set_thread_budget(big.linear, cores);
+    std::atomic<bool> stop{false};
+    big.calls = 0;
+    std::thread b([&] { while (!stop) { big.linear->predict(big.x); ++big.calls; } });
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    b.join();
+    std::cout << "big alone, 0, " << big.calls / seconds << std::endl;
+}
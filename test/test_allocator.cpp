@@ -0,0 +1,85 @@
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/allocator.hpp>
+
+namespace M = atnn::modules;
+namespace A = atnn::alloc;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // the caching allocator serves CPU tensors only
+
+        // size classes: 4 per power of two, each size maps back to its own class
+        for (size_t n = 1; !A::detail::is_huge(n); n += 997) {
+            const auto bin = A::detail::bin_of(n);
+            ATNN_ASSERT(bin < A::detail::num_bins);
+            ATNN_ASSERT(A::detail::bin_size(bin) >= n);
+            if (bin > 0) ATNN_ASSERT(A::detail::bin_size(bin - 1) < n);
+            ATNN_ASSERT_EQ(A::detail::bin_of(A::detail::bin_size(bin)), bin);
+        }
+
+        A::empty_cache();
+        A::reset_stats();
+        {
+            A::CachingAllocatorGuard guard(false);
+            auto t = A::zeros(CPU(at::kFloat), {10, 10});
+            ATNN_ASSERT_EQ(t.numel(), 100);
+            ATNN_ASSERT_EQ(A::stats().live_bytes, 0); // the default allocator
+        }
+
+        A::CachingAllocatorGuard guard;
+        {
+            auto t = A::zeros(CPU(at::kFloat), {10, 10});
+            ATNN_ASSERT(atnn::allclose(t, CPU(at::kFloat).zeros({10, 10})));
+            ATNN_ASSERT_EQ(A::stats().live_bytes, A::detail::bin_size(A::detail::bin_of(400)));
+            auto huge = A::empty(CPU(at::kFloat), {1 << 20}); // 4 MiB
+            huge.fill_(1);
+            ATNN_ASSERT_EQ(at::Scalar(huge.sum()).toDouble(), 1 << 20);
+        }
+        auto s = A::stats();
+        ATNN_ASSERT_EQ(s.live_bytes, 0);
+        ATNN_ASSERT(s.cached_bytes >= (size_t(4) << 20));
+        ATNN_ASSERT_EQ(s.peak_bytes, s.cached_bytes);
+        ATNN_ASSERT_EQ(s.misses, 2);
+        {
+            auto t = A::clone(CPU(at::kFloat).ones({10, 10}));
+            auto huge = A::empty(CPU(at::kFloat), {1 << 20});
+            ATNN_ASSERT(huge.is_contiguous());
+            ATNN_ASSERT_EQ(A::stats().hits, 2);
+            ATNN_ASSERT_EQ(at::Scalar(t.sum()).toDouble(), 100);
+        }
+
+        // the same grads with and without the cache. the second step reuses the blocks of the first
+        auto conv = std::make_shared<M::Conv2d>(2, 4, at::IntList {3, 3});
+        auto linear = std::make_shared<M::Linear>(36, 3);
+        auto x = CPU(at::kFloat).randn({5, 2, 5, 5});
+        auto gy = CPU(at::kFloat).randn({5, 3});
+        auto step = [&] {
+            for (auto p: conv->parameters) p.clear_grads();
+            for (auto p: linear->parameters) p.clear_grads();
+            atnn::Variable v(x);
+            auto h = conv->forward(v);
+            linear->forward(atnn::Variable(h.data().view({5, 36}), false)).backward(gy);
+            h.backward(gy.mm(linear->weight.data()).view({5, 4, 3, 3}));
+            return atnn::TList {v.grad().clone(), conv->weight.grad().clone(), linear->weight.grad().clone()};
+        };
+        atnn::TList expected;
+        {
+            A::CachingAllocatorGuard off(false);
+            expected = step();
+        }
+        step();
+        A::reset_stats();
+        auto actual = step();
+        for (size_t i = 0; i < actual.size(); ++i) ATNN_ASSERT(atnn::allclose(actual[i], expected[i], 1e-5, 1e-6));
+        ATNN_ASSERT(A::stats().hits > 0);
+        ATNN_ASSERT(A::stats().hit_rate() > 0.5);
+
+        // a tensor freed by another thread goes to its cache, then to the shared pool when it exits
+        auto shared = A::empty(CPU(at::kFloat), {64});
+        std::thread([&] { shared = at::Tensor(); }).join();
+        A::empty_cache();
+        ATNN_ASSERT_EQ(A::stats().cached_bytes, 0);
+    });
+}
@@ -0,0 +1,67 @@
+#include <limits>
+
+#include <atnn/atnn.hpp>
+#include <atnn/amp.hpp>
+
+namespace M = atnn::modules;
+namespace A = atnn::amp;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // bf16 rounding is implemented for CPU tensors
+
+        auto x = device(at::kFloat).randn({16, 8});
+        auto xr = A::round_bf16(x);
+        ATNN_ASSERT(atnn::allclose(A::round_bf16(xr), xr)); // idempotent
+        ATNN_ASSERT(atnn::allclose(xr, x, 1e-2, 1e-6));
+
+        // Linear is in the default allow-list, Tanh is not
+        auto l0 = std::make_shared<M::Linear>(8, 32);
+        auto tanh = std::make_shared<M::Tanh>();
+        auto l1 = std::make_shared<M::Linear>(32, 1);
+        auto net = std::make_shared<atnn::ModuleSet>();
+        net->modules = {l0, tanh, l1};
+        A::MixedPrecision mp(net);
+        ATNN_ASSERT_EQ(mp.parameters.size(), 4);
+        ATNN_ASSERT(atnn::allclose(l0->weight.data(), A::round_bf16(mp.masters[0])));
+        {
+            atnn::AutocastGuard guard(mp.autocast);
+            auto expected = xr.mm(l0->weight.data().t()) + l0->bias.data().expand({16, 32});
+            ATNN_ASSERT(atnn::allclose(l0->forward(atnn::Variable(x)).data(), expected, 1e-6));
+            ATNN_ASSERT(atnn::allclose(tanh->forward(atnn::Variable(x)).data(), x.tanh(), 1e-6));
+        }
+
+        // the loss decreases with scaled grads and fp32 master weights
+        auto mse = std::make_shared<M::MSELoss>();
+        auto target = x.sum(1).view({16, 1}).tanh();
+        auto train_step = [&] {
+            atnn::Variable loss;
+            {
+                A::MixedPrecisionGuard guard(mp);
+                loss = mse->forward(l1->forward(tanh->forward(l0->forward(atnn::Variable(x)))), target);
+                loss.clear_grads();
+                loss.backward(device(at::kFloat).ones({1}));
+            }
+            mp.step([](at::Tensor w, at::Tensor g) { w -= 0.1 * g; });
+            return at::Scalar(loss.data().sum()).toDouble();
+        };
+        const auto first = train_step();
+        double last = first;
+        for (int i = 0; i < 50; ++i) last = train_step();
+        ATNN_ASSERT(last < first);
+        ATNN_ASSERT_EQ(mp.scaler.skipped_steps, 0);
+
+        // overflowing grads skip the step and back off the scale
+        const auto w = l0->weight.data().clone();
+        mp.scaler.scale = std::numeric_limits<float>::infinity();
+        train_step();
+        ATNN_ASSERT_EQ(mp.scaler.skipped_steps, 1);
+        ATNN_ASSERT(atnn::allclose(l0->weight.data(), w));
+        A::LossScaler scaler({1024, 2, 0.5, 2});
+        scaler.update(false);
+        ATNN_ASSERT_EQ(scaler.scale, 512);
+        scaler.update(true);
+        scaler.update(true);
+        ATNN_ASSERT_EQ(scaler.scale, 1024);
+    });
+}
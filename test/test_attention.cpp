@@ -0,0 +1,36 @@
+#include <atnn/atnn.hpp>
+#include <atnn/attention.hpp>
+
+namespace A = atnn::attention;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // the tiled kernels are CPU only
+
+        const long b = 2, h = 3, lq = 7, lk = 9, d = 5, dv = 4;
+        atnn::Variable q(CPU(at::kFloat).randn({b, h, lq, d}));
+        atnn::Variable k(CPU(at::kFloat).randn({b, h, lk, d}));
+        atnn::Variable v(CPU(at::kFloat).randn({b, h, lk, dv}));
+
+        // tiles smaller than the lengths: the online softmax equals the dense one
+        auto attention = std::make_shared<A::Attention>(false, 3, 2);
+        auto y = attention->forward(q, k, v);
+        auto s = q.data().view({b * h, lq, d}).bmm(k.data().view({b * h, lk, d}).transpose(1, 2)) / std::sqrt(5.0f);
+        auto p = at::softmax_forward(s.contiguous().view({b * h * lq, lk})).view({b * h, lq, lk});
+        auto expected = p.bmm(v.data().view({b * h, lk, dv})).view({b, h, lq, dv});
+        ATNN_ASSERT(atnn::allclose(y.data(), expected, 1e-4, 1e-5));
+
+        auto gy = CPU(at::kFloat).randn({b, h, lq, dv});
+        auto f = [=](auto xs) { return atnn::VList {attention->forward(xs[0], xs[1], xs[2])}; };
+        atnn::grad_check(f, {q, k, v}, {gy}, 1e-2, 1e-2, 1e-3);
+
+        // causal: the first query sees the first key only
+        auto causal = std::make_shared<A::Attention>(true, 2, 3);
+        atnn::Variable kc(CPU(at::kFloat).randn({b, h, lq, d}));
+        atnn::Variable vc(CPU(at::kFloat).randn({b, h, lq, dv}));
+        auto yc = causal->forward(q, kc, vc);
+        ATNN_ASSERT(atnn::allclose(yc.data().narrow(2, 0, 1), vc.data().narrow(2, 0, 1), 1e-5, 1e-6));
+        auto fc = [=](auto xs) { return atnn::VList {causal->forward(xs[0], xs[1], xs[2])}; };
+        atnn::grad_check(fc, {q, kc, vc}, {gy}, 1e-2, 1e-2, 1e-3);
+    });
+}
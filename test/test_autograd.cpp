@@ -1,3 +1,5 @@
+#include <thread>
+
 #include <atnn/atnn.hpp>
 
 // you can define your own module's impl outside of it.
@@ -22,18 +24,24 @@ struct Pow : atnn::Module<Pow> {
     Pow(double n) : n(n) {}
 };
 
-// or inline impl style
+// or inline impl style with the fixed arity (no vector allocation)
 struct Add : atnn::Module<Add> {
     using Function = struct {
         template <typename Context>
-        static auto forward(Context, atnn::TList x) {
+        static auto forward(Context, atnn::TArray<2> x) {
             return x[0] + x[1];
         }
 
         template <typename Context>
-        static atnn::TList backward(Context, atnn::TList gy) {
+        static atnn::TArray<2> backward(Context, atnn::TArray<1> gy) {
             return {gy[0], gy[0]};
         }
+
+        // fused under atnn::LazyGuard
+        template <typename Context>
+        static atnn::lazy::Op pointwise(Context) {
+            return {atnn::lazy::Op::Add};
+        }
     };
 };
 
@@ -76,6 +84,32 @@ int main(int argc, char** argv) {
         atnn::grad_check(f1, {v0}, {gy});
     }
 
+    {
+        // apply the same module twice (like RNN). each call has its own tape
+        at::Tensor gy = device(at::kFloat).randn({3, 4});
+        auto v0 = atnn::Variable(device(at::kFloat).randn({3, 4}));
+        auto func = std::make_shared<Pow>(2);
+        auto v2 = func->forward(func->forward(v0)); // v0^4
+        v2.backward(gy);
+        assert(atnn::allclose(v0.grad(), gy * v0.data().pow(3) * 4, 1e-5));
+
+        // concurrent forward/backward on a shared module
+        std::vector<atnn::Variable> xs;
+        for (int i = 0; i < 4; ++i) xs.emplace_back(device(at::kFloat).randn({3, 4}));
+        std::vector<std::thread> threads;
+        for (auto& x: xs) {
+            threads.emplace_back([=] {
+                auto y = func->forward(x);
+                for (int n = 0; n < 100; ++n) y = func->forward(x);
+                y.backward(gy);
+            });
+        }
+        for (auto& t: threads) t.join();
+        for (auto& x: xs) {
+            assert(atnn::allclose(x.grad(), gy * x.data() * 2, 1e-6));
+        }
+    }
+
     for (auto device : {at::CPU, at::CUDA})
     {
         at::Tensor d = device(at::kFloat).ones({3, 4});
@@ -88,5 +122,52 @@ int main(int argc, char** argv) {
         assert(atnn::allclose(v0.grad(), d));
         assert(atnn::allclose(v1.grad(), d));
     }
+
+    {
+        // lazy mode records pointwise modules and fuses them into one pass on observation
+        auto sigmoid = std::make_shared<atnn::modules::Sigmoid>();
+        auto relu = std::make_shared<atnn::modules::ReLU>();
+        auto scale = std::make_shared<atnn::modules::Scale>(0.5);
+        auto add = std::make_shared<Add>();
+        auto f = [=](auto xs) { return add->forward(scale->forward(relu->forward(sigmoid->forward(xs[0]))), xs[0]); };
+        auto lazy_f = [=](auto xs) {
+            atnn::LazyGuard guard;
+            return f(xs);
+        };
+
+        atnn::Variable x(device(at::kFloat).randn({3, 4}));
+        auto gy = device(at::kFloat).randn({3, 4});
+        auto expected = f(atnn::VList {x}).data();
+        auto y = lazy_f(atnn::VList {x});
+        assert(y.ptr->pending != nullptr); // not evaluated yet
+        assert(atnn::allclose(y.data(), expected, 1e-6));
+        assert(y.ptr->pending == nullptr);
+        atnn::grad_check(lazy_f, {x}, {gy});
+    }
+
+    {
+        // in-place writes bump version counters, which backward checks against the saved tensors
+        auto sigmoid = std::make_shared<atnn::modules::Sigmoid>();
+        auto relu = std::make_shared<atnn::modules::ReLU>(true);
+        auto linear = std::make_shared<atnn::modules::Linear>(4, 5);
+        if (device == at::CUDA) { linear->toBackend(at::kCUDA); }
+        atnn::Variable x(device(at::kFloat).randn({3, 4}));
+        auto gy = device(at::kFloat).randn({3, 5});
+
+        auto f = [=](auto xs) { return relu->forward(linear->forward(xs[0])); }; // linear saves x, not y
+        atnn::grad_check(f, {x}, {gy}, 1e-2, 1e-3, 1e-4);
+
+        auto y = sigmoid->forward(x); // saves y
+        auto z = relu->forward(y);    // overwrites y
+        assert(y.ptr->version->value == 1);
+        assert(z.ptr->version == y.ptr->version);
+        bool thrown = false;
+        try {
+            z.backward(device(at::kFloat).ones({3, 4}));
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
     });
 }
@@ -0,0 +1,56 @@
+#include <atnn/atnn.hpp>
+#include <atnn/data.hpp>
+
+namespace D = atnn::data;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        auto x = device(at::kFloat).randn({10, 3, 4});
+        auto t = device(at::kLong).zeros({10});
+        for (long i = 0; i < 10; ++i) t[i] = i;
+
+        D::LoaderOptions options;
+        options.batch_size = 4;
+        options.num_workers = 3;
+        D::DataLoader loader(std::make_shared<D::TensorSource>(atnn::TList {x, t}), options);
+        loader.add_transform([](atnn::TList s) { return atnn::TList {s[0] * 2, s[1]}; });
+
+        for (int epoch = 0; epoch < 2; ++epoch) {
+            atnn::TList batch;
+            long offset = 0;
+            while (loader.next(batch)) {
+                ATNN_ASSERT_EQ(batch.size(), 2);
+                auto n = batch[0].size(0);
+                ATNN_ASSERT(atnn::shape_is(batch[0], {n, 3, 4}));
+                ATNN_ASSERT(atnn::allclose(batch[0], x.narrow(0, offset, n) * 2));
+                ATNN_ASSERT(atnn::allclose(batch[1], t.narrow(0, offset, n)));
+                offset += n;
+            }
+            ATNN_ASSERT_EQ(offset, 10);
+        }
+        ATNN_ASSERT_EQ(loader.stats().batches, 6); // 4 + 4 + 2 per epoch
+        ATNN_ASSERT_EQ(loader.stats().samples, 20);
+
+        options.drop_last = true;
+        options.num_workers = 0;
+        D::DataLoader dropping(std::make_shared<D::TensorSource>(atnn::TList {x, t}), options);
+        atnn::TList batch;
+        long nbatch = 0;
+        while (dropping.next(batch)) ++nbatch;
+        ATNN_ASSERT_EQ(nbatch, 2);
+
+        // a sample of another shape in a batch is an error, not a reallocation under the other workers
+        options.num_workers = 3;
+        D::DataLoader mixed(std::make_shared<D::TensorSource>(atnn::TList {x, t}), options);
+        mixed.add_transform([](atnn::TList s) {
+                return at::Scalar(s[1].sum()).toLong() == 5 ? atnn::TList {s[0].narrow(0, 0, 2), s[1]} : s;
+            });
+        bool thrown = false;
+        try {
+            while (mixed.next(batch)) {}
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ATNN_ASSERT(thrown);
+    });
+}
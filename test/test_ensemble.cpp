@@ -0,0 +1,113 @@
+#include <atnn/atnn.hpp>
+#include <atnn/ensemble.hpp>
+
+namespace M = atnn::modules;
+namespace E = atnn::ensemble;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // ensemble::Conv2d is CPU only
+
+        // MLPs sharing the input: one GEMM per layer for all the members
+        const long size = 3;
+        std::vector<atnn::ModulePtr> mlps;
+        for (long e = 0; e < size; ++e) {
+            auto net = std::make_shared<atnn::ModuleSet>();
+            net->modules = {std::make_shared<M::Linear>(6, 5), std::make_shared<M::Tanh>(), std::make_shared<M::Linear>(5, 4)};
+            mlps.push_back(net);
+        }
+        auto mlp = std::make_shared<E::Ensemble>(mlps);
+        ATNN_ASSERT_EQ(mlp->modules.size(), 3);
+        atnn::Variable x(CPU(at::kFloat).randn({7, 6}));
+        auto gy = CPU(at::kFloat).randn({size, 7, 4});
+        auto y = mlp->forward(x);
+        ATNN_ASSERT_SHAPE_EQ(y.data().sizes(), gy.sizes());
+        y.backward(gy);
+        auto gx = x.grad().clone();
+        auto expected_gx = gx.type().zeros_like(gx);
+        for (long e = 0; e < size; ++e) {
+            auto&& member = std::dynamic_pointer_cast<atnn::ModuleSet>(mlps[e])->modules;
+            atnn::Variable xe(x.data());
+            auto ye = xe;
+            for (auto&& m: member) ye = m->forward_unary(ye);
+            ATNN_ASSERT(atnn::allclose(y.data()[e], ye.data(), 1e-5, 1e-5));
+            ye.backward(gy[e]);
+            expected_gx += xe.grad();
+            auto stacked = mlp->parameters_of(e);
+            {
+                atnn::VList ps;
+                for (auto&& m: member) m->for_each_module([&](atnn::ModuleBase&, atnn::VList& p) { ps.insert(ps.end(), p.begin(), p.end()); });
+                ATNN_ASSERT_EQ(ps.size(), stacked.size());
+                for (size_t k = 0; k < ps.size(); ++k) {
+                    ATNN_ASSERT(atnn::allclose(stacked[k].data(), ps[k].data()));
+                    ATNN_ASSERT(atnn::allclose(stacked[k].grad(), ps[k].grad(), 1e-4, 1e-5));
+                }
+            }
+        }
+        ATNN_ASSERT(atnn::allclose(gx, expected_gx, 1e-4, 1e-5));
+
+        // the members see the updates of the stacked parameters through scatter
+        auto ps = mlp->parameters_of(1);
+        auto w = ps[0];
+        w.data().fill_(0.5);
+        mlp->scatter();
+        auto first = std::dynamic_pointer_cast<M::Linear>(std::dynamic_pointer_cast<atnn::ModuleSet>(mlps[1])->modules[0]);
+        ATNN_ASSERT(atnn::allclose(first->weight.data(), w.data()));
+        first->weight.data().fill_(0.25);
+        mlp->gather();
+        ATNN_ASSERT(atnn::allclose(mlp->parameters_of(1)[0].data(), first->weight.data()));
+
+        // convolutions: a shared input, then an input per member, then a Linear over the flattened features
+        std::vector<atnn::ModulePtr> cnns;
+        for (long e = 0; e < size; ++e) {
+            auto net = std::make_shared<atnn::ModuleSet>();
+            net->modules = {std::make_shared<M::Conv2d>(2, 3, at::IntList {3, 3}, at::IntList {1, 1}, at::IntList {1, 1}),
+                            std::make_shared<M::ReLU>(),
+                            std::make_shared<M::Conv2d>(3, 2, at::IntList {3, 3}, at::IntList {2, 2}),
+                            std::make_shared<M::Linear>(8, 3)};
+            cnns.push_back(net);
+        }
+        auto cnn = std::make_shared<E::Ensemble>(cnns);
+        atnn::Variable image(CPU(at::kFloat).randn({2, 2, 5, 5}));
+        auto gz = CPU(at::kFloat).randn({size, 2, 3});
+        auto z = cnn->forward(image);
+        z.backward(gz);
+        auto expected_gi = image.data().type().zeros_like(image.data());
+        for (long e = 0; e < size; ++e) {
+            auto&& member = std::dynamic_pointer_cast<atnn::ModuleSet>(cnns[e])->modules;
+            atnn::Variable ie(image.data());
+            auto h = member[2]->forward_unary(member[1]->forward_unary(member[0]->forward_unary(ie)));
+            auto ze = member[3]->forward_unary(h.data().view({2, 8})); // the reference flattens outside of the graph
+            ATNN_ASSERT(atnn::allclose(z.data()[e], ze.data(), 1e-4, 1e-5));
+            auto linear = std::dynamic_pointer_cast<M::Linear>(member[3]);
+            h.backward(gz[e].mm(linear->weight.data()).view({2, 2, 2, 2}));
+            expected_gi += ie.grad();
+            auto stacked = cnn->parameters_of(e);
+            auto conv = std::dynamic_pointer_cast<M::Conv2d>(member[0]);
+            ATNN_ASSERT(atnn::allclose(stacked[0].grad(), conv->weight.grad(), 1e-4, 1e-5));
+            ATNN_ASSERT(atnn::allclose(stacked[1].grad(), conv->bias.grad(), 1e-4, 1e-5));
+        }
+        ATNN_ASSERT(atnn::allclose(image.grad(), expected_gi, 1e-4, 1e-5));
+        // scattered grads are copies: zeroing the stacked grad leaves the members as they are
+        cnn->scatter();
+        auto conv0 = std::dynamic_pointer_cast<M::Conv2d>(std::dynamic_pointer_cast<atnn::ModuleSet>(cnns[0])->modules[0]);
+        const auto scattered = conv0->weight.grad().clone();
+        cnn->parameters_of(0)[0].grad().zero_();
+        ATNN_ASSERT(atnn::allclose(conv0->weight.grad(), scattered, 0, 0));
+
+        // elementwise modules are shared only with the same settings
+        std::vector<atnn::ModulePtr> scaled;
+        for (double factor: {1.0, 2.0}) {
+            auto net = std::make_shared<atnn::ModuleSet>();
+            net->modules = {std::make_shared<M::Linear>(6, 5), std::make_shared<M::Scale>(factor)};
+            scaled.push_back(net);
+        }
+        bool thrown = false;
+        try {
+            E::Ensemble mismatched(scaled);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ATNN_ASSERT(thrown);
+    });
+}
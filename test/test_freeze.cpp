@@ -0,0 +1,66 @@
+#include <atnn/atnn.hpp>
+#include <atnn/freeze.hpp>
+
+namespace M = atnn::modules;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        // BatchNorm backward in both modes
+        auto bn = std::make_shared<M::BatchNorm>(4);
+        if (device == at::CUDA) { bn->toBackend(at::kCUDA); }
+        auto f = [=](auto xs) { return atnn::VList {bn->forward(xs[0])}; };
+        atnn::Variable x(device(at::kFloat).randn({3, 4, 5, 6}));
+        auto gy = device(at::kFloat).randn({3, 4, 5, 6});
+        atnn::grad_check(f, {x}, {gy}, 1e-2, 1e-2, 1e-3);
+        bn->training = false;
+        atnn::grad_check(f, {x}, {gy}, 1e-2, 1e-2, 1e-3);
+
+        // conv -> bn -> scale -> relu -> conv -> bn
+        auto net = std::make_shared<atnn::ModuleSet>();
+        auto conv0 = std::make_shared<M::Conv2d>(4, 8, at::IntList {3, 3}, at::IntList {1, 1}, at::IntList {1, 1});
+        auto bn0 = std::make_shared<M::BatchNorm>(8);
+        auto conv1 = std::make_shared<M::Conv2d>(8, 2);
+        auto bn1 = std::make_shared<M::BatchNorm>(2);
+        net->modules = {conv0, bn0, std::make_shared<M::Scale>(0.5), std::make_shared<M::ReLU>(), conv1, bn1};
+        if (device == at::CUDA) { net->toBackend(at::kCUDA); }
+        for (int i = 0; i < 4; ++i) { // collect running statistics
+            auto h = device(at::kFloat).randn({2, 4, 7, 7});
+            for (auto&& m: net->modules) { h = m->infer({h})[0]; }
+        }
+        bn0->training = bn1->training = false;
+
+        auto frozen = atnn::freeze::freeze(net);
+        ATNN_ASSERT_EQ(frozen.stages.size(), 3); // conv, relu, conv
+        auto input = device(at::kFloat).randn({2, 4, 7, 7});
+        auto expected = input;
+        for (auto&& m: net->modules) { expected = m->infer({expected})[0]; }
+        ATNN_ASSERT(atnn::allclose(frozen.predict(input), expected, 1e-3, 1e-4));
+
+        // the modules keep training without touching the frozen copy
+        conv0->weight.data() += 1;
+        ATNN_ASSERT(atnn::allclose(frozen.predict(input), expected, 1e-3, 1e-4));
+        if (device == at::CUDA) return; // int8 kernels are CPU only
+
+        auto linear = std::make_shared<M::Linear>(16, 8);
+        auto lbn = std::make_shared<M::BatchNorm>(8);
+        lbn->training = false;
+        std::vector<atnn::ModulePtr> chain = {linear, lbn, std::make_shared<M::ReLU>()};
+        atnn::freeze::FreezeOptions options;
+        options.int8 = true;
+        for (int i = 0; i < 4; ++i) { options.calibration.push_back(CPU(at::kFloat).randn({8, 16})); }
+        auto q = atnn::freeze::freeze(chain, options);
+        ATNN_ASSERT_EQ(q.stages.size(), 1); // bn folded and relu fused
+        auto v = CPU(at::kFloat).randn({8, 16});
+        auto w = v;
+        for (auto&& m: chain) { w = m->infer({w})[0]; }
+        ATNN_ASSERT(atnn::allclose(q.predict(v), w, 5e-2, 5e-1));
+
+        // ~4x smaller once the per-channel scales, sums and bias are amortized over the input features
+        auto wide = std::make_shared<M::Linear>(256, 128);
+        atnn::freeze::FreezeOptions wide_options;
+        wide_options.int8 = true;
+        wide_options.calibration.push_back(CPU(at::kFloat).randn({8, 256}));
+        auto wq = atnn::freeze::freeze(std::vector<atnn::ModulePtr> {wide}, wide_options);
+        ATNN_ASSERT(wq.nbytes() * 3 < wide->weight.data().numel() * sizeof(float));
+    });
+}
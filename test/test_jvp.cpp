@@ -0,0 +1,91 @@
+#include <atnn/atnn.hpp>
+
+namespace M = atnn::modules;
+
+// user Functions opt in to forward mode with jvp
+struct Square : atnn::Module<Square> {
+    using Function = struct {
+        template <typename Context>
+        static auto forward(Context ctx, atnn::TArray<1> xs) {
+            ctx->save_for_backward(xs);
+            return xs[0] * xs[0];
+        }
+
+        template <typename Context>
+        static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+            return {gy[0] * ctx->saved_tensors[0] * 2};
+        }
+
+        template <typename Context>
+        static at::Tensor jvp(Context, atnn::TArray<1> xs, at::Tensor, atnn::TArray<1> tx) {
+            return tx[0] * xs[0] * 2;
+        }
+    };
+};
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        auto l1 = std::make_shared<M::Linear>(5, 4);
+        auto l2 = std::make_shared<M::Linear>(4, 3);
+        auto conv = std::make_shared<M::Conv2d>(2, 3, at::IntList {3, 3});
+        if (device == at::CUDA) {
+            l1->toBackend(at::kCUDA);
+            l2->toBackend(at::kCUDA);
+            conv->toBackend(at::kCUDA);
+        }
+        auto sigmoid = std::make_shared<M::Sigmoid>();
+        auto tanh = std::make_shared<M::Tanh>();
+        auto relu = std::make_shared<M::ReLU>();
+        auto scale = std::make_shared<M::Scale>(0.5);
+        auto square = std::make_shared<Square>();
+        auto log_softmax = std::make_shared<M::LogSoftmax>();
+        auto softmax = std::make_shared<M::Softmax>();
+        auto mse = std::make_shared<M::MSELoss>();
+
+        // the tangents pass through the chain without a tape
+        atnn::Variable x(device(at::kFloat).randn({2, 5}));
+        auto mlp = [=](auto xs) {
+            auto h = tanh->forward(relu->forward(l1->forward(xs[0])));
+            return log_softmax->forward(scale->forward(square->forward(sigmoid->forward(l2->forward(h)))));
+        };
+        atnn::jvp_grad_check(mlp, {x}, {device(at::kFloat).randn({2, 3})}, 3, 1e-2, 1e-2, 1e-3);
+        {
+            atnn::ForwardModeGuard guard;
+            atnn::Variable dual(x.data(), false);
+            dual.set_tangent(device(at::kFloat).randn({2, 5}));
+            auto y = mlp(atnn::VList {dual});
+            ATNN_ASSERT(y.is_leaf()); // no Node
+            ATNN_ASSERT(y.tangent().defined());
+        }
+
+        atnn::Variable p(device(at::kFloat).randn({2, 3}));
+        auto target = device(at::kFloat).randn({2, 3}); // a constant: zero tangent, no grad
+        auto loss = [=](auto xs) { return mse->forward(softmax->forward(xs[0]), target); };
+        atnn::jvp_grad_check(loss, {p}, {device(at::kFloat).ones({1})}, 3, 1e-2, 1e-2, 1e-3);
+
+        atnn::Variable image(device(at::kFloat).randn({2, 2, 5, 5}));
+        auto f = [=](auto xs) { return conv->forward(xs[0]); };
+        atnn::jvp_grad_check(f, {image}, {device(at::kFloat).randn({2, 3, 3, 3})}, 2, 1e-2, 1e-2, 1e-3);
+
+        // the tangents of the parameters: d/dw (x W^T + b) along (v, u) = x v^T + u
+        auto v = device(at::kFloat).randn({4, 5});
+        auto u = device(at::kFloat).randn({4});
+        l1->weight.set_tangent(v);
+        l1->bias.set_tangent(u);
+        auto dual = atnn::jvp([=](auto xs) { return l1->forward(xs[0]); }, {x.data()}, {device(at::kFloat).zeros({2, 5})});
+        ATNN_ASSERT(atnn::allclose(dual.second[0], x.data().mm(v.t()) + u.view({1, 4}).expand({2, 4}), 1e-5, 1e-5));
+        l1->weight.set_tangent({});
+        l1->bias.set_tangent({});
+
+        // modules without jvp are rejected
+        auto bn = std::make_shared<M::BatchNorm>(5);
+        if (device == at::CUDA) { bn->toBackend(at::kCUDA); }
+        bool thrown = false;
+        try {
+            atnn::jvp([=](auto xs) { return bn->forward(xs[0]); }, {x.data()}, {x.data()});
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ATNN_ASSERT(thrown);
+    });
+}
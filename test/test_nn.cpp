@@ -1,10 +1,27 @@
 #include <ATen/Functions.h>
 #include <atnn/atnn.hpp>
+#include <atnn/sequential.hpp>
 #include <tuple>
 
 
 namespace M = atnn::modules;
 
+// identity recording whether its backward was asked for the input grad
+struct Probe : atnn::Module<Probe> {
+    using Function = struct {
+        template <typename Context>
+        static auto forward(Context, atnn::TArray<1> xs) { return xs[0]; }
+
+        template <typename Context>
+        static atnn::TArray<1> backward(Context ctx, atnn::TArray<1> gy) {
+            ctx->asked = ctx->needs_input_grad(0);
+            return {ctx->asked ? gy[0] : at::Tensor()};
+        }
+    };
+
+    bool asked = true;
+};
+
 struct Net : atnn::ModuleSet {
     std::shared_ptr<M::Conv2d> conv2d = std::make_shared<M::Conv2d>(4, 2);
     std::shared_ptr<M::Sigmoid> sigmoid = std::make_shared<M::Sigmoid>();
@@ -60,6 +77,76 @@ int main(int argc, char** argv) {
         };
         atnn::grad_check(f2, {x}, {gz}, 1e-2, 1e-3, 1e-4);
 
+        // the same chain dispatched statically
+        auto seq = atnn::make_sequential(net.conv2d, net.sigmoid);
+        auto f3 = [=](auto xs) { return atnn::VList {seq->forward(xs[0])}; };
+        ATNN_ASSERT(atnn::allclose(f3(atnn::VList {x})[0].data(), f2(atnn::VList {x})[0].data()));
+        atnn::grad_check(f3, {x}, {gz}, 1e-2, 1e-3, 1e-4);
+        auto mlp = atnn::make_sequential(std::make_shared<M::Linear>(6, 5), std::make_shared<M::ReLU>(),
+                                         std::make_shared<M::Linear>(5, 4));
+        if (device == at::CUDA) { mlp->toBackend(at::kCUDA); }
+        atnn::Variable v(device(at::kFloat).randn({3, 6}));
+        auto fm = [=](auto xs) { return atnn::VList {mlp->forward(xs[0])}; };
+        atnn::grad_check(fm, {v}, {device(at::kFloat).ones({3, 4})}, 1e-2, 1e-3, 1e-4);
+
+        // 4 averaged micro-batches of 2 = the full batch of 8 divided by 4, in the same buffers
+        auto linear = std::make_shared<M::Linear>(6, 4);
+        auto conv = std::make_shared<M::Conv2d>(4, 2);
+        if (device == at::CUDA) { linear->toBackend(at::kCUDA); conv->toBackend(at::kCUDA); }
+        auto net2 = std::make_shared<atnn::ModuleSet>();
+        net2->modules = {linear, conv};
+        atnn::GradAccumulator acc(net2, 4);
+        ATNN_ASSERT_EQ(acc.parameters.size(), 4);
+        auto xl = device(at::kFloat).randn({8, 6});
+        auto gl = device(at::kFloat).randn({8, 4});
+        auto xc = device(at::kFloat).randn({8, 4, 5, 6});
+        auto gc = device(at::kFloat).randn({8, 2, 3, 4});
+        linear->forward(atnn::Variable(xl)).backward(gl);
+        conv->forward(atnn::Variable(xc)).backward(gc);
+        atnn::TList full;
+        for (auto&& p: acc.parameters) full.push_back(p.grad().clone() / 4);
+        acc.zero();
+        const auto buffer = linear->weight.grad().data_ptr();
+        for (int step = 0; step < 2; ++step) { // zeroed in place and accumulated again
+            for (long i = 0; i < 8; i += 2) {
+                atnn::GradAccumulationGuard guard(acc.scale());
+                linear->forward(atnn::Variable(xl.narrow(0, i, 2))).backward(gl.narrow(0, i, 2));
+                conv->forward(atnn::Variable(xc.narrow(0, i, 2))).backward(gc.narrow(0, i, 2));
+            }
+            for (size_t k = 0; k < full.size(); ++k) {
+                ATNN_ASSERT(atnn::allclose(acc.parameters[k].grad(), full[k], 1e-4, 1e-5));
+            }
+            ATNN_ASSERT_EQ(linear->weight.grad().data_ptr(), buffer);
+            acc.zero();
+        }
+
+        // inputs and parameters without grad are pruned from backward
+        atnn::Variable image(xc, false);
+        conv->forward(image).backward(gc); // weight grads from the saved CPU columns, no grad_input (scratch on CUDA)
+        ATNN_ASSERT(atnn::is_empty(image.grad()));
+        ATNN_ASSERT(conv->weight.grad().type().backend() == xc.type().backend());
+        for (size_t k = 2; k < full.size(); ++k) {
+            ATNN_ASSERT(atnn::allclose(acc.parameters[k].grad(), full[k] * 4, 1e-4, 1e-5));
+        }
+        acc.zero();
+        auto relu = std::make_shared<M::ReLU>()->forward(image);
+        ATNN_ASSERT(relu.is_leaf() && !relu.requires_grad()); // no Node recorded
+        // also in the first stage of a Sequential
+        auto probe = std::make_shared<Probe>();
+        auto probed = atnn::make_sequential(probe, std::make_shared<M::Linear>(6, 4));
+        if (device == at::CUDA) { probed->toBackend(at::kCUDA); }
+        probed->forward(atnn::Variable(xl, false)).backward(gl);
+        ATNN_ASSERT(!probe->asked);
+        probed->forward(atnn::Variable(xl)).backward(gl);
+        ATNN_ASSERT(probe->asked);
+        linear->set_requires_grad(false);
+        ATNN_ASSERT(!linear->has_trainable_parameters());
+        atnn::Variable vl(xl);
+        linear->forward(vl).backward(gl);
+        ATNN_ASSERT_EQ(at::Scalar(linear->weight.grad().abs().sum()).toDouble(), 0); // still zeroed by acc.zero()
+        ATNN_ASSERT(atnn::allclose(vl.grad(), gl.mm(linear->weight.data()), 1e-5));
+        linear->set_requires_grad(true);
+
         /*
         atnn::Variable y, z;
         std::tie(y, z) = net(x);
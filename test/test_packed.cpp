@@ -0,0 +1,118 @@
+#include <atnn/atnn.hpp>
+#include <atnn/data.hpp>
+#include <atnn/packed.hpp>
+
+namespace M = atnn::modules;
+namespace P = atnn::packed;
+
+struct Sequences : atnn::data::Source {
+    atnn::TList sequences;
+    size_t index = 0;
+
+    explicit Sequences(atnn::TList sequences) : sequences(sequences) {}
+
+    bool next(atnn::TList& sample) override {
+        if (this->index >= this->sequences.size()) return false;
+        sample = {this->sequences[this->index++]};
+        return true;
+    }
+
+    void reset() override { this->index = 0; }
+};
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        const std::vector<long> lengths = {3, 5, 1, 4};
+        atnn::TList sequences;
+        for (auto l: lengths) sequences.push_back(device(at::kFloat).randn({l, 3}));
+
+        auto x = P::pack(sequences, true);
+        ATNN_ASSERT(x.batch_sizes == std::vector<long>({4, 3, 3, 2, 1}));
+        ATNN_ASSERT(x.sorted_indices == std::vector<long>({1, 3, 0, 2}));
+        ATNN_ASSERT_EQ(x.data.data().size(0), 13);
+        auto restored = P::unpack(x);
+        for (size_t i = 0; i < sequences.size(); ++i) ATNN_ASSERT(atnn::allclose(restored[i], sequences[i]));
+
+        // the same as stepping an LSTMCell over each sequence
+        auto lstm = std::make_shared<P::LSTM>(3, 4);
+        if (device == at::CUDA) { lstm->toBackend(at::kCUDA); }
+        auto cell = lstm->cell;
+        auto y = lstm->forward_packed(x);
+        auto&& outputs = std::get<0>(y).data;
+        const auto offsets = x.offsets();
+        auto gy = device(at::kFloat).randn({13, 4});
+        outputs.backward(gy);
+        std::get<1>(y).backward(device(at::kFloat).zeros({4, 4}));
+        std::get<2>(y).backward(device(at::kFloat).zeros({4, 4}));
+        const auto packed_grads = atnn::TList {x.data.grad(), cell->weight_ih.grad().clone(), cell->weight_hh.grad().clone(), cell->bias.grad().clone()};
+
+        for (auto&& p: cell->parameters) p.zero_grad();
+        for (long k = 0; k < x.size(); ++k) {
+            auto zero = cell->zero_state(1);
+            std::array<atnn::Variable, 2> state = {atnn::Variable(zero[0], false), atnn::Variable(zero[1], false)};
+            std::vector<atnn::Variable> rows;
+            for (long t = 0; t < x.length(k); ++t) {
+                rows.emplace_back(x.data.data()[offsets[t] + k].view({1, 3}).clone());
+                state = cell->forward(rows.back(), state[0], state[1]);
+                ATNN_ASSERT(atnn::allclose(state[0].data()[0], outputs.data()[offsets[t] + k], 1e-5, 1e-6));
+                state[0].backward(gy[offsets[t] + k].view({1, 4})); // waits for the grad of the cell state
+            }
+            ATNN_ASSERT(atnn::allclose(state[0].data()[0], std::get<1>(y).data()[k], 1e-5, 1e-6));
+            ATNN_ASSERT(atnn::allclose(state[1].data()[0], std::get<2>(y).data()[k], 1e-5, 1e-6));
+            state[1].backward(device(at::kFloat).zeros({1, 4}));
+            for (long t = 0; t < x.length(k); ++t) {
+                ATNN_ASSERT(atnn::allclose(rows[t].grad()[0], packed_grads[0][offsets[t] + k], 1e-4, 1e-5));
+            }
+        }
+        ATNN_ASSERT(atnn::allclose(cell->weight_ih.grad(), packed_grads[1], 1e-4, 1e-5));
+        ATNN_ASSERT(atnn::allclose(cell->weight_hh.grad(), packed_grads[2], 1e-4, 1e-5));
+        ATNN_ASSERT(atnn::allclose(cell->bias.grad(), packed_grads[3], 1e-4, 1e-5));
+
+        atnn::Variable batch_sizes(x.batch_sizes_tensor(), false);
+        atnn::Variable h0(device(at::kFloat).randn({4, 4}));
+        atnn::Variable c0(device(at::kFloat).randn({4, 4}));
+        auto f = [=](auto xs) {
+            auto y = lstm->forward(xs[0], batch_sizes, xs[1], xs[2]);
+            return atnn::VList {y[0], y[1], y[2]};
+        };
+        atnn::grad_check(f, {atnn::Variable(x.data.data().clone()), h0, c0},
+                         {gy, device(at::kFloat).randn({4, 4}), device(at::kFloat).randn({4, 4})}, 1e-2, 1e-2, 1e-3);
+
+        // row-wise losses take the packed data and the targets packed the same way
+        atnn::TList targets;
+        for (auto l: lengths) {
+            auto t = CPU(at::kLong).tensor({l});
+            for (long i = 0; i < l; ++i) t.data<int64_t>()[i] = (l + i) % 4;
+            targets.push_back(t.toBackend(device(at::kLong).backend()));
+        }
+        auto packed_targets = P::pack(targets);
+        ATNN_ASSERT(packed_targets.batch_sizes == x.batch_sizes);
+        auto log_softmax = std::make_shared<M::LogSoftmax>();
+        auto logp = log_softmax->forward(outputs);
+        auto loss = std::make_shared<M::NLLLoss>()->forward(logp, packed_targets.data);
+        double expected = 0;
+        auto nll_sum = std::make_shared<M::NLLLoss>(false);
+        auto per_sequence = P::unpack(std::get<0>(y).with_data(logp));
+        for (size_t i = 0; i < lengths.size(); ++i) {
+            expected += at::Scalar(nll_sum->forward(atnn::Variable(per_sequence[i], false), atnn::Variable(targets[i], false)).data().sum()).toDouble();
+        }
+        expected /= 13;
+        ATNN_ASSERT(std::abs(at::Scalar(loss.data().sum()).toDouble() - expected) < 1e-5);
+
+        // buckets of similar lengths
+        atnn::TList samples;
+        for (long l: {2, 9, 3, 8, 1, 10, 2}) samples.push_back(CPU(at::kFloat).zeros({l, 3}));
+        atnn::data::BucketBatcher batcher(std::make_shared<Sequences>(samples), {2, {5}});
+        std::vector<atnn::TList> batch;
+        std::vector<std::vector<long>> batches;
+        while (batcher.next(batch)) {
+            batches.emplace_back();
+            for (auto&& s: batch) batches.back().push_back(s[0].size(0));
+        }
+        ATNN_ASSERT(batches == std::vector<std::vector<long>>({{2, 3}, {9, 8}, {1, 2}, {10}}));
+        ATNN_ASSERT_EQ(batcher.stats.samples, 7);
+        ATNN_ASSERT_EQ(batcher.stats.tokens, 35);
+        ATNN_ASSERT_EQ(batcher.stats.padded_tokens, 6 + 18 + 4 + 10);
+        ATNN_ASSERT(batcher.next(batch)); // the next epoch
+    });
+}
@@ -0,0 +1,85 @@
+#include <atnn/atnn.hpp>
+#include <atnn/per_sample.hpp>
+
+namespace M = atnn::modules;
+
+// the grads of each example run alone
+template <class F>
+std::vector<atnn::TList> reference_grads(F f, const atnn::VList& params, at::Tensor x, at::Tensor gy) {
+    std::vector<atnn::TList> grads;
+    for (long i = 0; i < x.size(0); ++i) {
+        for (auto p: params) p.clear_grads();
+        f(atnn::Variable(x.narrow(0, i, 1), false)).backward(gy.narrow(0, i, 1));
+        grads.emplace_back();
+        for (auto&& p: params) grads.back().push_back(p.grad().clone());
+    }
+    return grads;
+}
+
+template <class F>
+void check(F f, const atnn::VList& params, at::Tensor x, at::Tensor gy) {
+    const auto expected = reference_grads(f, params, x, gy);
+    const long n = x.size(0);
+    const double max_norm = 0.5;
+    std::vector<double> norms(n, 0);
+    for (long i = 0; i < n; ++i) {
+        for (auto&& g: expected[i]) norms[i] += at::Scalar((g * g).sum()).toDouble();
+        norms[i] = std::sqrt(norms[i]);
+    }
+
+    for (auto p: params) p.clear_grads();
+    auto grads = std::make_shared<atnn::per_sample::Gradients>(max_norm);
+    {
+        atnn::PerSampleGuard guard(grads);
+        f(atnn::Variable(x, false)).backward(gy);
+    }
+    for (size_t k = 0; k < params.size(); ++k) {
+        ATNN_ASSERT(atnn::is_empty(params[k].grad())); // no batch grads
+        auto per_sample = grads->grads(params[k]);
+        for (long i = 0; i < n; ++i) ATNN_ASSERT(atnn::allclose(per_sample[i], expected[i][k], 1e-4, 1e-5));
+    }
+    auto actual_norms = grads->norms();
+    for (long i = 0; i < n; ++i) ATNN_ASSERT(std::abs(at::Scalar(actual_norms[i]).toDouble() - norms[i]) < 1e-4 * (1 + norms[i]));
+
+    grads->accumulate(); // the clipped sum
+    ATNN_ASSERT(grads->records.empty());
+    for (size_t k = 0; k < params.size(); ++k) {
+        auto sum = expected[0][k].type().zeros_like(expected[0][k]);
+        for (long i = 0; i < n; ++i) sum += expected[i][k] * std::min(1.0, max_norm / (norms[i] + 1e-6));
+        ATNN_ASSERT(atnn::allclose(params[k].grad(), sum, 1e-4, 1e-5));
+    }
+}
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // Conv2d per-sample grads use the CPU im2col columns
+
+        auto l1 = std::make_shared<M::Linear>(6, 5);
+        auto tanh = std::make_shared<M::Tanh>();
+        auto l2 = std::make_shared<M::Linear>(5, 3);
+        auto mlp = [=](atnn::Variable x) { return l2->forward(tanh->forward(l1->forward(x))); };
+        check(mlp, {l1->weight, l1->bias, l2->weight, l2->bias}, CPU(at::kFloat).randn({4, 6}), CPU(at::kFloat).randn({4, 3}));
+
+        // a module called twice: the norms of its summed grads
+        auto twice = std::make_shared<M::Linear>(4, 4);
+        check([=](atnn::Variable x) { return twice->forward(tanh->forward(twice->forward(x))); }, {twice->weight, twice->bias},
+              CPU(at::kFloat).randn({3, 4}), CPU(at::kFloat).randn({3, 4}));
+
+        // positions x positions Gram matrices (4 output pixels) and materialized grads (9 output pixels)
+        auto wide = std::make_shared<M::Conv2d>(4, 8, at::IntList {3, 3});
+        check([=](atnn::Variable x) { return wide->forward(x); }, {wide->weight, wide->bias},
+              CPU(at::kFloat).randn({3, 4, 4, 4}), CPU(at::kFloat).randn({3, 8, 2, 2}));
+        auto narrow = std::make_shared<M::Conv2d>(2, 3, at::IntList {3, 3});
+        check([=](atnn::Variable x) { return narrow->forward(x); }, {narrow->weight, narrow->bias},
+              CPU(at::kFloat).randn({3, 2, 5, 5}), CPU(at::kFloat).randn({3, 3, 3, 3}));
+
+        // frozen parameters are skipped
+        l1->set_requires_grad(false);
+        auto grads = std::make_shared<atnn::per_sample::Gradients>();
+        {
+            atnn::PerSampleGuard guard(grads);
+            mlp(atnn::Variable(CPU(at::kFloat).randn({4, 6}), false)).backward(CPU(at::kFloat).randn({4, 3}));
+        }
+        ATNN_ASSERT_EQ(grads->records.size(), 1);
+    });
+}
@@ -0,0 +1,71 @@
+#include <atnn/atnn.hpp>
+#include <atnn/pipeline.hpp>
+#include <atnn/threading.hpp>
+
+namespace M = atnn::modules;
+namespace P = atnn::pipeline;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        // pinning and thread budgets
+        std::thread([] {
+                atnn::threading::pin_current_thread({0});
+                ATNN_ASSERT(atnn::threading::current_cores() == std::vector<int>{0});
+            }).join();
+        auto budgeted = std::make_shared<M::Linear>(4, 4);
+        atnn::threading::set_thread_budget(budgeted, 1);
+        if (device == at::CUDA) { budgeted->toBackend(at::kCUDA); }
+        budgeted->forward(atnn::Variable(device(at::kFloat).randn({2, 4}))).backward(device(at::kFloat).ones({2, 4}));
+        ATNN_ASSERT_EQ(atnn::IntraOp::depth(), 0);
+
+        auto net = std::make_shared<atnn::ModuleSet>();
+        std::vector<std::shared_ptr<M::Linear>> linears;
+        for (int i = 0; i < 3; ++i) linears.push_back(std::make_shared<M::Linear>(8, 8));
+        net->modules = {linears[0], std::make_shared<M::Tanh>(), linears[1], std::make_shared<M::ReLU>(), linears[2]};
+        if (device == at::CUDA) { net->toBackend(at::kCUDA); }
+        auto x = device(at::kFloat).randn({10, 8});
+        auto gy = device(at::kFloat).randn({10, 8});
+
+        // reference: the whole batch in one stream
+        auto y = atnn::Variable(x);
+        for (auto&& m: net->modules) y = m->forward_unary(y);
+        y.backward(gy);
+        atnn::TList expected;
+        for (auto&& l: linears) {
+            expected.push_back(l->weight.grad().clone());
+            l->weight.zero_grad();
+            l->bias.zero_grad();
+        }
+
+        for (auto schedule: {P::Schedule::GPipe, P::Schedule::OneFOneB}) {
+            P::PipelineOptions options;
+            options.micro_batches = 4; // of 3, 3, 3 and 1 samples
+            options.schedule = schedule;
+            P::Pipeline pipe(net, {2, 2, 1}, options);
+            ATNN_ASSERT_EQ(pipe.size(), 3);
+            ATNN_ASSERT(atnn::allclose(pipe.predict(x), y.data(), 1e-5));
+            auto out = pipe.train_step(x, [&](at::Tensor yi, long i) {
+                    ATNN_ASSERT_EQ(yi.size(0), i < 3 ? 3 : 1);
+                    return gy.narrow(0, 3 * i, yi.size(0));
+                });
+            ATNN_ASSERT(atnn::allclose(out, y.data(), 1e-5));
+            for (size_t i = 0; i < linears.size(); ++i) {
+                ATNN_ASSERT(atnn::allclose(linears[i]->weight.grad(), expected[i], 1e-4, 1e-5));
+                linears[i]->weight.zero_grad();
+                linears[i]->bias.zero_grad();
+            }
+        }
+
+        // a stage that cannot be pinned fails the steps instead of terminating
+        P::PipelineOptions unpinnable;
+        unpinnable.cores = {{0}, {-1}, {0}};
+        P::Pipeline pipe(net, {2, 2, 1}, unpinnable);
+        bool thrown = false;
+        try {
+            pipe.predict(x);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        ATNN_ASSERT(thrown);
+    });
+}
@@ -0,0 +1,46 @@
+#include <atnn/atnn.hpp>
+#include <atnn/quantize.hpp>
+
+namespace M = atnn::modules;
+namespace Q = atnn::quantize;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // int8 kernels are CPU only
+
+        auto linear = std::make_shared<M::Linear>(64, 32);
+        auto conv2d = std::make_shared<M::Conv2d>(4, 8, at::IntList {3, 3}, at::IntList {1, 1}, at::IntList {1, 1});
+        std::shared_ptr<Q::Observation> linear_range, conv2d_range;
+        {
+            Q::Calibrator calibrator;
+            linear_range = calibrator.attach(linear);
+            conv2d_range = calibrator.attach(conv2d);
+            for (int i = 0; i < 8; ++i) {
+                linear->predict(CPU(at::kFloat).randn({16, 64}));
+                conv2d->forward(atnn::Variable(CPU(at::kFloat).randn({2, 4, 6, 5})));
+            }
+        }
+        ATNN_ASSERT(linear->forward_hooks.empty()); // detached
+        ATNN_ASSERT(!linear_range->input.empty());
+
+        // float -> float
+        Q::QuantizedLinear qlinear(*linear, linear_range->input.qparams(), linear_range->output.qparams());
+        auto x = CPU(at::kFloat).randn({16, 64});
+        auto expected = linear->predict(x);
+        ATNN_ASSERT(atnn::allclose(qlinear.predict(x), expected, 5e-2, 5e-1));
+        ATNN_ASSERT(qlinear.nbytes() * 3 < linear->weight.data().numel() * sizeof(float));
+
+        // uint8 -> uint8 through the requantize epilogue
+        auto qx = Q::quantize_tensor(x, qlinear.input);
+        auto qy = qlinear.predict(qx);
+        ATNN_ASSERT(qy.data.type().scalarType() == at::kByte);
+        ATNN_ASSERT(atnn::allclose(Q::dequantize(qy), expected, 5e-2, 5e-1));
+
+        Q::QuantizedConv2d qconv2d(*conv2d, conv2d_range->input.qparams());
+        auto image = CPU(at::kFloat).randn({2, 4, 6, 5});
+        auto conv_expected = conv2d->predict(image);
+        auto conv_actual = qconv2d.predict(image);
+        ATNN_ASSERT(atnn::shape_is(conv_actual, conv_expected.sizes()));
+        ATNN_ASSERT(atnn::allclose(conv_actual, conv_expected, 5e-2, 5e-1));
+    });
+}
@@ -0,0 +1,66 @@
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <atnn/atnn.hpp>
+#include <atnn/random.hpp>
+
+namespace M = atnn::modules;
+namespace R = atnn::random;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        // known answers of Random123
+        ATNN_ASSERT(R::philox({0, 0, 0, 0}, {0, 0}) == (R::Block {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+        ATNN_ASSERT(R::philox({0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0})
+                    == (R::Block {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}));
+
+        // the same numbers for any number of threads, disjoint draws
+        R::Generator g(42);
+        auto x = R::randn({1 << 16}, 0, 1, g);
+        const auto mean = at::Scalar(x.sum()).toDouble() / x.numel();
+        const auto var = at::Scalar((x * x).sum()).toDouble() / x.numel() - mean * mean;
+        ATNN_ASSERT(std::abs(mean) < 2e-2 && std::abs(var - 1) < 2e-2);
+        auto again = CPU(at::kFloat).tensor({1 << 16});
+#ifdef _OPENMP
+        const auto threads = omp_get_max_threads();
+        omp_set_num_threads(1);
+#endif
+        R::fill_normal(again, 0, 1, 42, 0);
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        ATNN_ASSERT(atnn::allclose(again, x, 0, 0));
+        ATNN_ASSERT(!atnn::allclose(R::randn({1 << 16}, 0, 1, g), x));
+        auto u = R::uniform({1000}, -1, 1, g);
+        ATNN_ASSERT(at::Scalar(u.min()).toDouble() >= -1 && at::Scalar(u.max()).toDouble() < 1);
+
+        // reproducible initialization
+        R::manual_seed(1);
+        auto l0 = std::make_shared<M::Linear>(16, 8);
+        R::manual_seed(1);
+        auto l1 = std::make_shared<M::Linear>(16, 8);
+        ATNN_ASSERT(atnn::allclose(l0->weight.data(), l1->weight.data(), 0, 0));
+
+        // the mask regenerated in backward: gx * x = gy * y
+        auto dropout = std::make_shared<M::Dropout>(0.25);
+        atnn::Variable xv(device(at::kFloat).randn({64, 32}));
+        auto y = dropout->forward(xv);
+        auto gy = device(at::kFloat).randn({64, 32});
+        y.backward(gy);
+        ATNN_ASSERT(atnn::allclose(xv.grad() * xv.data(), gy * y.data(), 1e-5, 1e-6));
+        const auto kept = at::Scalar(y.data().ne(0).toType(CPU(at::kFloat)).sum()).toDouble() / y.data().numel();
+        ATNN_ASSERT(std::abs(kept - 0.75) < 5e-2);
+        auto kept_x = xv.data() * y.data().ne(0).toType(xv.data().type());
+        ATNN_ASSERT(atnn::allclose(y.data(), kept_x / 0.75, 1e-5, 1e-6));
+        ATNN_ASSERT(!atnn::allclose(dropout->forward(xv).data(), y.data())); // a new mask per call
+        // forward mode regenerates the mask of the call too: exactly zero inputs keep their tangents
+        const auto zero = device(at::kFloat).zeros({64, 32});
+        auto dual = atnn::jvp([=](auto xs) { return dropout->forward(xs[0]); }, {zero}, {device(at::kFloat).ones({64, 32})});
+        const auto kept_t = at::Scalar(dual.second[0].ne(0).toType(CPU(at::kFloat)).sum()).toDouble() / zero.numel();
+        ATNN_ASSERT(std::abs(kept_t - 0.75) < 5e-2);
+        ATNN_ASSERT(atnn::allclose(dual.second[0], dual.second[0].ne(0).toType(zero.type()) / 0.75, 1e-5, 1e-6));
+        dropout->training = false;
+        ATNN_ASSERT(atnn::allclose(dropout->forward(xv).data(), xv.data()));
+    });
+}
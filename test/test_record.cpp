@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+#include <atnn/atnn.hpp>
+#include <atnn/data.hpp>
+
+namespace D = atnn::data;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        const long n = 100;
+        const std::string record_path = "/tmp/atnn_test_record.bin";
+        auto x = device(at::kFloat).randn({n, 3, 2});
+        {
+            D::RecordWriter writer(record_path);
+            for (long i = 0; i < n; ++i) {
+                auto label = CPU(at::kLong).zeros({1});
+                label[0] = i;
+                writer.append({x[i], label});
+            }
+        }
+
+        auto records = std::make_shared<D::RecordFile>(record_path);
+        ATNN_ASSERT_EQ(records->size(), n);
+        auto xc = x.toBackend(at::kCPU);
+        for (long i = 0; i < n; ++i) {
+            auto sample = records->get(i);
+            ATNN_ASSERT_EQ(sample.size(), 2);
+            ATNN_ASSERT(atnn::shape_is(sample[0], {3, 2}));
+            ATNN_ASSERT(atnn::allclose(sample[0], xc[i]));
+            ATNN_ASSERT_EQ(at::Scalar(sample[1][0]).toLong(), i);
+        }
+
+        // every record appears once per epoch
+        D::ShuffleOptions options;
+        options.block_size = 8;
+        options.buffer_size = 16;
+        D::ShuffleSource shuffled(records, options);
+        for (int epoch = 0; epoch < 2; ++epoch) {
+            std::set<long> seen;
+            atnn::TList sample;
+            bool in_order = true;
+            while (shuffled.next(sample)) {
+                auto i = at::Scalar(sample[1][0]).toLong();
+                in_order &= i == static_cast<long>(seen.size());
+                seen.insert(i);
+            }
+            ATNN_ASSERT_EQ(seen.size(), n);
+            ATNN_ASSERT(!in_order);
+            shuffled.reset();
+        }
+
+        // truncated or corrupt files are rejected instead of read out of bounds
+        auto rejected = [](auto f) {
+            try {
+                f();
+            } catch (const std::runtime_error&) {
+                return true;
+            }
+            return false;
+        };
+        const std::string broken_path = "/tmp/atnn_test_record_broken.bin";
+        std::string bytes;
+        {
+            std::ifstream in(record_path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        std::ofstream(broken_path, std::ios::binary).write(bytes.data(), bytes.size() / 2);
+        ATNN_ASSERT(rejected([&] { D::RecordFile f(broken_path); }));
+        const uint32_t huge_ndim = 1u << 30;
+        std::memcpy(&bytes[sizeof(D::record::Header) + 12], &huge_ndim, sizeof(huge_ndim)); // the ndim of the first field
+        std::ofstream(broken_path, std::ios::binary).write(bytes.data(), bytes.size());
+        D::RecordFile corrupt(broken_path);
+        ATNN_ASSERT(rejected([&] { corrupt.get(0); }));
+        std::remove(broken_path.c_str());
+        std::remove(record_path.c_str());
+
+        // IDX with 3 images of 2x2 and big endian int labels
+        const std::string images_path = "/tmp/atnn_test_images.idx";
+        const std::string labels_path = "/tmp/atnn_test_labels.idx";
+        {
+            std::ofstream images(images_path, std::ios::binary);
+            const unsigned char header[] = {0, 0, 0x08, 3, 0, 0, 0, 3, 0, 0, 0, 2, 0, 0, 0, 2};
+            images.write(reinterpret_cast<const char*>(header), sizeof(header));
+            for (char i = 0; i < 12; ++i) images.put(i);
+            std::ofstream labels(labels_path, std::ios::binary);
+            const unsigned char lheader[] = {0, 0, 0x0C, 1, 0, 0, 0, 3};
+            labels.write(reinterpret_cast<const char*>(lheader), sizeof(lheader));
+            for (char i = 0; i < 3; ++i) {
+                const char be[] = {0, 0, 1, i}; // 256 + i
+                labels.write(be, sizeof(be));
+            }
+        }
+        auto mnist = D::mnist(images_path, labels_path);
+        ATNN_ASSERT_EQ(mnist->size(), 3);
+        for (long i = 0; i < 3; ++i) {
+            auto sample = mnist->get(i);
+            ATNN_ASSERT(atnn::shape_is(sample[0], {2, 2}));
+            ATNN_ASSERT_EQ(at::Scalar(sample[0][1][1]).toLong(), 4 * i + 3);
+            ATNN_ASSERT_EQ(at::Scalar(sample[1][0]).toLong(), 256 + i);
+        }
+        // no dimensions, a header cut in the sizes, and sizes whose product overflows
+        const std::vector<std::vector<unsigned char>> broken_headers = {
+            {0, 0, 0x08, 0, 1, 2, 3, 4},
+            {0, 0, 0x08, 3, 0, 0, 0, 3, 0, 0},
+            {0, 0, 0x08, 4, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0}}; // 2^64 bytes;
+        for (auto&& header: broken_headers) {
+            std::ofstream(broken_path, std::ios::binary).write(reinterpret_cast<const char*>(header.data()), header.size());
+            ATNN_ASSERT(rejected([&] { D::IdxFile f(broken_path); }));
+        }
+        std::remove(broken_path.c_str());
+        std::remove(images_path.c_str());
+        std::remove(labels_path.c_str());
+    });
+}
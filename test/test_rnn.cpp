@@ -0,0 +1,70 @@
+#include <thread>
+
+#include <atnn/atnn.hpp>
+#include <atnn/serving.hpp>
+
+namespace M = atnn::modules;
+namespace S = atnn::serving;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        auto cell = std::make_shared<M::LSTMCell>(3, 4);
+        if (device == at::CUDA) { cell->toBackend(at::kCUDA); }
+        atnn::Variable x(device(at::kFloat).randn({2, 3}));
+        atnn::Variable h(device(at::kFloat).randn({2, 4}));
+        atnn::Variable c(device(at::kFloat).randn({2, 4}));
+        auto f = [=](auto xs) {
+            auto next = cell->forward(xs[0], xs[1], xs[2]);
+            return atnn::VList {next[0], next[1]};
+        };
+        atnn::grad_check(f, {x, h, c}, {device(at::kFloat).randn({2, 4}), device(at::kFloat).randn({2, 4})}, 1e-2, 1e-2, 1e-3);
+
+        // streams advanced chunk by chunk equal the whole sequences
+        const long sessions = 5, length = 6;
+        auto frames = device(at::kFloat).randn({sessions, length, 3});
+        S::StreamingOptions options;
+        options.max_batch = 4;
+        options.num_workers = 2;
+        S::StreamingServer server(cell, options);
+        std::vector<std::vector<std::future<at::Tensor>>> results(sessions);
+        std::vector<long> begin(sessions, 0);
+        for (long k = 0; k < 3; ++k) { // chunks of 1, 2 and 3 frames in different orders: different time offsets
+            for (long i = 0; i < sessions; ++i) {
+                const long chunk = (k + i) % 3 + 1;
+                results[i].push_back(server.submit(i, frames[i].narrow(0, begin[i], chunk)));
+                begin[i] += chunk;
+            }
+        }
+        for (long i = 0; i < sessions; ++i) {
+            auto state = cell->zero_state(1);
+            long t = 0;
+            for (auto&& r: results[i]) {
+                auto y = r.get();
+                for (long k = 0; k < y.size(0); ++k, ++t) {
+                    state = cell->predict(frames[i][t].view({1, 3}), state[0], state[1]);
+                    ATNN_ASSERT(atnn::allclose(y[k], state[0][0], 1e-5, 1e-6));
+                }
+            }
+            ATNN_ASSERT_EQ(t, length);
+        }
+        auto stats = server.stats();
+        ATNN_ASSERT_EQ(stats.requests, sessions * 3);
+        ATNN_ASSERT(stats.mean_rows_per_step() >= 1);
+        ATNN_ASSERT_EQ(server.cache_stats().misses, sessions); // the first chunks only
+
+        // LRU and expiry
+        S::SessionCache<int> cache(2, std::chrono::milliseconds(50));
+        int value = 0;
+        cache.put(1, 10);
+        cache.put(2, 20);
+        ATNN_ASSERT(cache.get(1, value) && value == 10);
+        cache.put(3, 30); // evicts 2
+        ATNN_ASSERT(!cache.get(2, value));
+        ATNN_ASSERT(cache.get(3, value) && value == 30);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ATNN_ASSERT(!cache.get(1, value));
+        ATNN_ASSERT_EQ(cache.size(), 0);
+        ATNN_ASSERT_EQ(cache.stats().evictions, 1);
+        ATNN_ASSERT_EQ(cache.stats().expirations, 2);
+    });
+}
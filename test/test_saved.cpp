@@ -0,0 +1,91 @@
+#include <atnn/atnn.hpp>
+#include <atnn/saved.hpp>
+
+namespace M = atnn::modules;
+namespace S = atnn::saved;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        // round trips
+        auto x = CPU(at::kFloat).randn({64, 100});
+        auto relu = at::threshold_forward(x, 0, 0, false);
+        auto sparse = S::SparsePolicy(0.75, 0).pack(relu);
+        ATNN_ASSERT(sparse != nullptr);
+        ATNN_ASSERT(atnn::allclose(sparse->unpack(), relu));
+        ATNN_ASSERT(atnn::allclose(sparse->unpack(), relu)); // again
+        ATNN_ASSERT(S::SparsePolicy(0.75, 0).pack(x) == nullptr); // dense
+        ATNN_ASSERT(atnn::allclose(S::HalfPolicy(S::HalfPolicy::BF16, 0).pack(x)->unpack(), x, 1e-2, 1e-6));
+        ATNN_ASSERT(atnn::allclose(S::HalfPolicy(S::HalfPolicy::FP16, 0).pack(x)->unpack(), x, 1e-3, 1e-4));
+        ATNN_ASSERT(S::HalfPolicy().pack(x) == nullptr); // below min_numel
+        ATNN_ASSERT_EQ(S::detail::from_bf16(S::detail::to_bf16(1.0f + 1.0f / 256)), 1.0f); // ties to even
+        ATNN_ASSERT_EQ(S::detail::from_fp16(S::detail::to_fp16(65504.0f)), 65504.0f);
+        ATNN_ASSERT_EQ(S::detail::from_fp16(S::detail::to_fp16(std::ldexp(1.0f, -24))), std::ldexp(1.0f, -24));
+        {
+            S::SpillPolicy spill("/tmp", 0);
+            auto p = spill.pack(x);
+            p->prefetch();
+            ATNN_ASSERT(atnn::allclose(p->unpack(), x));
+            ATNN_ASSERT(atnn::allclose(p->unpack(), x));
+            ATNN_ASSERT_EQ(spill.stats().unpacks, 2);
+        }
+
+        // same gradients with the lossless policies (CUDA tensors are kept as they are)
+        auto l0 = std::make_shared<M::Linear>(100, 64);
+        auto r = std::make_shared<M::ReLU>();
+        auto l1 = std::make_shared<M::Linear>(64, 10);
+        if (device == at::CUDA) {
+            l0->toBackend(at::kCUDA);
+            l1->toBackend(at::kCUDA);
+        }
+        auto input = device(at::kFloat).randn({32, 100});
+        auto gy = device(at::kFloat).randn({32, 10});
+        auto step = [&](std::shared_ptr<atnn::SavedTensorPolicy> policy) {
+            atnn::SavedTensorPolicyGuard guard(policy);
+            for (auto&& p: {l0->weight, l0->bias, l1->weight, l1->bias}) p.ptr->grad = at::Tensor();
+            atnn::Variable xv(input);
+            auto y = l1->forward(r->forward(l0->forward(xv)));
+            y.clear_grads();
+            y.backward(gy);
+            return atnn::TList {l0->weight.grad().clone(), l1->weight.grad().clone(), xv.grad().clone()};
+        };
+        const auto expected = step(nullptr);
+        auto sparse_policy = std::make_shared<S::SparsePolicy>(1.0, 0);
+        auto spill_policy = std::make_shared<S::SpillPolicy>("/tmp", 0);
+        for (std::shared_ptr<S::Policy> policy: {std::shared_ptr<S::Policy>(sparse_policy), std::shared_ptr<S::Policy>(spill_policy)}) {
+            const auto actual = step(policy);
+            for (size_t i = 0; i < expected.size(); ++i) {
+                ATNN_ASSERT(atnn::allclose(actual[i], expected[i], 1e-6));
+            }
+            if (device == at::CPU) ATNN_ASSERT(policy->stats().packs > 0);
+        }
+        const auto half = step(std::make_shared<S::HalfPolicy>(S::HalfPolicy::BF16, 0));
+        ATNN_ASSERT(atnn::allclose(half[0], expected[0], 5e-2, 5e-2));
+
+        // an observed intermediate is read once for the Variable and the Node
+        {
+            atnn::SavedTensorPolicyGuard guard(spill_policy);
+            const auto before = spill_policy->stats();
+            auto h = r->forward(l0->forward(atnn::Variable(input)));
+            auto y = l1->forward(h);
+            h.data();
+            y.backward(gy);
+            const auto after = spill_policy->stats();
+            ATNN_ASSERT_EQ(after.unpacks - before.unpacks, after.packs - before.packs);
+        }
+        // rounding formats leave the Variables held by the user exact
+        {
+            atnn::SavedTensorPolicyGuard guard(std::make_shared<S::HalfPolicy>(S::HalfPolicy::BF16, 0));
+            auto h = l0->forward(atnn::Variable(input));
+            const auto exact = h.data().clone();
+            auto y = l1->forward(r->forward(h));
+            ATNN_ASSERT(atnn::allclose(h.data(), exact, 0, 0));
+            // the ReLU output only the graph holds is released at the next pack
+            auto z = r->forward(y);
+            if (device == at::CPU) {
+                ATNN_ASSERT(y.node->vargs[0].ptr->packed != nullptr);
+                ATNN_ASSERT(!y.node->vargs[0].ptr->data.defined());
+            }
+            ATNN_ASSERT(h.ptr->packed == nullptr);
+        }
+    });
+}
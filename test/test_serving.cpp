@@ -0,0 +1,33 @@
+#include <atnn/atnn.hpp>
+#include <atnn/serving.hpp>
+
+namespace M = atnn::modules;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        auto linear = std::make_shared<M::Linear>(5, 3);
+        auto sigmoid = std::make_shared<M::Sigmoid>();
+        if (device == at::CUDA) { linear->toBackend(at::kCUDA); }
+
+        auto x = device(at::kFloat).randn({8, 5});
+        auto expected = sigmoid->predict(linear->predict(x));
+        ATNN_ASSERT(atnn::allclose(expected, sigmoid->forward(linear->forward(atnn::Variable(x))).data(), 1e-6));
+
+        atnn::serving::BatchingOptions options;
+        options.max_batch = 3;
+        options.num_workers = 2;
+        atnn::serving::BatchingServer server(
+            [=](at::Tensor xs) { return sigmoid->predict(linear->predict(xs)); }, options);
+
+        std::vector<std::future<at::Tensor>> results;
+        for (long i = 0; i < 8; ++i) {
+            results.push_back(server.submit(x[i]));
+        }
+        for (long i = 0; i < 8; ++i) {
+            ATNN_ASSERT(atnn::allclose(results[i].get(), expected[i], 1e-6));
+        }
+        auto stats = server.stats();
+        ATNN_ASSERT_EQ(stats.requests, 8);
+        ATNN_ASSERT(stats.batches >= 3); // at most max_batch per forward
+    });
+}
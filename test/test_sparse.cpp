@@ -0,0 +1,37 @@
+#include <atnn/atnn.hpp>
+#include <atnn/sparse.hpp>
+
+namespace M = atnn::modules;
+namespace S = atnn::sparse;
+
+int main(int argc, char** argv) {
+    atnn::test_common(argc, argv, [](auto device) {
+        if (device == at::CUDA) return; // the sparse kernels are CPU only
+
+        auto linear = std::make_shared<M::Linear>(32, 16);
+        auto x = CPU(at::kFloat).randn({5, 32});
+        auto gy = CPU(at::kFloat).randn({5, 16});
+        for (S::BlockShape block: {S::BlockShape {1, 1}, S::BlockShape {4, 4}, S::BlockShape {8, 1}}) {
+            auto sparse = S::prune(*linear, 0.75, block);
+            ATNN_ASSERT(std::abs(sparse->density() - 0.25) < 1e-6);
+            auto w = sparse->dense_weight();
+            auto mask = sparse->to_dense(sparse->values.data().type().ones_like(sparse->values.data()));
+            ATNN_ASSERT(atnn::allclose(w, linear->weight.data() * mask));
+            ATNN_ASSERT(atnn::allclose(S::SparseLinear(w, linear->bias.data(), block).dense_weight(), w));
+
+            // the same as the dense Linear with the pruned weight
+            atnn::Variable xv(x);
+            auto y = sparse->forward(xv);
+            auto expected = x.mm(w.t()) + linear->bias.data().view({1, 16}).expand({5, 16});
+            ATNN_ASSERT(atnn::allclose(y.data(), expected, 1e-5, 1e-5));
+            y.backward(gy);
+            ATNN_ASSERT(atnn::allclose(xv.grad(), gy.mm(w), 1e-5, 1e-5));
+            // grads of the kept weights only
+            ATNN_ASSERT(atnn::allclose(sparse->to_dense(sparse->values.grad()), gy.t().mm(x) * mask, 1e-5, 1e-5));
+            ATNN_ASSERT(atnn::allclose(sparse->bias.grad(), gy.sum(0), 1e-5, 1e-5));
+        }
+
+        ATNN_ASSERT(S::prune(*linear, 0.9, {4, 4})->nbytes() < linear->weight.data().numel() * sizeof(float) / 4);
+        ATNN_ASSERT_EQ(S::prune(*linear, 1.0)->density(), 0);
+    });
+}